@@ -11,16 +11,18 @@
 #include <termios.h>
 #include <unistd.h>
 
+#include "../main/powermon_protocol.h"
+
 // ------------------------------------------------------------------------------------------------------------------------
 
-#define SERIAL_BUFFER_SIZE   2048
-#define LINE_BUFFER_SIZE     512
+#define SERIAL_BUFFER_SIZE   (2 * PROTOCOL_FRAME_MAX)
 #define RECONNECT_DELAY_SECS 5
 
 // ------------------------------------------------------------------------------------------------------------------------
 
-static bool g_verbose   = false;
-static bool g_reconnect = false;
+static bool g_verbose             = false;
+static bool g_reconnect           = false;
+static char g_capture_prefix[128] = "powermon-capture";
 
 static bool parse_config(const char *file) {
 
@@ -51,6 +53,8 @@ static bool parse_config(const char *file) {
             g_verbose = (strcmp(value, "true") == 0);
         if (strcmp(key, "reconnect") == 0)
             g_reconnect = (strcmp(value, "true") == 0);
+        if (strcmp(key, "capture") == 0)
+            snprintf(g_capture_prefix, sizeof(g_capture_prefix), "%s", value);
     }
 
     fclose(fp);
@@ -100,13 +104,46 @@ error:
     return -1;
 }
 
+static void serial_command(const int fd) {
+
+    // commands typed (or piped) on stdin go to the device, a line at a time
+    static char command_buffer[PROTOCOL_MESSAGE_SIZE];
+    static size_t command_length = 0;
+    static bool command_closed   = false;
+
+    if (command_closed)
+        return;
+    const int flags = fcntl(STDIN_FILENO, F_GETFL);
+    if (flags < 0 || !(flags & O_NONBLOCK))
+        (void)fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+    char c;
+    ssize_t r;
+    while ((r = read(STDIN_FILENO, &c, 1)) == 1) {
+        if (c == '\n') {
+            command_buffer[command_length++] = '\n';
+            if (write(fd, command_buffer, command_length) != (ssize_t)command_length)
+                fprintf(stderr, "error: command write (%s)\n", strerror(errno));
+            command_length = 0;
+        } else if (command_length < sizeof(command_buffer) - 1)
+            command_buffer[command_length++] = c;
+    }
+    if (r == 0)
+        command_closed = true;
+}
+
 static void serial_close(const int fd) {
 
     if (fd >= 0)
         close(fd);
 }
 
-static bool serial_readline(const int fd, char *line, const size_t line_size) {
+typedef enum {
+    SERIAL_NONE = 0,
+    SERIAL_LINE,  // text line, terminated
+    SERIAL_FRAME, // binary frame, between delimiters (still encoded)
+} serial_data_t;
+
+static serial_data_t serial_read(const int fd, char *data, const size_t data_size, size_t *data_length) {
 
     static char serial_buffer[SERIAL_BUFFER_SIZE];
     static ssize_t serial_length = 0;
@@ -123,21 +160,48 @@ static bool serial_readline(const int fd, char *line, const size_t line_size) {
         }
     }
 
+    // frames are delimited both sides: skip any run of delimiters to the start of the next frame, and any partial frame before
+    ssize_t serial_start = 0;
+    for (int i = 0; i < serial_length && serial_buffer[i] != '\n'; i++)
+        if (serial_buffer[i] == PROTOCOL_DELIMITER && (i + 1 >= serial_length || serial_buffer[i + 1] != PROTOCOL_DELIMITER)) {
+            serial_start = i;
+            break;
+        }
+    if (serial_start > 0) {
+        memmove(serial_buffer, &serial_buffer[serial_start], (size_t)(serial_length - serial_start));
+        serial_length -= serial_start;
+    }
+
     if (serial_length > 0) {
-        ssize_t serial_offset = -1;
-        for (int i = 0; i < serial_length && serial_offset < 0; i++)
-            if (serial_buffer[i] == '\n')
+        const bool serial_frame = serial_buffer[0] == PROTOCOL_DELIMITER;
+        const char serial_end   = serial_frame ? PROTOCOL_DELIMITER : '\n';
+        ssize_t serial_offset   = -1;
+        for (int i = serial_frame ? 1 : 0; i < serial_length && serial_offset < 0; i++)
+            if (serial_buffer[i] == serial_end)
                 serial_offset = i;
         if (serial_offset >= 0) {
-            serial_buffer[serial_offset] = '\0';
-            if (serial_offset > 0 && serial_buffer[serial_offset - 1] == '\r')
-                serial_buffer[serial_offset - 1] = '\0';
-            strncpy(line, serial_buffer, line_size);
+            serial_data_t serial_data = SERIAL_NONE;
+            if (serial_frame) {
+                const size_t frame_length = (size_t)serial_offset - 1;
+                if (frame_length <= data_size) {
+                    memcpy(data, &serial_buffer[1], frame_length);
+                    *data_length = frame_length;
+                    serial_data  = SERIAL_FRAME;
+                } else
+                    fprintf(stderr, "error: frame too large (%zu bytes), discarding\n", frame_length);
+            } else {
+                serial_buffer[serial_offset] = '\0';
+                if (serial_offset > 0 && serial_buffer[serial_offset - 1] == '\r')
+                    serial_buffer[serial_offset - 1] = '\0';
+                strncpy(data, serial_buffer, data_size);
+                *data_length = strlen(data);
+                serial_data  = SERIAL_LINE;
+            }
             const ssize_t serial_remain = serial_length - serial_offset - 1;
             if (serial_remain > 0)
                 memmove(serial_buffer, &serial_buffer[serial_offset + 1], (size_t)serial_remain);
             serial_length = serial_remain;
-            return true;
+            return serial_data;
         }
     }
 
@@ -146,7 +210,95 @@ static bool serial_readline(const int fd, char *line, const size_t line_size) {
         serial_length = 0;
     }
 
-    return false;
+    return SERIAL_NONE;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    float voltage, current, phase, power_real, power_apparent, power_factor, energy_import, energy_export, run_hours;
+    bool voltage_valid, current_valid, power_present, energy_present;
+    char voltage_fault[32], current_fault[32];
+} read_device_t;
+
+static void print_read_device(const int device, const read_device_t *read) {
+
+    const bool power_valid = read->voltage_valid && read->current_valid;
+
+    if (device > 0)
+        printf(" ");
+    printf("[%d] ", device + 1);
+    printf(!read->voltage_valid ? "-," : "%.6fV,", read->voltage);
+    printf(!read->current_valid ? "-," : "%.6fA,", read->current);
+    printf(!power_valid ? "-" : "%+06.1f°", read->phase);
+    if (read->power_present) {
+        printf(!power_valid ? " -," : " %+.3fW,", read->power_real);
+        printf(!power_valid ? "-," : "%.3fVA,", read->power_apparent);
+        printf(!power_valid ? "-" : "%+.3fPF", read->power_factor);
+    }
+    if (read->energy_present)
+        printf(" %.1f/%.1fWh,%.3fh", read->energy_import, read->energy_export, read->run_hours);
+    printf(" (%s,%s)", read->voltage_fault, read->current_fault);
+}
+
+static read_device_t read_devices[PROTOCOL_DEVICES_MAX]; // as last present, so sparse READs (report by exception) print whole
+static int read_devices_count = 0;
+
+static void update_read_device(const int device, const read_device_t *read) {
+
+    if (device < 0 || device >= PROTOCOL_DEVICES_MAX)
+        return;
+    read_devices[device] = *read;
+    if (device >= read_devices_count)
+        read_devices_count = device + 1;
+}
+
+static void print_read_devices(void) {
+
+    for (int device = 0; device < read_devices_count; device++)
+        print_read_device(device, &read_devices[device]);
+}
+
+static void print_read_frequency(const float frequency) { printf(frequency > 0.0 ? " %.3fHz" : " -Hz", frequency); } // 0 if not measured
+
+typedef struct {
+    float offset;
+    float offset_delta;
+    float noise;
+    unsigned long samples;
+    char faults[128];
+} diag_sensor_t;
+
+static void print_diag_device(const int device, const diag_sensor_t *voltage, const diag_sensor_t *current) {
+
+    if (device > 0)
+        printf(" ");
+    printf("[%d] ", device + 1);
+    printf("%.1f%+.1f,%.1f,%lu,%s;", voltage->offset, voltage->offset_delta, voltage->noise, voltage->samples, voltage->faults);
+    printf("%.1f%+.1f,%.1f,%lu,%s", current->offset, current->offset_delta, current->noise, current->samples, current->faults);
+}
+
+static void print_cycle_device(const int device, const float voltage, const float current) { printf(" [%d] %.3fV,%.4fA", device + 1, voltage, current); }
+
+static void print_cycle_trigger(const unsigned long dropped, const unsigned long trigger) {
+
+    printf(" (dropped=%lu,trigger=", dropped);
+    if (trigger == 0)
+        printf("-");
+    for (int d = 0, o = 0; d < 16; d++) {
+        if (trigger & (1UL << d))
+            printf("%sI%d", o++ == 0 ? "" : "/", d + 1);
+        if (trigger & (1UL << (16 + d)))
+            printf("%sV%d", o++ == 0 ? "" : "/", d + 1);
+    }
+    printf(")");
+}
+
+static void print_event(const int device, const char *event, const bool active, const float before, const float after, const char *fault) {
+
+    printf(" [%d] %s %s %.4f>%.4f", device + 1, event, active ? "raised" : "cleared", before, after);
+    if (strcmp(fault, "OK") != 0)
+        printf(" (%s)", fault);
 }
 
 // ------------------------------------------------------------------------------------------------------------------------
@@ -155,29 +307,42 @@ static void process_line_read(const uint64_t timestamp, const uint64_t sequence,
 
     printf("%" PRIx64 " %" PRIx64 " READ ", timestamp, sequence);
 
-    const char *ptr = data;
-    int device      = 0;
+    const char *ptr       = data;
+    int device            = 0;
+    unsigned long present = ~0UL; // all, in order, unless report by exception
+    float frequency       = -1.0;
+
+    if (ptr && sscanf(ptr, "@%lx", &present) == 1 && (ptr = strchr(ptr, ' ')) != NULL)
+        ptr++;
 
     while (ptr && *ptr) {
 
-        float voltage, current, phase;
-        char voltage_fault[32], current_fault[32];
+        read_device_t read;
 
-        if (sscanf(ptr, "%f,%f,%f,%31[^,],%31[^, ]", &voltage, &current, &phase, voltage_fault, current_fault) != 5)
+        const int fields = sscanf(ptr, "%f,%f,%f,%31[^,],%31[^, ],%f,%f,%f,%f,%f,%f", &read.voltage, &read.current, &read.phase, read.voltage_fault, read.current_fault,
+                                  &read.power_real, &read.power_apparent, &read.power_factor, &read.energy_import, &read.energy_export, &read.run_hours);
+        if (fields == 1 && strchr(ptr, ',') == NULL) {
+            frequency = read.voltage;
+            break;
+        }
+        if (fields != 5 && fields != 8 && fields != 11)
             break;
 
-        if (device > 0)
-            printf(" ");
-        printf("[%d] ", device + 1);
-        printf(voltage > 900.0 ? "-," : "%.6fV,", voltage);
-        printf(current > 90.0 ? "-," : "%.6fA,", current);
-        printf(voltage > 900.0 || current > 90.0 ? "-" : "%+04.0f°", phase);
-        printf(" (%s,%s)", voltage_fault, current_fault);
+        read.voltage_valid  = read.voltage <= 900.0;
+        read.current_valid  = read.current <= 90.0;
+        read.power_present  = fields >= 8;
+        read.energy_present = fields == 11;
+        while (device < PROTOCOL_DEVICES_MAX && !(present & (1UL << device)))
+            device++;
+        update_read_device(device, &read);
 
         device++;
         if ((ptr = strchr(ptr, ' ')) != NULL)
             ptr++;
     }
+    print_read_devices();
+    if (frequency >= 0.0)
+        print_read_frequency(frequency);
 
     printf("\n");
     fflush(stdout);
@@ -192,23 +357,62 @@ static void process_line_diag(const uint64_t timestamp, const uint64_t sequence,
 
     while (ptr && *ptr) {
 
-        float voltage_offset, current_offset;
-        unsigned long voltage_samples, current_samples;
-        char voltage_faults[128], current_faults[128];
+        diag_sensor_t voltage, current;
 
-        if (sscanf(ptr, "%f,%lu,%127[^;];%f,%lu,%127[^; ]", &voltage_offset, &voltage_samples, voltage_faults, &current_offset, &current_samples, current_faults) != 6)
+        if (sscanf(ptr, "%lu,%f,%f,%f,%127[^;];%lu,%f,%f,%f,%127[^; ]", &voltage.samples, &voltage.offset, &voltage.offset_delta, &voltage.noise, voltage.faults,
+                   &current.samples, &current.offset, &current.offset_delta, &current.noise, current.faults) != 10)
             break;
 
-        if (device > 0)
-            printf(" ");
-        printf("[%d] ", device + 1);
-        printf("%.1f,%lu,%s;", voltage_offset, voltage_samples, voltage_faults);
-        printf("%.1f,%lu,%s", current_offset, current_samples, current_faults);
+        print_diag_device(device, &voltage, &current);
 
         device++;
         if ((ptr = strchr(ptr, ' ')) != NULL)
             ptr++;
     }
+    if (ptr && *ptr)
+        printf(" %s", ptr); // trailing counters
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static void process_line_cycl(const uint64_t timestamp, const uint64_t sequence, const char *data) {
+
+    unsigned long dropped, trigger;
+    if (data == NULL || sscanf(data, "%lu,%lx", &dropped, &trigger) != 2)
+        return;
+
+    printf("%" PRIx64 " %" PRIx64 " CYCL", timestamp, sequence);
+
+    const char *ptr = strchr(data, ' ');
+    while (ptr && *++ptr) {
+
+        int device;
+        float voltage, current;
+
+        if (sscanf(ptr, "%d:%f,%f", &device, &voltage, &current) != 3)
+            break;
+
+        print_cycle_device(device - 1, voltage, current);
+
+        ptr = strchr(ptr, ' ');
+    }
+    print_cycle_trigger(dropped, trigger);
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static void process_line_evnt(const uint64_t timestamp, const uint64_t sequence, const char *data) {
+
+    int device;
+    char event[16], state[16], fault[16];
+    float before, after;
+    if (data == NULL || sscanf(data, "%d:%15[^,],%15[^,],%f,%f,%15s", &device, event, state, &before, &after, fault) != 6)
+        return;
+
+    printf("%" PRIx64 " %" PRIx64 " EVNT", timestamp, sequence);
+    print_event(device - 1, event, strcmp(state, "raise") == 0, before, after, fault);
 
     printf("\n");
     fflush(stdout);
@@ -261,12 +465,358 @@ static void process_line(const char *line) {
         process_line_read(timestamp, sequence, ptr);
     else if (strcmp(type, "DIAG") == 0)
         process_line_diag(timestamp, sequence, ptr);
-    else if (strcmp(type, "INIT") == 0 || strcmp(type, "TERM") == 0 || strcmp(type, "FAIL") == 0)
+    else if (strcmp(type, "CYCL") == 0)
+        process_line_cycl(timestamp, sequence, ptr);
+    else if (strcmp(type, "EVNT") == 0)
+        process_line_evnt(timestamp, sequence, ptr);
+    else if (strcmp(type, "INIT") == 0 || strcmp(type, "TERM") == 0 || strcmp(type, "FAIL") == 0 || strcmp(type, "HARM") == 0 || strcmp(type, "CMND") == 0 ||
+             strcmp(type, "PERF") == 0)
         process_line_rest(timestamp, sequence, type, ptr);
 }
 
 // ------------------------------------------------------------------------------------------------------------------------
 
+static const char *fault2str(const uint8_t fault) {
+    static const char *faults_str[PROTOCOL_FAULTS_NUM] = { "OK", "E_COUNT", "E_ABOVE", "E_BELOW", "E_ISNAN", "E_ZOFFS" }; // as firmware
+    return fault < PROTOCOL_FAULTS_NUM ? faults_str[fault] : "E_UNKNW";
+}
+
+static const char *event2str(const uint8_t event) {
+    static const char *events_str[PROTOCOL_EVENTS_NUM] = { "V_OVER", "V_UNDER", "V_LOSS", "I_OVER", "I_STEP", "V_FAULT", "I_FAULT" }; // as firmware
+    return event < PROTOCOL_EVENTS_NUM ? events_str[event] : "E_UNKNW";
+}
+
+static void process_frame_init(const protocol_header_t *header, const uint8_t *body) {
+
+    const protocol_init_t *init = (const protocol_init_t *)body;
+    if (header->length < sizeof(protocol_init_t) + (init->devices * sizeof(protocol_calibration_t)))
+        return;
+
+    const protocol_calibration_t *calibration = (const protocol_calibration_t *)(body + sizeof(protocol_init_t));
+    printf("%" PRIx64 " %" PRIx64 " INIT", (uint64_t)header->timestamp, header->counter);
+    printf(" type=%.*s,vers=%.*s,arch=%.*s,serial=%.*s,hw-voltage=%.*s,hw-current=", PROTOCOL_STRING_SIZE, init->type, PROTOCOL_STRING_SIZE, init->version,
+           PROTOCOL_STRING_SIZE, init->platform, PROTOCOL_STRING_SIZE, init->serial, PROTOCOL_STRING_SIZE, init->sensor_voltage);
+    for (int d = 0; d < init->devices; d++)
+        printf("%s%.*s-%u", d == 0 ? "" : "/", PROTOCOL_STRING_SIZE, init->sensor_current, calibration[d].current_rating);
+    printf(",voltage-freq=auto,voltage-max=%.0f,current-max=%.0f", (double)init->voltage_max, (double)init->current_max);
+    printf(",devices=%u,period-read=%" PRIu32 ",period-diag=%" PRIu32 ",debug-pin=%s", init->devices, init->period_read, init->period_diag,
+           (init->flags & PROTOCOL_INIT_DEBUG) ? "yes" : "no");
+    printf(",adc-mode=%s,phase-mode=%s,harmonics=%u", (init->flags & PROTOCOL_INIT_CONTINUOUS) ? "continuous" : "windowed",
+           (init->flags & PROTOCOL_INIT_GOERTZEL) ? "goertzel" : "crossing", init->harmonics);
+    printf(",stream=%s", (init->flags & PROTOCOL_INIT_STREAM) ? ((init->flags & PROTOCOL_INIT_STREAM_ALL) ? "all" : "triggered") : "none");
+    printf(",adc-bits=%u,adc-rate=%" PRIu32 "kHz,adc-size-frame=%u,adc-size-pool=%u,adc-pins=", init->adc_bits, init->adc_rate / 1000, init->adc_frame_size,
+           init->adc_pool_size);
+    for (int d = 0; d < init->devices; d++)
+        printf("%s%u", d == 0 ? "" : "/", calibration[d].current_pin);
+    for (int d = 0; d < init->devices; d++)
+        printf("/%u", calibration[d].voltage_pin);
+    printf(",adc-linear=%s", (init->flags & PROTOCOL_INIT_LINEAR) ? "efuse" : "none");
+    printf(",calibrations=");
+    for (int d = 0; d < init->devices; d++)
+        printf("%s%.3f%+.1fV/%.3f%+.1fC", d == 0 ? "" : ";", (double)calibration[d].voltage_gain, (double)calibration[d].voltage_offset, (double)calibration[d].current_gain,
+               (double)calibration[d].current_offset);
+    printf(",settings=%s,protocol=binary\n", (init->flags & PROTOCOL_INIT_SETTINGS) ? "stored" : "default");
+    fflush(stdout);
+}
+
+static void process_frame_read(const protocol_header_t *header, const uint8_t *body) {
+
+    const protocol_read_t *read_header = (const protocol_read_t *)body;
+    if (header->length < sizeof(protocol_read_t) + (read_header->devices * sizeof(protocol_read_device_t)))
+        return;
+
+    printf("%" PRIx64 " %" PRIx64 " READ ", (uint64_t)header->timestamp, header->counter);
+
+    const protocol_read_device_t *devices = (const protocol_read_device_t *)(body + sizeof(protocol_read_t));
+    for (int device = 0, index = 0; device < PROTOCOL_DEVICES_MAX && index < read_header->devices; device++) {
+        if (!(read_header->present & (1U << device)))
+            continue;
+        const protocol_read_device_t *record = &devices[index++];
+        read_device_t read                   = {
+            .voltage        = record->voltage,
+            .current        = record->current,
+            .phase          = record->phase,
+            .power_real     = record->power_real,
+            .power_apparent = record->power_apparent,
+            .power_factor   = record->power_factor,
+            .energy_import  = record->energy_import,
+            .energy_export  = record->energy_export,
+            .run_hours      = record->run_hours,
+            .voltage_valid  = record->voltage_fault == 0,
+            .current_valid  = record->current_fault == 0,
+            .power_present  = true,
+            .energy_present = true,
+        };
+        snprintf(read.voltage_fault, sizeof(read.voltage_fault), "%s", fault2str(record->voltage_fault));
+        snprintf(read.current_fault, sizeof(read.current_fault), "%s", fault2str(record->current_fault));
+        update_read_device(device, &read);
+    }
+    print_read_devices();
+    print_read_frequency(read_header->frequency);
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static void print_harmonics(const protocol_harmonics_t *harmonics) {
+
+    printf("%.2f", (double)harmonics->thd);
+    for (int t = 0; t < PROTOCOL_HARMONICS_TOP && harmonics->order[t] > 0; t++)
+        printf("%s%u:%.2f", t == 0 ? "," : "/", harmonics->order[t], (double)harmonics->percent[t]);
+    if (harmonics->order[0] == 0)
+        printf(",-");
+}
+
+static void process_frame_harm(const protocol_header_t *header, const uint8_t *body) {
+
+    const protocol_harm_t *harm = (const protocol_harm_t *)body;
+    if (header->length < sizeof(protocol_harm_t) + (harm->devices * 2 * sizeof(protocol_harmonics_t)))
+        return;
+
+    printf("%" PRIx64 " %" PRIx64 " HARM", (uint64_t)header->timestamp, header->counter);
+
+    const protocol_harmonics_t *harmonics = (const protocol_harmonics_t *)(body + sizeof(protocol_harm_t));
+    for (int device = 0; device < harm->devices; device++) {
+        printf(" ");
+        print_harmonics(&harmonics[(device * 2) + 0]);
+        printf(";");
+        print_harmonics(&harmonics[(device * 2) + 1]);
+    }
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static void convert_diag_sensor(const protocol_diag_sensor_t *sensor_record, diag_sensor_t *sensor) {
+
+    sensor->offset       = sensor_record->offset;
+    sensor->offset_delta = sensor_record->offset_delta;
+    sensor->noise        = sensor_record->noise;
+    sensor->samples      = sensor_record->samples;
+    for (int f = 0, o = 0; f < PROTOCOL_FAULTS_NUM; f++)
+        o += snprintf(&sensor->faults[o], sizeof(sensor->faults) - (size_t)o, "%s%" PRIu32, f == 0 ? "" : "/", sensor_record->faults[f]);
+}
+
+static void process_frame_diag(const protocol_header_t *header, const uint8_t *body) {
+
+    const protocol_diag_t *diag = (const protocol_diag_t *)body;
+    if (header->length < sizeof(protocol_diag_t) + (diag->devices * 2 * sizeof(protocol_diag_sensor_t)))
+        return;
+
+    printf("%" PRIx64 " %" PRIx64 " DIAG ", (uint64_t)header->timestamp, header->counter);
+
+    const protocol_diag_sensor_t *sensors = (const protocol_diag_sensor_t *)(body + sizeof(protocol_diag_t));
+    for (int device = 0; device < diag->devices; device++) {
+        diag_sensor_t voltage, current;
+        convert_diag_sensor(&sensors[(device * 2) + 0], &voltage);
+        convert_diag_sensor(&sensors[(device * 2) + 1], &current);
+        print_diag_device(device, &voltage, &current);
+    }
+    printf(" cycles=%" PRIu32 "/%" PRIu32 " windows=%" PRIu32 "/%" PRIu32 " overflows=%" PRIu32, diag->cycles, diag->cycles_dropped, diag->windows, diag->windows_dropped,
+           diag->adc_overflows);
+    printf(" recovered=%" PRIu32 "/%" PRIu32, diag->adc_restarts, diag->adc_reinits);
+    printf(" schedule=%" PRIu32 "/%" PRIu32 "/%" PRIu32, diag->schedule_jitter, diag->schedule_max, diag->schedule_late);
+    printf(" output=%" PRIu32 "/%" PRIu32 "/%" PRIu32 "/%" PRIu32, diag->output_queued, diag->output_sent, diag->output_dropped, diag->output_peak);
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static void process_frame_fail(const protocol_header_t *header, const uint8_t *body) {
+
+    const protocol_fail_t *fail = (const protocol_fail_t *)body;
+    if (header->length < sizeof(protocol_fail_t))
+        return;
+
+    printf("%" PRIx64 " %" PRIx64 " FAIL %.*s, error %" PRId32 " (%.*s)\n", (uint64_t)header->timestamp, header->counter, PROTOCOL_MESSAGE_SIZE, fail->message, fail->error,
+           (int)sizeof(fail->error_name), fail->error_name);
+    fflush(stdout);
+}
+
+static void process_frame_cycl(const protocol_header_t *header, const uint8_t *body) {
+
+    const protocol_cycle_t *cycle = (const protocol_cycle_t *)body;
+    if (header->length < sizeof(protocol_cycle_t) + (cycle->devices * sizeof(protocol_cycle_device_t)))
+        return;
+
+    printf("%" PRIx64 " %" PRIx64 " CYCL", (uint64_t)header->timestamp, header->counter);
+
+    const protocol_cycle_device_t *devices = (const protocol_cycle_device_t *)(body + sizeof(protocol_cycle_t));
+    for (int device = 0; device < cycle->devices; device++)
+        print_cycle_device(devices[device].device, devices[device].voltage, devices[device].current);
+    print_cycle_trigger(cycle->dropped, cycle->trigger);
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static void process_frame_evnt(const protocol_header_t *header, const uint8_t *body) {
+
+    const protocol_event_t *event = (const protocol_event_t *)body;
+    if (header->length < sizeof(protocol_event_t))
+        return;
+
+    printf("%" PRIx64 " %" PRIx64 " EVNT", (uint64_t)header->timestamp, header->counter);
+    print_event(event->device, event2str(event->event), event->active != 0, event->before, event->after, fault2str(event->fault));
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static void process_frame_perf(const protocol_header_t *header, const uint8_t *body) {
+
+    static const char *const stages[PROTOCOL_PERF_STAGES] = { "extract", "calculate", "output", "loop" };
+    const protocol_perf_t *perf                           = (const protocol_perf_t *)body;
+    if (header->length < sizeof(protocol_perf_t))
+        return;
+
+    printf("%" PRIx64 " %" PRIx64 " PERF", (uint64_t)header->timestamp, header->counter);
+    for (int s = 0; s < PROTOCOL_PERF_STAGES; s++) {
+        printf(" %s=%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",", stages[s], perf->stages[s].count, perf->stages[s].mean, perf->stages[s].max);
+        for (int b = 0; b < PROTOCOL_PERF_BUCKETS; b++)
+            printf("%s%" PRIu32, b == 0 ? "" : "/", perf->stages[s].buckets[b]);
+    }
+    printf(" idle=");
+    for (int core = 0; core < PROTOCOL_PERF_CORES; core++)
+        if (perf->idle[core] < 0)
+            printf("%s-", core == 0 ? "" : "/");
+        else
+            printf("%s%.1f", core == 0 ? "" : "/", perf->idle[core]);
+    printf(" stack=");
+    for (int t = 0; t < PROTOCOL_PERF_TASKS; t++)
+        printf("%s%" PRIu32, t == 0 ? "" : "/", perf->stack[t]);
+    printf(" heap=%" PRIu32 "/%" PRIu32, perf->heap_free, perf->heap_min);
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static void process_frame_cmnd(const protocol_header_t *header, const uint8_t *body) {
+
+    const protocol_command_t *command = (const protocol_command_t *)body;
+    if (header->length < sizeof(protocol_command_t))
+        return;
+
+    printf("%" PRIx64 " %" PRIx64 " CMND %.*s\n", (uint64_t)header->timestamp, header->counter, PROTOCOL_RESPONSE_SIZE, command->response);
+    fflush(stdout);
+}
+
+static void capture_save(const protocol_capture_t *capture, const uint16_t *samples) {
+
+    char filename[sizeof(g_capture_prefix) + 32];
+    snprintf(filename, sizeof(filename), "%s-%" PRIu32 ".csv", g_capture_prefix, capture->capture);
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        fprintf(stderr, "error: cannot open capture file '%s' (%s)\n", filename, strerror(errno));
+        return;
+    }
+
+    int sensors[32], sensors_count = 0;
+    for (int s = 0; s < 32; s++)
+        if (capture->sensors & (1UL << s))
+            sensors[sensors_count++] = s;
+
+    fprintf(fp, "# capture %" PRIu32 ", %" PRIu32 " cycles, %" PRIu32 " Hz per sensor, raw adc\n", capture->capture, (uint32_t)capture->cycles, capture->rate);
+    fprintf(fp, "time_us");
+    for (int s = 0; s < sensors_count; s++)
+        fprintf(fp, ",sensor%d", sensors[s]);
+    fprintf(fp, "\n");
+    for (uint32_t i = 0; i + (uint32_t)sensors_count <= capture->total; i += (uint32_t)sensors_count) {
+        fprintf(fp, "%.1f", ((double)(i / (uint32_t)sensors_count) * 1000000.0) / (double)capture->rate);
+        for (int s = 0; s < sensors_count; s++)
+            fprintf(fp, ",%u", samples[i + (uint32_t)s]);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+
+    fprintf(stderr, "capture %" PRIu32 " saved to '%s' (%" PRIu32 " samples)\n", capture->capture, filename, capture->total);
+}
+
+static void process_frame_capt(const protocol_header_t *header, const uint8_t *body) {
+
+    static protocol_capture_t capture;
+    static uint16_t *samples = NULL;
+    static uint32_t received = 0;
+
+    const protocol_capture_t *chunk = (const protocol_capture_t *)body;
+    if (header->length < sizeof(protocol_capture_t) + (chunk->samples * sizeof(uint16_t)) || chunk->offset + chunk->samples > chunk->total)
+        return;
+
+    if (chunk->offset == 0) {
+        free(samples);
+        if ((samples = (uint16_t *)malloc(chunk->total * sizeof(uint16_t))) == NULL)
+            return;
+        capture  = *chunk;
+        received = 0;
+    } else if (samples == NULL || chunk->capture != capture.capture || chunk->offset != received) {
+        fprintf(stderr, "error: capture %" PRIu32 " chunk out of sequence, discarding\n", chunk->capture);
+        return;
+    }
+    memcpy(&samples[chunk->offset], body + sizeof(protocol_capture_t), chunk->samples * sizeof(uint16_t));
+    received += chunk->samples;
+
+    if (received == capture.total) {
+        capture_save(&capture, samples);
+        free(samples);
+        samples = NULL;
+    }
+}
+
+static void process_frame(const uint8_t *frame, const size_t frame_length) {
+
+    static uint8_t record[PROTOCOL_RECORD_MAX];
+
+    if (protocol_frame_decode(frame, frame_length, record, sizeof(record)) == 0) {
+        fprintf(stderr, "error: failed to decode frame (%zu bytes)\n", frame_length);
+        return;
+    }
+
+    const protocol_header_t *header = (const protocol_header_t *)record;
+    const uint8_t *body             = &record[sizeof(protocol_header_t)];
+
+    switch ((protocol_type_t)header->type) {
+    case PROTOCOL_TYPE_INIT:
+        process_frame_init(header, body);
+        break;
+    case PROTOCOL_TYPE_TERM:
+        process_line_rest((uint64_t)header->timestamp, header->counter, "TERM", NULL);
+        break;
+    case PROTOCOL_TYPE_READ:
+        process_frame_read(header, body);
+        break;
+    case PROTOCOL_TYPE_HARM:
+        process_frame_harm(header, body);
+        break;
+    case PROTOCOL_TYPE_DIAG:
+        process_frame_diag(header, body);
+        break;
+    case PROTOCOL_TYPE_FAIL:
+        process_frame_fail(header, body);
+        break;
+    case PROTOCOL_TYPE_CYCL:
+        process_frame_cycl(header, body);
+        break;
+    case PROTOCOL_TYPE_CMND:
+        process_frame_cmnd(header, body);
+        break;
+    case PROTOCOL_TYPE_CAPT:
+        process_frame_capt(header, body);
+        break;
+    case PROTOCOL_TYPE_EVNT:
+        process_frame_evnt(header, body);
+        break;
+    case PROTOCOL_TYPE_PERF:
+        process_frame_perf(header, body);
+        break;
+    default:
+        if (g_verbose)
+            fprintf(stderr, "error: unknown frame type %u\n", header->type);
+        break;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
 static volatile bool g_running = true;
 
 static void signal_handler(__attribute__((unused)) int sig) { g_running = false; }
@@ -307,9 +857,15 @@ int main(const int argc, const char *argv[]) {
 
             while (g_running) {
 
-                char line[LINE_BUFFER_SIZE];
-                if (serial_readline(fd, line, sizeof(line)))
-                    process_line(line);
+                serial_command(fd);
+
+                char data[PROTOCOL_FRAME_MAX];
+                size_t data_length       = 0;
+                const serial_data_t kind = serial_read(fd, data, sizeof(data), &data_length);
+                if (kind == SERIAL_LINE)
+                    process_line(data);
+                else if (kind == SERIAL_FRAME)
+                    process_frame((const uint8_t *)data, data_length);
                 else if (!serial_check(device)) {
                     fprintf(stderr, "device '%s' disconnected\n", device);
                     break;
@@ -1,27 +1,42 @@
 
 /*
- * ESP32-S3 AC Power Monitor - 300VAC, 30A via. ACS712 and ZMPT101B sensors: 5 devices (10 sensors), output over USB
+ * ESP32-S3 AC Power Monitor - 300VAC, 30A via. ACS712 and ZMPT101B sensors: 5 devices (10 sensors), or 8 (16) with ADC2, output over USB
  */
 
 // ------------------------------------------------------------------------------------------------------------------------
 
 #include "driver/gpio.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
 #include "esp_adc/adc_continuous.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
 #include "esp_err.h"
 #include "esp_mac.h"
+#include "esp_system.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "powermon_protocol.h"
+#include "powermon_ring.h"
 #include "tinyusb.h"
 #include "tusb_cdc_acm.h"
 #include "tusb_console.h"
+#include <limits.h>
 #include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // ------------------------------------------------------------------------------------------------------------------------
 
 #define __MIN(a, b)  ((a) < (b) ? (a) : (b))
+#define __MAX(a, b)  ((a) > (b) ? (a) : (b))
 
 #define US_PER_MS    1000
 #define MAX_STR_SIZE 256
@@ -44,24 +59,109 @@ void __app_init(void) {
 #define SYSTEM_VERSION                    "1.00"
 #define SYSTEM_PLATFORM                   "esp32s3"
 #define SYSTEM_SENSOR_VOLTAGE             "zmpt101b"
-#define SYSTEM_SENSOR_CURRENT             "acs712-30"
+#define SYSTEM_SENSOR_CURRENT             "acs712"
 
 // ------------------------------------------------------------------------------------------------------------------------
 
 // System
+#define ADC_DUAL_UNIT                     0                                                 // ADC2 alongside ADC1 for 8 devices (ADC2 has 8 channels free of USB)
+#if ADC_DUAL_UNIT
+#define NUM_DEVICES                       8
+#else
 #define NUM_DEVICES                       5
+#endif
 #define NUM_SENSORS                       (NUM_DEVICES + NUM_DEVICES)
-#define REPORTINGS_PERIOD_MS              5000                                              // Output every 5 seconds
-#define AC_FREQUENCY_HZ                   60                                                // 60Hz AC mains
-#define SAMPLES_PER_CYCLE                 64                                                // Samples per AC cycle
-#define NUM_CYCLES_TO_SAMPLE              5                                                 // Sample 5 cycles for accuracy (~83ms @ 60Hz)
-#define SAMPLE_DURATION_MS                ((NUM_CYCLES_TO_SAMPLE * 1000) / AC_FREQUENCY_HZ) // Sampling duration (5 cycles at 60Hz = ~83ms)
-#define NUM_SAMPLES                       (SAMPLES_PER_CYCLE * NUM_CYCLES_TO_SAMPLE)        // 320 samples per sensor
-#define DIAGNOSTIC_PERIOD_MS              60000                                             // Output diagnostics every 60 seconds
+#define REPORTINGS_PERIOD_MS              5000                                              // Output every 5 seconds (default, see settings)
+#define AC_FREQUENCY_HZ                   50                                                // Initial estimate, until measured from voltage crossings
+#define AC_FREQUENCY_MIN_HZ               45                                                // Range accepted for measured frequency
+#define AC_FREQUENCY_MAX_HZ               65                                                //
+#define FREQUENCY_SIGNAL_MIN              50.0                                              // Voltage RMS (ADC counts, ~40V) needed to track frequency
+#define SAMPLES_PER_CYCLE                 64                                                // Samples per AC cycle (at 60Hz)
+#define NUM_CYCLES_TO_SAMPLE              5                                                 // Sample 5 whole cycles in windowed mode (~100ms @ 50Hz)
+#define DIAGNOSTIC_PERIOD_MS              60000                                             // Output diagnostics every 60 seconds (default, see settings)
 #define STARTUP_DELAY_MS                  2500                                              // Startup delay MS
-#define MIN_SAMPLES_PER_SECOND_PER_SENSOR (AC_FREQUENCY_HZ * SAMPLES_PER_CYCLE)             // 3,840 Hz per sensor
+#define MIN_SAMPLES_PER_SECOND_PER_SENSOR (60 * SAMPLES_PER_CYCLE)                          // 3,840 Hz per sensor
 #define MIN_SAMPLE_RATE                   (MIN_SAMPLES_PER_SECOND_PER_SENSOR * NUM_SENSORS) // 38,400 Hz total minimum
+#if ADC_DUAL_UNIT
+#define GPIO_DEBUG_MODE                   GPIO_NUM_21                                       // tie low for debug output (GPIO12/13 are ADC2 sensors)
+#define GPIO_BINARY_MODE                  GPIO_NUM_47                                       // tie low for binary (framed) output
+#else
 #define GPIO_DEBUG_MODE                   GPIO_NUM_13                                       // tie low for debug output
+#define GPIO_BINARY_MODE                  GPIO_NUM_12                                       // tie low for binary (framed) output
+#endif
+#define OUTPUT_FLUSH_TIMEOUT_MS           100                                               // Output writer, give up on a record if host not reading
+#define OUTPUT_RING_SIZE                  16                                                // Records queued for USB, else dropped (power of 2)
+#define OUTPUT_RECORD_SIZE                PROTOCOL_FRAME_MAX                                // Text line or binary frame, longest
+#define OUTPUT_TASK_STACK                 4096                                              //
+#define OUTPUT_TASK_PRIORITY              1                                                 // As main (processing) task, only it waits for the host
+#define ADC_ACQUIRE_CONTINUOUS            1                                                 // Continuous gap-free acquisition over each period (0 = windowed)
+#ifndef PHASE_GOERTZEL
+#define PHASE_GOERTZEL                    1                                                 // Phase from fundamental over whole window (0 = zero crossings)
+#endif
+#define PHASE_GOERTZEL_CYCLES             3                                                 // Goertzel block length in cycles
+#ifndef HARMONICS_NUM
+#define HARMONICS_NUM                     13                                                // Goertzel bank: fundamental to 13th (780Hz < 2kHz Nyquist)
+#endif
+#define HARMONICS_TOP                     3                                                 // Largest harmonics reported
+#define HARMONICS_FUNDAMENTAL_MIN         4.0                                               // Fundamental RMS (ADC counts) below which THD is not reported
+#define OFFSET_TRACK_WINDOWS              8                                                 // Windows averaged for zero offset of each sensor, carried over
+#define OFFSET_TRACK_STEP                 50.0                                              // Window mean (ADC counts) this far from offset restarts tracking
+#define NOISE_FLOOR_SENSORS               ((1UL << NUM_SENSORS) - 1)                        // Sensors (bit mask) with noise floor subtracted from RMS
+#define NOISE_FLOOR_WINDOWS               8                                                 // Windows averaged for noise floor estimate
+#define NOISE_FLOOR_MAX                   8.0                                               // Noise floor RMS (ADC counts) at most, residual above is signal
+#define READ_EXCEPTION                    0                                                 // Devices in READ only if changed beyond deadbands, or at heartbeat (0 = all)
+#define READ_DEADBAND_VOLTAGE             1.0                                               // Voltage change (V) from value last in READ
+#define READ_DEADBAND_CURRENT             0.05                                              // Current change (A)
+#define READ_DEADBAND_PHASE               2.0                                               // Phase angle change (degrees)
+#define READ_DEADBAND_POWER               5.0                                               // Real or apparent power change (W, VA)
+#define READ_DEADBAND_POWER_FACTOR        0.02                                              // Power factor change
+#define READ_DEADBAND_ENERGY              10.0                                              // Import or export energy change (Wh)
+#define READ_HEARTBEAT                    12                                                // READs at most without a device (60s at 5s)
+#define STREAM_CYCLES                     1                                                 // Per-cycle V/I records around triggers, e.g. inrush or sag (0 = none)
+#define STREAM_CYCLES_ALL                 0                                                 // Per-cycle records for every cycle, not only around triggers
+#define STREAM_DEVICES                    ((1UL << NUM_DEVICES) - 1)                        // Devices (bit mask) in per-cycle records
+#define STREAM_PRETRIGGER_CYCLES          16                                                // Cycles kept to output before a trigger
+#define STREAM_POSTTRIGGER_CYCLES         48                                                // Cycles output after a trigger, extended by retriggers
+#define STREAM_AVERAGE_CYCLES             50                                                // Cycles averaged for triggers to compare against
+#define STREAM_TRIGGER_CURRENT_STEP       1.5                                               // Cycle current above average by this factor
+#define STREAM_TRIGGER_CURRENT_MIN        1.0                                               // Cycle current (A) needed to trigger
+#define STREAM_TRIGGER_VOLTAGE_SAG        0.85                                              // Cycle voltage below average by this factor
+#define STREAM_QUEUE_SIZE                 32                                                // Cycles queued from acquisition to output, else dropped
+#define STREAM_TASK_STACK                 4096                                              //
+#define STREAM_TASK_PRIORITY              1                                                 // As main (processing) task
+#define EVENT_DEVICES                     ((1UL << NUM_DEVICES) - 1)                        // Devices (bit mask) with events detected, each cycle if streamed (else window)
+#define EVENT_VOLTAGE_NOMINAL             230.0                                             // Mains voltage (V) that voltage limits are of
+#define EVENT_VOLTAGE_OVER                1.10                                              // Voltage above nominal by this factor
+#define EVENT_VOLTAGE_UNDER               0.90                                              // Voltage below nominal by this factor
+#define EVENT_VOLTAGE_LOSS                0.20                                              // Voltage below nominal by this factor is lost, not under
+#define EVENT_VOLTAGE_HYSTERESIS          0.02                                              // Of nominal, back past the limit by this to clear
+#define EVENT_CURRENT_OVER                0.90                                              // Current above sensor rating by this factor
+#define EVENT_CURRENT_HYSTERESIS          0.05                                              // Of sensor rating, back past the limit by this to clear
+#define EVENT_CURRENT_STEP                2.0                                               // Current change (A) from average that is a step
+#define EVENT_CURRENT_AVERAGE             10                                                // Cycles (or windows) averaged for steps to compare against
+#define EVENT_CURRENT_HOLDOFF             10                                                // Cycles (or windows) after a step before another, average follows
+#define SCHEDULE_LATE_US                  2000                                              // Window ended (or started) after its time on the reporting grid by this (us) is late
+#define PERF_INSTRUMENT                   1                                                 // Stage timing, CPU idle, stack and heap as PERF with DIAG (0 = none, at no cost)
+#define PERF_BUCKETS                      8                                                 // Stage duration histogram, bucket n below 4^(n+1)us and the last all above
+#define PERF_BUCKET_BASE_US               4                                                 //
+#define PERF_CYCLES_PER_US                CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ                   // CPU cycle counter, per core
+#define PERF_CORES                        2                                                 //
+#define PERF_TASKS                        5                                                 // Stack high water marks of acquire, main, output, stream and command
+#define ENERGY_RUN_CURRENT                0.1                                               // Current (A) above which a device is running, for its run hours
+#define ENERGY_CHECKPOINT_MS              900000                                            // Energy totals saved at most this often (15 minutes), so lost at most on restart
+#define ACQUIRE_TASK_CORE                 1                                                 // Acquisition alone on one core, all else on the other
+#define ACQUIRE_TASK_STACK                4096                                              //
+#define ACQUIRE_TASK_PRIORITY             5                                                 // Above all else, blocks on ADC reads
+#define PROCESS_TASK_CORE                 0                                                 // Main (processing and output), stream and command tasks
+#define REPORT_RING_SIZE                  4                                                 // Windows from acquisition to processing, else dropped (power of 2)
+#define FEEDBACK_RING_SIZE                4                                                 // Levels from processing back to acquisition (power of 2)
+#define COMMAND_SIZE                      64                                                // Command line from host, longest
+#define COMMAND_QUEUE_SIZE                4                                                 //
+#define COMMAND_TASK_STACK                4096                                              //
+#define COMMAND_TASK_PRIORITY             1                                                 //
+#define CAPTURE_SAMPLES_MAX               8192                                              // Raw capture buffer (16KB), e.g. 2 sensors for 50 cycles
+#define CAPTURE_CHUNK_SAMPLES             256                                               // Samples per output frame
+#define CAPTURE_TIMEOUT_MS                5000                                              // Capture waits for cycles no longer than this
 
 // Voltage Divider (5V -> 3V)
 #define VDIV_R1                           20000                                  // 20k ohm
@@ -73,24 +173,62 @@ void __app_init(void) {
 #define ADC_MAX_VALUE                     ((1 << ADC_BIT_SIZE) - 1)            // ADC specific
 #define ADC_VREF                          3.3                                  // 3.3V reference (ESP32)
 #define ADC_MIDPOINT                      (ADC_MAX_VALUE / 2)                  // Expected midpoint for AC signal
+#define ADC_ATTEN                         ADC_ATTEN_DB_12                      // 0 to ~3.1V, non-linear towards the rails (corrected by lookup)
+#define ADC_LINEAR_SMOOTHING              8                                    // Codes each side averaged in lookup, as calibration is whole mV (~1.2 codes)
 #define ADC_RESULT_BYTES                  SOC_ADC_DIGI_RESULT_BYTES            // ADC result size (ESP32-S3 specific) per read, 4 bytes
+#if ADC_DUAL_UNIT
+#define ADC_UNITS                         2                                    // ADC1 and ADC2
+#define ADC_SAMPLE_RATE_HZ                64000                                // Above minimum, over both units in turn
+#define ADC_SAMPLE_SIZE                   256                                  // Should be multiple of NUM_SENSORS (16) for even distribution
+#define ADC_CONV_MODE                     ADC_CONV_ALTER_UNIT                  // Pattern slots alternate ADC1, ADC2, so sensors in turn must too
+#define ADC_SENSOR_UNIT(i)                (((i) % 2) == 0 ? ADC_UNIT_1 : ADC_UNIT_2)
+#else
+#define ADC_UNITS                         1                                    // ADC1
 #define ADC_SAMPLE_RATE_HZ                40000                                // Above minimum
 #define ADC_SAMPLE_SIZE                   250                                  // Should be multiple of NUM_SENSORS (10) for even distribution
+#define ADC_CONV_MODE                     ADC_CONV_SINGLE_UNIT_1               //
+#define ADC_SENSOR_UNIT(i)                ADC_UNIT_1
+#endif
+#define ADC_SENSOR_RATE_HZ                (ADC_SAMPLE_RATE_HZ / NUM_SENSORS)   // Per sensor, 4kHz
 #define ADC_FRAME_SIZE                    (ADC_SAMPLE_SIZE * ADC_RESULT_BYTES) // ADC DMA transfer frame size in bytes, 1024 bytes
 #define ADC_NUM_FRAMES                    16                                   // ADC frames to buffer (for smooth operation), use 4
 #define ADC_POOL_SIZE                     (ADC_FRAME_SIZE * ADC_NUM_FRAMES)    // Total buffer pool size, 4096 bytes
 #if ADC_SAMPLE_RATE_HZ < CONFIG_SOC_ADC_SAMPLE_FREQ_THRES_LOW || ADC_SAMPLE_RATE_HZ > CONFIG_SOC_ADC_SAMPLE_FREQ_THRES_HIGH
 #error ADC_SAMPLE_RATE_HZ outside of SOC specification
 #endif
+#if ADC_SAMPLE_RATE_HZ < MIN_SAMPLE_RATE || ADC_SAMPLE_SIZE % NUM_SENSORS != 0
+#error ADC_SAMPLE_RATE_HZ below minimum for NUM_SENSORS, or ADC_SAMPLE_SIZE not a multiple of it
+#endif
+#if ADC_DUAL_UNIT && !SOC_ADC_DIG_SUPPORTED_UNIT(1) // ADC_UNIT_2
+#error ADC_DUAL_UNIT requires ADC2 continuous (DMA) support
+#endif
 #define ADC_SAMPLE_THRESHOLD_MIN          10
-#define ADC_READINGS_PER_SENSOR_PER_FRAME (ADC_SAMPLE_SIZE / NUM_SENSORS)                   // 25 per sensor
-#define ADC_FRAMES_NEEDED                 (NUM_SAMPLES / ADC_READINGS_PER_SENSOR_PER_FRAME) // 320/25 = 13 frames
+#define ADC_READINGS_PER_SENSOR_PER_FRAME (ADC_SAMPLE_SIZE / NUM_SENSORS)                   // 25 per sensor (16 with ADC2)
+#define ADC_RESULT_DATA(r)                ((r) & 0x0FFF)                                    // TYPE2 result: data[11:0]
+#define ADC_RESULT_SOURCE(r)              (((r) >> 12) & 0x001F)                            // TYPE2 result: unit[16] and channel[15:12]
+#define ADC_SOURCE(unit, channel)         (((unit) << 4) | (channel))                       // As ADC_RESULT_SOURCE (ADC_UNIT_1 is 0)
+#define ADC_CHANNEL_LOOKUP_SIZE           32                                                // TYPE2 result: 1 bit of unit, 4 bits of channel
+#define ADC_SKEW_SLOTS                    NUM_DEVICES                                       // Pattern slots from current to voltage of a device (125us)
+#if ADC_RESULT_BYTES != 4
+#error ADC_RESULT_BYTES must be 4 for TYPE2 word decoding
+#endif
+#if STREAM_CYCLES && !ADC_ACQUIRE_CONTINUOUS
+#error STREAM_CYCLES requires ADC_ACQUIRE_CONTINUOUS
+#endif
+#if CAPTURE_CHUNK_SAMPLES * 2 > PROTOCOL_RECORD_MAX - 64
+#error CAPTURE_CHUNK_SAMPLES too large for protocol record
+#endif
+#define ADC_READ_TIMEOUT_MS               10                                                // Wait for frame notification, at most (a frame is ~6ms at 40kHz)
+#define ADC_STALL_TIMEOUT_MS              100                                               // No frames for this long is a stalled driver, recovered as an error
+#define ADC_STOP_TIMEOUT_MS               1000                                              // Acquisition ending, waited for at most, else the driver is left open
+#define ADC_RECOVER_RESTARTS              3                                                 // Recovery by restarting the driver in place, at most, then
+#define ADC_RECOVER_REINITS               2                                                 // by recreating it, then by restarting the powermon (reset once frames flow)
 
 // Sensor ACS712
 #define ACS712_MV_PER_AMP_5A              185.0                 // 185 mV/A
 #define ACS712_MV_PER_AMP_20A             100.0                 // 100 mv/A
 #define ACS712_MV_PER_AMP_30A             66.0                  // 66 mv/A
-#define ACS712_MV_PER_AMP                 ACS712_MV_PER_AMP_30A // 30A version
+#define ACS712_RATING_DEFAULT             30                    // 30A version (default, see settings)
 #define ACS712_SUPPLY_V                   5.0                   // 5V supply to sensor
 
 // Sensor ZMPT101B
@@ -103,25 +241,296 @@ void __app_init(void) {
 #define ZERO_OFFSET_LOWER                 1000
 #define ZERO_OFFSET_UPPER                 2800
 
+// Settings (runtime, persisted in NVS, defaults as above)
+#define SETTINGS_NAMESPACE                "powermon"
+#define SETTINGS_KEY                      "settings"
+#define SETTINGS_VERSION                  1       // Stored settings of other versions are ignored
+#define ENERGY_KEY_FORMAT                 "energy%d"
+#define ENERGY_SLOTS                      2       // Stored energy totals alternate between keys, the newest is loaded
+#define ENERGY_VERSION                    1       // Stored energy totals of other versions are ignored
+#define SETTINGS_PERIOD_READ_MIN_MS       1000    //
+#define SETTINGS_PERIOD_READ_MAX_MS       60000   //
+#define SETTINGS_PERIOD_DIAG_MAX_MS       3600000 //
+#define SETTINGS_GAIN_MIN                 0.5     // Calibration gain accepted
+#define SETTINGS_GAIN_MAX                 2.0     //
+#define SETTINGS_VOLTAGE_OFFSET_MAX       50.0    // Calibration offset accepted, +/-
+#define SETTINGS_CURRENT_OFFSET_MAX       5.0     //
+#define CALIBRATE_WINDOWS                 2       // Windows waited for, so one is wholly with the reference load
+#define CALIBRATE_SIGNAL_MIN              10.0    // Reference RMS (ADC counts) needed for gain
+
 // ------------------------------------------------------------------------------------------------------------------------
 
-// Pin Mapping - GPIO pins for ADC channels (GPIO1 to 10 only allowed on ADC unit 1)
-static const gpio_num_t adc_sensor_pins[NUM_SENSORS] = {
+// Pin Mapping - GPIO pins for ADC channels (GPIO1 to 10 on ADC unit 1, GPIO11 to 18 on ADC unit 2 as GPIO19/20 are USB), default until set
+#if ADC_DUAL_UNIT
+static const gpio_num_t adc_sensor_pins_default[NUM_SENSORS] = {
+    GPIO_NUM_2, GPIO_NUM_12, GPIO_NUM_4, GPIO_NUM_14, GPIO_NUM_6, GPIO_NUM_16, GPIO_NUM_8, GPIO_NUM_18, // Current sensors (ACS712), alternately ADC1, ADC2
+    GPIO_NUM_1, GPIO_NUM_11, GPIO_NUM_3, GPIO_NUM_13, GPIO_NUM_5, GPIO_NUM_15, GPIO_NUM_7, GPIO_NUM_17  // Voltage sensors (ZMPT101B), alternately ADC1, ADC2
+};
+#else
+static const gpio_num_t adc_sensor_pins_default[NUM_SENSORS] = {
     GPIO_NUM_2, GPIO_NUM_4, GPIO_NUM_6, GPIO_NUM_8, GPIO_NUM_10, // Current sensors (ACS712)
     GPIO_NUM_1, GPIO_NUM_3, GPIO_NUM_5, GPIO_NUM_7, GPIO_NUM_9   // Voltage sensors (ZMPT101B)
 };
+#endif
+static gpio_num_t adc_sensor_pins[NUM_SENSORS]; // in use, from settings at startup
 
 // Calibration parameters
 typedef struct {
     float gain;   // Multiplicative correction (default 1.0)
     float offset; // Additive correction in final units (default 0.0)
 } calibration_t;
-static calibration_t voltage_calibration[NUM_DEVICES] = { { 1.0, 0.0 }, { 1.0, 0.0 }, { 1.0, 0.0 }, { 1.0, 0.0 }, { 1.0, 0.0 } };
-static calibration_t current_calibration[NUM_DEVICES] = { { 1.0, 0.0 }, { 1.0, 0.0 }, { 1.0, 0.0 }, { 1.0, 0.0 }, { 1.0, 0.0 } };
 
 // ------------------------------------------------------------------------------------------------------------------------
 
-static bool __debug_enabled = false;
+typedef struct {
+    uint32_t version;
+    uint32_t period_read;                // ms
+    uint32_t period_diag;                // ms
+    uint8_t pins[NUM_SENSORS];           // GPIO, currents then voltages: applied at restart
+    uint8_t current_rating[NUM_DEVICES]; // ACS712 variant, A
+    calibration_t voltage_calibration[NUM_DEVICES];
+    calibration_t current_calibration[NUM_DEVICES];
+} settings_t;
+
+typedef struct {
+    float voltage_scale[NUM_DEVICES]; // V per ADC count, with calibration gain
+    float voltage_offset[NUM_DEVICES];
+    float current_scale[NUM_DEVICES]; // A per ADC count, with calibration gain
+    float current_offset[NUM_DEVICES];
+} settings_scale_t;
+
+static const char *settings_names[] = { "period-read", "period-diag", "pins", "current-sensor", "voltage-gain", "voltage-offset", "current-gain", "current-offset" };
+
+static settings_t settings;             // in use: changed only by the command task, other tasks take copies with settings_read
+static settings_scale_t settings_scale; // of settings in use
+static seqcount_t settings_sequence;    // of settings and settings_scale, as changed
+static bool settings_stored = false;    // loaded from, or last saved to, NVS
+static portMUX_TYPE settings_lock = portMUX_INITIALIZER_UNLOCKED; // held while changing, so readers retry only for as long as a copy
+
+static float settings_current_mv_per_amp(const uint8_t rating) {
+    switch (rating) {
+    case 5:
+        return (float)ACS712_MV_PER_AMP_5A;
+    case 20:
+        return (float)ACS712_MV_PER_AMP_20A;
+    case 30:
+    default:
+        return (float)ACS712_MV_PER_AMP_30A;
+    }
+}
+
+static float settings_voltage_per_count(void) {
+    // ADC count to voltage at ADC pin, through the voltage divider to the sensor output, through the ZMPT101B ratio to AC voltage
+    return (((float)ADC_VREF / (float)ADC_MAX_VALUE) * (float)VDIV_RATIO) / (float)ZMPT101B_RATIO;
+}
+
+static float settings_current_per_count(const uint8_t rating) {
+    // ADC count to voltage at ADC pin, through the voltage divider to the sensor output, through the ACS712 sensitivity to current
+    return (((float)ADC_VREF / (float)ADC_MAX_VALUE) * (float)VDIV_RATIO * (float)1000.0) / settings_current_mv_per_amp(rating);
+}
+
+static void settings_defaults(settings_t *s) {
+    *s = (settings_t) { .version = SETTINGS_VERSION, .period_read = REPORTINGS_PERIOD_MS, .period_diag = DIAGNOSTIC_PERIOD_MS };
+    for (int i = 0; i < NUM_SENSORS; i++)
+        s->pins[i] = (uint8_t)adc_sensor_pins_default[i];
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        s->current_rating[d]      = ACS712_RATING_DEFAULT;
+        s->voltage_calibration[d] = (calibration_t) { 1.0, 0.0 };
+        s->current_calibration[d] = (calibration_t) { 1.0, 0.0 };
+    }
+}
+
+static const char *settings_validate(const settings_t *s) {
+    if (s->version != SETTINGS_VERSION)
+        return "version mismatch";
+    if (s->period_read < SETTINGS_PERIOD_READ_MIN_MS || s->period_read > SETTINGS_PERIOD_READ_MAX_MS)
+        return "period-read out of range";
+    if (s->period_diag < s->period_read || s->period_diag > SETTINGS_PERIOD_DIAG_MAX_MS)
+        return "period-diag out of range";
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        adc_unit_t unit;
+        adc_channel_t channel;
+        if (adc_continuous_io_to_channel((gpio_num_t)s->pins[i], &unit, &channel) != ESP_OK || unit != ADC_SENSOR_UNIT(i) ||
+            (unit == ADC_UNIT_2 && channel > ADC_CHANNEL_7)) // GPIO19/20, USB
+            return ADC_DUAL_UNIT ? "pins not alternately on adc unit 1 and 2 (gpio 11-18)" : "pins not all on adc unit 1";
+        for (int j = 0; j < i; j++)
+            if (s->pins[j] == s->pins[i])
+                return "pins not unique";
+    }
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        if (s->current_rating[d] != 5 && s->current_rating[d] != 20 && s->current_rating[d] != 30)
+            return "current-sensor not acs712-5/20/30";
+        if (!(s->voltage_calibration[d].gain >= (float)SETTINGS_GAIN_MIN && s->voltage_calibration[d].gain <= (float)SETTINGS_GAIN_MAX) ||
+            !(s->current_calibration[d].gain >= (float)SETTINGS_GAIN_MIN && s->current_calibration[d].gain <= (float)SETTINGS_GAIN_MAX))
+            return "gain out of range";
+        if (!(fabsf(s->voltage_calibration[d].offset) <= (float)SETTINGS_VOLTAGE_OFFSET_MAX) || !(fabsf(s->current_calibration[d].offset) <= (float)SETTINGS_CURRENT_OFFSET_MAX))
+            return "offset out of range";
+    }
+    return NULL;
+}
+
+static void settings_prebake(const settings_t *s, settings_scale_t *scale) {
+    // conversions and gains folded into one factor per channel, so readings scale without re-deriving them
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        scale->voltage_scale[d]  = settings_voltage_per_count() * s->voltage_calibration[d].gain;
+        scale->voltage_offset[d] = s->voltage_calibration[d].offset;
+        scale->current_scale[d]  = settings_current_per_count(s->current_rating[d]) * s->current_calibration[d].gain;
+        scale->current_offset[d] = s->current_calibration[d].offset;
+    }
+}
+
+// settings and scales in use, either if not NULL, as a consistent copy though the command task may be changing them
+static void settings_read(settings_t *s, settings_scale_t *scale) {
+    uint32_t sequence;
+    while (true) {
+        sequence = seqcount_read_begin(&settings_sequence);
+        if (s != NULL)
+            *s = settings;
+        if (scale != NULL)
+            *scale = settings_scale;
+        if (!seqcount_read_retry(&settings_sequence, sequence))
+            break;
+        // spinning, not sleeping: a change is a copy that is neither preempted nor interrupted (see settings_apply), so is soon over
+    }
+}
+
+static esp_err_t settings_load(settings_t *s) {
+    nvs_handle_t handle;
+    size_t size   = sizeof(settings_t);
+    esp_err_t err = nvs_open(SETTINGS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK)
+        return err;
+    err = nvs_get_blob(handle, SETTINGS_KEY, s, &size);
+    nvs_close(handle);
+    if (err == ESP_OK && (size != sizeof(settings_t) || settings_validate(s) != NULL))
+        err = ESP_ERR_INVALID_STATE;
+    return err;
+}
+
+static esp_err_t settings_save(const settings_t *s) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(SETTINGS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+        return err;
+    if ((err = nvs_set_blob(handle, SETTINGS_KEY, s, sizeof(settings_t))) == ESP_OK)
+        err = nvs_commit(handle);
+    nvs_close(handle);
+    return err;
+}
+
+// validated settings replace those in use and are saved, by the command task only: returns error, or NULL
+static const char *settings_apply(const settings_t *s) {
+    const char *error = settings_validate(s);
+    if (error != NULL)
+        return error;
+    settings_scale_t scale;
+    settings_prebake(s, &scale);
+    portENTER_CRITICAL(&settings_lock); // not preempted, nor interrupted, while readers would retry
+    seqcount_write_begin(&settings_sequence);
+    settings       = *s;
+    settings_scale = scale;
+    seqcount_write_end(&settings_sequence);
+    portEXIT_CRITICAL(&settings_lock);
+    settings_stored = settings_save(&settings) == ESP_OK;
+    return NULL;
+}
+
+// name=value, or name.device=value if device >= 0, else per device values joined by '/': returns false if unknown
+static bool settings_format(const settings_t *s, const char *name, const int device, char *string, const size_t string_size) {
+    if (strcmp(name, "period-read") == 0 || strcmp(name, "period-diag") == 0) {
+        snprintf(string, string_size, "%s=%lu", name, strcmp(name, "period-read") == 0 ? s->period_read : s->period_diag);
+        return device < 0;
+    }
+    if (strcmp(name, "pins") == 0) {
+        for (int i = 0, o = snprintf(string, string_size, "%s=", name); i < NUM_SENSORS; i++)
+            o += snprintf(&string[o], string_size - (size_t)o, "%s%u", i == 0 ? "" : "/", s->pins[i]);
+        return device < 0;
+    }
+    const int first = device < 0 ? 0 : device, last = device < 0 ? NUM_DEVICES - 1 : device;
+    int o = device < 0 ? snprintf(string, string_size, "%s=", name) : snprintf(string, string_size, "%s.%d=", name, device + 1);
+    for (int d = first; d <= last; d++) {
+        const char *separator = d == first ? "" : "/";
+        if (strcmp(name, "current-sensor") == 0)
+            o += snprintf(&string[o], string_size - (size_t)o, "%s%s-%u", separator, SYSTEM_SENSOR_CURRENT, s->current_rating[d]);
+        else if (strcmp(name, "voltage-gain") == 0)
+            o += snprintf(&string[o], string_size - (size_t)o, "%s%.4f", separator, s->voltage_calibration[d].gain);
+        else if (strcmp(name, "voltage-offset") == 0)
+            o += snprintf(&string[o], string_size - (size_t)o, "%s%.2f", separator, s->voltage_calibration[d].offset);
+        else if (strcmp(name, "current-gain") == 0)
+            o += snprintf(&string[o], string_size - (size_t)o, "%s%.4f", separator, s->current_calibration[d].gain);
+        else if (strcmp(name, "current-offset") == 0)
+            o += snprintf(&string[o], string_size - (size_t)o, "%s%.3f", separator, s->current_calibration[d].offset);
+        else
+            return false;
+    }
+    return true;
+}
+
+// value into name, or name.device if device >= 0, without validation: returns error, or NULL
+static const char *settings_parse(settings_t *s, const char *name, const int device, const char *value) {
+    char *end;
+    if (strcmp(name, "period-read") == 0 || strcmp(name, "period-diag") == 0) {
+        const unsigned long period = strtoul(value, &end, 10);
+        if (device >= 0 || end == value || *end != '\0')
+            return "usage: period-read|period-diag <ms>";
+        if (strcmp(name, "period-read") == 0)
+            s->period_read = (uint32_t)period;
+        else
+            s->period_diag = (uint32_t)period;
+        return NULL;
+    }
+    if (strcmp(name, "pins") == 0) {
+        const char *start = value;
+        for (int i = 0; i < NUM_SENSORS; i++, start = end + 1) {
+            const long pin = strtol(start, &end, 10);
+            if (device >= 0 || end == start || pin < 0 || pin > UINT8_MAX || *end != (i == NUM_SENSORS - 1 ? '\0' : '/'))
+                return "usage: pins <gpio>/<gpio>/... (currents then voltages)";
+            s->pins[i] = (uint8_t)pin;
+        }
+        return NULL;
+    }
+    if (strcmp(name, "current-sensor") == 0) {
+        unsigned int rating = 0;
+        int length          = 0;
+        if (device < 0 || sscanf(value, SYSTEM_SENSOR_CURRENT "-%u%n", &rating, &length) != 1 || value[length] != '\0' || rating > UINT8_MAX)
+            return "usage: current-sensor.<device> acs712-5|acs712-20|acs712-30";
+        s->current_rating[device] = (uint8_t)rating;
+        return NULL;
+    }
+    calibration_t *calibration;
+    if (strcmp(name, "voltage-gain") == 0 || strcmp(name, "voltage-offset") == 0)
+        calibration = s->voltage_calibration;
+    else if (strcmp(name, "current-gain") == 0 || strcmp(name, "current-offset") == 0)
+        calibration = s->current_calibration;
+    else
+        return "unknown setting";
+    const float number = strtof(value, &end);
+    if (device < 0 || end == value || *end != '\0')
+        return "usage: <voltage|current>-<gain|offset>.<device> <value>";
+    if (strstr(name, "-gain") != NULL)
+        calibration[device].gain = number;
+    else
+        calibration[device].offset = number;
+    return NULL;
+}
+
+static void settings_init(void) {
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        (void)nvs_flash_erase();
+        err = nvs_flash_init();
+    }
+    settings_stored = err == ESP_OK && settings_load(&settings) == ESP_OK;
+    if (!settings_stored)
+        settings_defaults(&settings);
+    settings_prebake(&settings, &settings_scale); // before other tasks
+    for (int i = 0; i < NUM_SENSORS; i++)
+        adc_sensor_pins[i] = (gpio_num_t)settings.pins[i];
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static volatile bool __debug_enabled = false;
 static void __debug_init(void) {
     gpio_input_enable(GPIO_DEBUG_MODE);
     gpio_set_pull_mode(GPIO_DEBUG_MODE, GPIO_PULLUP_ONLY);
@@ -129,9 +538,10 @@ static void __debug_init(void) {
         __debug_enabled = true;
 }
 #define debug_enabled() (__debug_enabled)
+static void __attribute__((format(printf, 1, 2))) output_debug(const char *format, ...); // as a record, see output_begin
 #define DEBUG_PRINT                                                                                                                                                                \
     if (__debug_enabled)                                                                                                                                                           \
-    printf
+    output_debug
 
 // ------------------------------------------------------------------------------------------------------------------------
 
@@ -165,6 +575,39 @@ static const char *fault2str(const adc_fault_t fault) {
     }
 }
 
+typedef enum {
+    EVENT_OVERVOLTAGE = 0,
+    EVENT_UNDERVOLTAGE,
+    EVENT_NOVOLTAGE,
+    EVENT_OVERCURRENT,
+    EVENT_CURRENTSTEP,
+    EVENT_VOLTAGEFAULT,
+    EVENT_CURRENTFAULT,
+    NUM_EVENTS,
+} adc_event_type_t;
+
+static const char *event2str(const adc_event_type_t event) {
+    switch (event) {
+    case EVENT_OVERVOLTAGE:
+        return "V_OVER";
+    case EVENT_UNDERVOLTAGE:
+        return "V_UNDER";
+    case EVENT_NOVOLTAGE:
+        return "V_LOSS";
+    case EVENT_OVERCURRENT:
+        return "I_OVER";
+    case EVENT_CURRENTSTEP:
+        return "I_STEP";
+    case EVENT_VOLTAGEFAULT:
+        return "V_FAULT";
+    case EVENT_CURRENTFAULT:
+        return "I_FAULT";
+    case NUM_EVENTS:
+    default:
+        return "E_UNKNW";
+    }
+}
+
 static const char *faults2str(const uint32_t faults[], const size_t faults_size, char *string, const size_t string_size) {
     for (int i = 0, o = 0; i < faults_size; i++)
         o += snprintf(&string[o], string_size - (size_t)o, "%s%lu", i == 0 ? "" : "/", faults[i]);
@@ -173,328 +616,1902 @@ static const char *faults2str(const uint32_t faults[], const size_t faults_size,
 
 // ------------------------------------------------------------------------------------------------------------------------
 
+#if PERF_INSTRUMENT
+
+typedef enum {
+    PERF_EXTRACT = 0, // acquisition, each read of frames
+    PERF_CALCULATE,   // processing, each window
+    PERF_OUTPUT,      // records, each window
+    PERF_LOOP,        // processing and output, each window
+    NUM_PERF_STAGES
+} perf_stage_t;
+
+static const char *stage2str(const perf_stage_t stage) {
+    switch (stage) {
+    case PERF_EXTRACT:
+        return "extract";
+    case PERF_CALCULATE:
+        return "calculate";
+    case PERF_OUTPUT:
+        return "output";
+    case PERF_LOOP:
+        return "loop";
+    case NUM_PERF_STAGES:
+    default:
+        return "unknown";
+    }
+}
+
+typedef struct {
+    uint32_t count;
+    uint64_t sum; // us
+    uint32_t max; // us
+    uint32_t buckets[PERF_BUCKETS];
+} perf_histogram_t;
+
+typedef struct {
+    perf_histogram_t stages[NUM_PERF_STAGES]; // each written by one task only, and read by main as copies with perf_read
+    seqcount_t sequence[NUM_PERF_STAGES];     // of each stage, as recorded
+    uint32_t idle_time;                       // us, as of last idle
+    uint32_t idle_counter[PERF_CORES];        // run time of idle task, as of last idle
+} perf_t;
+
+static perf_t perf;
+static const char *const perf_tasks[PERF_TASKS] = { "acquire", "main", "output", "stream", "command" };
+
+#define PERF_BEGIN(begin)      const uint32_t begin = esp_cpu_get_cycle_count()
+#define PERF_END(stage, begin) perf_record(stage, esp_cpu_get_cycle_count() - (begin))
+
+static void perf_record(const perf_stage_t stage, const uint32_t cycles) {
+
+    // begin and end on the same core (tasks are pinned), and the counter wraps after ~18s, far longer than any stage
+    perf_histogram_t *histogram = &perf.stages[stage];
+    const uint32_t duration     = cycles / PERF_CYCLES_PER_US;
+    int bucket                  = 0;
+    for (uint32_t edge = PERF_BUCKET_BASE_US; duration >= edge && bucket < PERF_BUCKETS - 1; edge *= PERF_BUCKET_BASE_US)
+        bucket++;
+    seqcount_write_begin(&perf.sequence[stage]);
+    histogram->count++;
+    histogram->sum += duration;
+    if (duration > histogram->max)
+        histogram->max = duration;
+    histogram->buckets[bucket]++;
+    seqcount_write_end(&perf.sequence[stage]);
+}
+
+static void perf_read(const perf_stage_t stage, perf_histogram_t *histogram) {
+
+    // whole, as extract is recorded by acquisition on the other core: spinning, as its recording is a few instructions and never waits on this
+    uint32_t sequence;
+    do {
+        sequence   = seqcount_read_begin(&perf.sequence[stage]);
+        *histogram = perf.stages[stage];
+    } while (seqcount_read_retry(&perf.sequence[stage], sequence));
+}
+
+static uint32_t perf_mean(const perf_histogram_t *histogram) { return histogram->count > 0 ? (uint32_t)(histogram->sum / histogram->count) : 0; }
+
+static void perf_idle(float idle[PERF_CORES]) {
+
+    // percent of time in each core's idle task since last called (since boot, at first), or -1 without FreeRTOS run time stats
+#if configGENERATE_RUN_TIME_STATS
+    const uint32_t time = (uint32_t)esp_timer_get_time(), elapsed = time - perf.idle_time;
+    for (int core = 0; core < PERF_CORES; core++) {
+        const uint32_t counter  = (uint32_t)ulTaskGetIdleRunTimeCounterForCore(core);
+        idle[core]              = elapsed > 0 ? __MIN(((float)(counter - perf.idle_counter[core]) * (float)100.0) / (float)elapsed, (float)100.0) : (float)-1.0;
+        perf.idle_counter[core] = counter;
+    }
+    perf.idle_time = time;
+#else
+    for (int core = 0; core < PERF_CORES; core++)
+        idle[core] = (float)-1.0;
+#endif
+}
+
+static uint32_t perf_stack(const char *task_name) {
+
+    // bytes never used, at least, of the task's stack (0 if no such task)
+    const TaskHandle_t task = xTaskGetHandle(task_name);
+    return task != NULL ? (uint32_t)uxTaskGetStackHighWaterMark(task) : 0;
+}
+
+#else
+#define PERF_BEGIN(begin)
+#define PERF_END(stage, begin)
+#endif
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    uint8_t order;
+    float percent; // of fundamental
+} adc_harmonic_t;
+
+typedef struct {
+    float thd;     // percent of fundamental, 0 if fundamental too small
+    adc_harmonic_t top[HARMONICS_TOP];
+} adc_harmonics_t;
+
 typedef struct {
     float voltage_rms;
     float current_rms;
     float phase_angle;
+    float power_real;
+    float power_apparent;
+    float power_factor;
+    adc_harmonics_t voltage_harmonics;
+    adc_harmonics_t current_harmonics;
     adc_fault_t voltage_fault;
     adc_fault_t current_fault;
+    float energy_import; // Wh, totals since first started, see energy_t
+    float energy_export;
+    float run_hours;
 } adc_result_t;
 
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    int64_t sum;          // of samples centred on ADC_MIDPOINT
+    uint64_t sum_squares; // of samples centred on ADC_MIDPOINT
+} adc_accum_t;
+
+typedef struct {
+    uint32_t cycle;
+    int64_t time;                   // at end of cycle
+    adc_accum_t accum[NUM_SENSORS]; // over the cycle (without min, max)
+} adc_cycle_t;
+
+typedef struct {
+    uint32_t cycle;
+    int64_t time;
+    uint32_t trigger; // bit per device: current step (from bit 0), voltage sag (from bit 16)
+    float voltage_rms[NUM_DEVICES];
+    float current_rms[NUM_DEVICES];
+    adc_fault_t voltage_fault[NUM_DEVICES];
+    adc_fault_t current_fault[NUM_DEVICES];
+} adc_cycle_result_t;
+
+#define CYCLE_TRIGGER_CURRENT(d) (1UL << (d))
+#define CYCLE_TRIGGER_VOLTAGE(d) (1UL << (16 + (d)))
+
+typedef struct {
+    int device;
+    adc_event_type_t type;
+    bool active;       // raised, else cleared (steps are only raised)
+    adc_fault_t fault; // for fault events, as raised or as cleared
+    float before;      // V or A, as previous (levels, faults) or average (steps)
+    float after;
+} adc_event_t;
+
+typedef struct {
+    volatile bool armed;   // starts at next cycle boundary
+    volatile bool running; // stops after cycles, or when full
+    volatile bool done;
+    uint32_t sensors; // bit mask
+    uint32_t cycles;  // remaining
+    uint32_t count;
+    uint32_t size; // whole pattern rounds of sensors
+    uint16_t buffer[CAPTURE_SAMPLES_MAX];
+} adc_capture_t;
+
+typedef struct {
+    uint32_t level;    // crossing level, the zero offset of the previous window
+    uint32_t last;     // previous sample
+    uint32_t crossing; // sample count at most recent upward crossing (0 = none)
+} adc_crossing_t;
+
+typedef struct {
+    float s1[HARMONICS_NUM];
+    float s2[HARMONICS_NUM];
+    uint32_t count;
+    float real; // fundamental of latest completed block
+    float imag;
+    bool ready;
+    uint32_t blocks;
+    float power[HARMONICS_NUM]; // sum of |X|² over completed blocks
+} adc_goertzel_t;
+
+typedef struct {
+    uint32_t count;
+    float real; // sum of phasors of voltage to current phase lag
+    float imag;
+} adc_phase_t;
+
+typedef struct {
+    int32_t current; // latest current sample, awaiting the voltage sample of the same pattern round
+    int32_t voltage; // previous voltage sample
+    bool current_valid;
+    bool voltage_valid;
+} adc_skew_t;
+
+typedef struct {
+    uint32_t count;
+    int64_t sum_voltage; // of voltage interpolated to current sample time, scaled by NUM_SENSORS
+    int64_t sum_current;
+    int64_t sum_product;
+} adc_power_t;
+
+typedef struct {
+    uint32_t cycles;
+    adc_accum_t accum[NUM_SENSORS];
+    adc_power_t power[NUM_DEVICES];
+} adc_window_t;
+
+typedef struct {
+    int sensor;          // reference voltage sensor, -1 if none
+    uint32_t level;      // crossing level
+    uint32_t hysteresis; // rearm below level by this
+    uint32_t last;       // previous sample
+    bool armed;
+    uint32_t samples; // free running count of reference samples
+    uint32_t crossing_index;
+    float crossing_fraction;
+    bool crossing_valid;
+    bool cycle;        // crossing during current pattern round
+    bool aligned;      // window starts on a cycle boundary
+    bool resync;       // samples lost since last boundary, so the next does not end a cycle
+    float period_sum;  // periods (samples) measured in window
+    uint32_t period_count;
+} adc_tracker_t;
+
+typedef struct {
+    int64_t time; // of window start
+    adc_window_t window;
+    adc_goertzel_t goertzel[NUM_SENSORS];
+    uint32_t goertzel_length; // of blocks, as tuned over the window
+    float goertzel_frequency; // as tuned over the window, of the bank and its phasors
+    adc_phase_t phase[NUM_DEVICES];
+    float frequency; // as measured over the window, to which the next is tuned
+    bool frequency_measured;
+    uint32_t windows; // acquired in this one, more than 1 if those before were dropped and carried into it
+} adc_report_t;
+
+typedef struct {
+    uint32_t level[NUM_SENSORS]; // crossing levels (0 = unchanged)
+    int tracker_sensor;
+    uint32_t tracker_level;
+    uint32_t tracker_hysteresis;
+} adc_feedback_t;
+
+typedef struct {
+    esp_timer_handle_t timer; // periodic, at period of readings
+    uint32_t period;          // ms, as timer started
+    int64_t start;            // of grid, tick n is at start + n periods
+    volatile uint32_t ticks;  // since start, by timer
+    uint32_t handled;         // since start, by acquisition
+    uint32_t reports;         // windows, since boot
+    uint64_t jitter_sum;      // us, of windows after their grid time
+    uint32_t jitter_max;      // us
+    uint32_t late;            // windows, beyond SCHEDULE_LATE_US or ticks missed
+} adc_schedule_t;
+
+typedef struct {
+    uint32_t attempts;  // since frames last flowed, selects the tier
+    int64_t frame_time; // of last frames read
+    uint32_t restarts;  // of driver in place, since boot
+    uint32_t reinits;   // of driver recreated, since boot
+    uint32_t failures;  // attempts, since boot, as reported by the processing task, see readings_recovery_debug
+    esp_err_t error;    // that the last attempt recovered from
+    uint32_t reported;  // failures, by the processing task
+} adc_recovery_t;
+
 typedef struct {
     adc_continuous_handle_t handle;
     uint8_t *buffer;
     size_t buffer_size;
-    uint32_t samples[NUM_SENSORS][NUM_SAMPLES];
-    uint32_t sample_count[NUM_SENSORS];
+    adc_window_t window; // accumulating, including partial cycle
+    adc_window_t cycle;  // window as at most recent cycle boundary
+    adc_window_t result; // completed window, whole cycles
+    adc_tracker_t tracker;
+    float frequency;     // measured, or estimate
+    bool frequency_measured;
+    float cycle_samples; // per sensor at frequency
+    adc_crossing_t crossing[NUM_SENSORS];
+    adc_goertzel_t goertzel[NUM_SENSORS];
+    float goertzel_coeff[HARMONICS_NUM];
+    float goertzel_cos[HARMONICS_NUM];
+    float goertzel_sin[HARMONICS_NUM];
+    uint32_t goertzel_length;
+    uint32_t result_goertzel_length; // of completed window, as tuned while acquired: readings_end retunes for the next
+    float result_goertzel_frequency;
+    uint32_t result_windows; // in the completed window, with those dropped before it (0 = none dropped, so none to carry)
+    adc_phase_t phase[NUM_DEVICES];
+    adc_skew_t skew[NUM_DEVICES];
+    ring_t report_ring;   // completed windows, acquisition to processing
+    ring_t feedback_ring; // levels, processing to acquisition
+    TaskHandle_t process_task;
+    TaskHandle_t acquire_task;   // notified of frames by ISR, and of ticks by schedule
+    adc_schedule_t schedule;     // reporting grid
+    adc_recovery_t recovery;     // of driver errors and stalls
+    volatile uint32_t overflows; // of ADC pool, frames lost
+    volatile esp_err_t acquire_error;
+    volatile bool acquire_stop; // requested by readings_term, when acquisition is still running
+    uint32_t windows_dropped;
     uint32_t fault_count[NUM_SENSORS][NUM_FAULTS];
-    float zero_offset[NUM_SENSORS];
+    uint32_t samples[NUM_SENSORS];             // of completed window
+    float zero_offset[NUM_SENSORS];            // ADC counts, tracked over windows
+    float zero_offset_delta[NUM_SENSORS];      // of completed window mean from offset, before its update
+    uint32_t zero_offset_windows[NUM_SENSORS]; // tracked, up to OFFSET_TRACK_WINDOWS (0 = none)
+    float rms[NUM_SENSORS];                    // ADC counts, of completed window, for calibration
+    float noise[NUM_SENSORS];                  // ADC counts, RMS of noise floor estimate
+    volatile uint32_t windows;                 // completed
+    QueueHandle_t cycle_queue;                 // to stream, NULL if not
+    uint32_t cycle_count;
+    uint32_t cycle_dropped;
+    adc_capture_t capture; // raw samples, by command
 } adc_system_t;
 
 // ------------------------------------------------------------------------------------------------------------------------
 
 static adc_channel_t adc_sensor_to_channel[NUM_SENSORS];
-static int __adc_sensor_for_channel(const adc_channel_t channel) {
+static int8_t adc_channel_to_sensor[ADC_CHANNEL_LOOKUP_SIZE];
+static uint16_t adc_linear[ADC_UNITS][ADC_MAX_VALUE + 1]; // raw to linear ADC counts, per unit (at ADC_ATTEN)
+static const uint16_t *adc_sensor_to_linear[NUM_SENSORS];
+static bool adc_linear_calibrated = false;
+static adc_report_t adc_reports[REPORT_RING_SIZE];
+static adc_feedback_t adc_feedbacks[FEEDBACK_RING_SIZE];
+
+static void readings_tune(adc_system_t *adc, const float frequency) {
+
+    adc->frequency     = frequency;
+    adc->cycle_samples = (float)ADC_SENSOR_RATE_HZ / frequency;
+    for (int h = 0; h < HARMONICS_NUM; h++) {
+        const double omega     = (2.0 * M_PI * frequency * (h + 1)) / ADC_SENSOR_RATE_HZ;
+        adc->goertzel_coeff[h] = (float)(2.0 * cos(omega));
+        adc->goertzel_cos[h]   = (float)cos(omega);
+        adc->goertzel_sin[h]   = (float)sin(omega);
+    }
+    adc->goertzel_length = (uint32_t)lroundf((float)PHASE_GOERTZEL_CYCLES * adc->cycle_samples); // whole cycles: no leakage from offset or between harmonics
+}
+
+static void readings_window_reset(adc_window_t *window) {
+
+    memset(window, 0, sizeof(adc_window_t));
     for (int i = 0; i < NUM_SENSORS; i++)
-        if (adc_sensor_to_channel[i] == channel)
-            return i;
-    return -1;
+        window->accum[i].min = UINT32_MAX;
 }
 
-static esp_err_t readings_init(adc_system_t *adc) {
+static void readings_window_subtract(adc_window_t *window, const adc_window_t *window_sub) {
 
-    adc->buffer_size = ADC_FRAME_SIZE;
-    adc->buffer      = (uint8_t *)malloc(adc->buffer_size);
-    if (!adc->buffer)
-        return ESP_ERR_NO_MEM;
+    // min and max are not subtractable, so are retained over both
+    window->cycles -= window_sub->cycles;
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        window->accum[i].count -= window_sub->accum[i].count;
+        window->accum[i].sum -= window_sub->accum[i].sum;
+        window->accum[i].sum_squares -= window_sub->accum[i].sum_squares;
+    }
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        window->power[d].count -= window_sub->power[d].count;
+        window->power[d].sum_voltage -= window_sub->power[d].sum_voltage;
+        window->power[d].sum_current -= window_sub->power[d].sum_current;
+        window->power[d].sum_product -= window_sub->power[d].sum_product;
+    }
+}
+
+static void readings_window_add(adc_window_t *window, const adc_window_t *window_add) {
+
+    window->cycles += window_add->cycles;
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        window->accum[i].count += window_add->accum[i].count;
+        window->accum[i].sum += window_add->accum[i].sum;
+        window->accum[i].sum_squares += window_add->accum[i].sum_squares;
+        window->accum[i].min = __MIN(window->accum[i].min, window_add->accum[i].min);
+        window->accum[i].max = __MAX(window->accum[i].max, window_add->accum[i].max);
+    }
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        window->power[d].count += window_add->power[d].count;
+        window->power[d].sum_voltage += window_add->power[d].sum_voltage;
+        window->power[d].sum_current += window_add->power[d].sum_current;
+        window->power[d].sum_product += window_add->power[d].sum_product;
+    }
+}
+
+static bool IRAM_ATTR readings_isr_frame(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *data, void *context) {
+
+    // frame ready: wake acquisition to read it
+    (void)handle;
+    (void)data;
+    const adc_system_t *adc = (const adc_system_t *)context;
+    BaseType_t woken        = pdFALSE;
+    if (adc->acquire_task != NULL)
+        vTaskNotifyGiveFromISR(adc->acquire_task, &woken);
+    return woken == pdTRUE;
+}
+
+static bool IRAM_ATTR readings_isr_overflow(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *data, void *context) {
+
+    // pool full: frames lost as acquisition has not kept up
+    (void)handle;
+    (void)data;
+    ((adc_system_t *)context)->overflows++;
+    return false;
+}
+
+static bool readings_linear_unit(const adc_unit_t unit, uint16_t *linear) {
+
+    // eFuse curve fitting to mV, as ideal counts so that all else is unchanged: averaged over neighbouring codes to recover the curve from whole mV
+#ifdef ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    const adc_cali_curve_fitting_config_t config = { .unit_id = unit, .chan = ADC_CHANNEL_0, .atten = ADC_ATTEN, .bitwidth = ADC_BITWIDTH_DEFAULT };
+    adc_cali_handle_t handle;
+    if (adc_cali_create_scheme_curve_fitting(&config, &handle) == ESP_OK) {
+        for (int raw = 0; raw <= ADC_MAX_VALUE; raw++) {
+            const int spread = __MIN(ADC_LINEAR_SMOOTHING, __MIN(raw, ADC_MAX_VALUE - raw));
+            int sum = 0;
+            for (int r = raw - spread; r <= raw + spread; r++) {
+                int millivolts = 0;
+                (void)adc_cali_raw_to_voltage(handle, r, &millivolts);
+                sum += millivolts;
+            }
+            const float counts = ((float)sum / (float)((2 * spread) + 1)) * (float)ADC_MAX_VALUE / (float)(ADC_VREF * 1000.0);
+            linear[raw]        = (uint16_t)__MIN(lroundf(__MAX(counts, (float)0.0)), ADC_MAX_VALUE);
+        }
+        (void)adc_cali_delete_scheme_curve_fitting(handle);
+        return true;
+    }
+#endif
+    // no calibration (e.g. eFuse not burnt): ideal, as raw
+    for (int raw = 0; raw <= ADC_MAX_VALUE; raw++)
+        linear[raw] = (uint16_t)raw;
+    return false;
+}
+
+static void readings_linear_init(void) {
+
+    // once at boot, so that each sample is corrected by one lookup
+    adc_linear_calibrated = true;
+    for (int u = 0; u < ADC_UNITS; u++)
+        if (!readings_linear_unit((adc_unit_t)u, adc_linear[u]))
+            adc_linear_calibrated = false;
+    for (int i = 0; i < NUM_SENSORS; i++)
+        adc_sensor_to_linear[i] = adc_linear[ADC_SENSOR_UNIT(i)];
+}
 
+static esp_err_t readings_open(adc_system_t *adc) {
+
+    // driver handle, configured but not started: at init, and again to recover
+    esp_err_t ret;
     adc_continuous_handle_cfg_t handle_cfg = {
         .max_store_buf_size = ADC_POOL_SIZE,
         .conv_frame_size    = ADC_FRAME_SIZE,
     };
-    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_cfg, &adc->handle));
+    if ((ret = adc_continuous_new_handle(&handle_cfg, &adc->handle)) != ESP_OK)
+        return ret;
 
     adc_digi_pattern_config_t patterns[NUM_SENSORS];
     for (int i = 0; i < NUM_SENSORS; i++) {
         adc_unit_t unit;
-        ESP_ERROR_CHECK(adc_continuous_io_to_channel(adc_sensor_pins[i], &unit, &adc_sensor_to_channel[i]));
-        if (unit != ADC_UNIT_1)
+        if ((ret = adc_continuous_io_to_channel(adc_sensor_pins[i], &unit, &adc_sensor_to_channel[i])) != ESP_OK)
+            return ret;
+        if (unit != ADC_SENSOR_UNIT(i) || ADC_SOURCE(unit, adc_sensor_to_channel[i]) >= ADC_CHANNEL_LOOKUP_SIZE)
             return ESP_FAIL;
-        patterns[i].atten     = ADC_ATTEN_DB_12;
+        adc_channel_to_sensor[ADC_SOURCE(unit, adc_sensor_to_channel[i])] = (int8_t)i;
+        patterns[i].atten     = ADC_ATTEN;
         patterns[i].channel   = adc_sensor_to_channel[i];
         patterns[i].unit      = unit;
         patterns[i].bit_width = ADC_BIT_SIZE;
     }
     adc_continuous_config_t dig_cfg = {
         .sample_freq_hz = ADC_SAMPLE_RATE_HZ,
-        .conv_mode      = ADC_CONV_SINGLE_UNIT_1,
+        .conv_mode      = ADC_CONV_MODE,
         .format         = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
         .pattern_num    = NUM_SENSORS,
         .adc_pattern    = patterns,
     };
-    ESP_ERROR_CHECK(adc_continuous_config(adc->handle, &dig_cfg));
-
-    return ESP_OK;
+    if ((ret = adc_continuous_config(adc->handle, &dig_cfg)) != ESP_OK)
+        return ret;
+    const adc_continuous_evt_cbs_t callbacks = {
+        .on_conv_done = readings_isr_frame,
+        .on_pool_ovf  = readings_isr_overflow,
+    };
+    return adc_continuous_register_event_callbacks(adc->handle, &callbacks, adc);
 }
 
-static void readings_term(adc_system_t *adc) {
+static void readings_close(adc_system_t *adc) {
 
     if (adc->handle) {
         (void)adc_continuous_stop(adc->handle);
         (void)adc_continuous_deinit(adc->handle);
         adc->handle = NULL;
     }
-    if (adc->buffer) {
-        free(adc->buffer);
-        adc->buffer = NULL;
-    }
-}
-
-static void readings_extract(const uint8_t *buffer, const uint32_t length, adc_system_t *adc) {
-
-    adc_channel_t channel_last = -1;
-    int sensor                 = 0;
-    for (int i = 0; i < length; i += SOC_ADC_DIGI_RESULT_BYTES) {
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wcast-align"
-        const adc_digi_output_data_t *p = (const adc_digi_output_data_t *)&buffer[i];
-#pragma GCC diagnostic pop
-        const adc_channel_t channel = (adc_channel_t)p->type2.channel;
-        if (channel != channel_last)
-            sensor = __adc_sensor_for_channel(channel_last = channel);
-        if (sensor >= 0 && sensor < NUM_SENSORS && adc->sample_count[sensor] < NUM_SAMPLES)
-            adc->samples[sensor][adc->sample_count[sensor]++] = p->type2.data;
-    }
 }
 
-static esp_err_t readings_collect(adc_system_t *adc) {
-
-    memset(adc->sample_count, 0, sizeof(adc->sample_count));
-    ESP_ERROR_CHECK(adc_continuous_start(adc->handle));
-    const int64_t start_time = esp_timer_get_time();
-    uint32_t bytes_read      = 0;
-    while ((esp_timer_get_time() - start_time) < (SAMPLE_DURATION_MS * US_PER_MS)) // Fixed timing
-        if (adc_continuous_read(adc->handle, adc->buffer, adc->buffer_size, &bytes_read, 0) == ESP_OK && bytes_read > 0)
-            readings_extract(adc->buffer, bytes_read, adc);
-    ESP_ERROR_CHECK(adc_continuous_stop(adc->handle));
+static esp_err_t readings_init(adc_system_t *adc) {
 
-    return ESP_OK;
+    adc->buffer_size = ADC_FRAME_SIZE;
+    adc->buffer      = (uint8_t *)malloc(adc->buffer_size);
+    if (!adc->buffer)
+        return ESP_ERR_NO_MEM;
+    for (int i = 0; i < NUM_SENSORS; i++)
+        adc->crossing[i].level = adc->crossing[i].last = ADC_MIDPOINT;
+    memset(adc_channel_to_sensor, -1, sizeof(adc_channel_to_sensor));
+    readings_window_reset(&adc->window);
+    readings_window_reset(&adc->cycle);
+    readings_window_reset(&adc->result);
+    adc->result_windows = 0;
+    adc->tracker.sensor = -1; // until voltage found
+    readings_tune(adc, AC_FREQUENCY_HZ);
+    if (!ring_init(&adc->report_ring, adc_reports, sizeof(adc_report_t), REPORT_RING_SIZE) ||
+        !ring_init(&adc->feedback_ring, adc_feedbacks, sizeof(adc_feedback_t), FEEDBACK_RING_SIZE))
+        return ESP_ERR_INVALID_SIZE;
+
+    return readings_open(adc); // started by acquisition, see readings_task
 }
 
-//
-
-static float calculate_rms(const uint32_t *samples, const uint32_t count, const float zero_offset) {
+static void readings_crossing(adc_system_t *adc, const int sensor, const uint32_t count) {
 
-    if (count == 0)
-        return 0.0;
-    float sum_squares = 0.0;
-    for (int i = 0; i < count; i++)
-        sum_squares += ((float)samples[i] - zero_offset) * ((float)samples[i] - zero_offset);
-    return sqrtf(sum_squares / (float)count);
+    if (sensor >= NUM_DEVICES) { // voltage: start of cycle
+        adc->crossing[sensor].crossing = count;
+        return;
+    }
+    // current: first crossing within a cycle of the voltage crossing
+    adc_crossing_t *voltage = &adc->crossing[sensor + NUM_DEVICES];
+#if !PHASE_GOERTZEL
+    // within the same pattern round as the voltage crossing (in phase) the current is converted first, so is seen a cycle later: up to a sample over
+    if (voltage->crossing > 0 && count >= voltage->crossing && (float)(count - voltage->crossing) < adc->cycle_samples + (float)1.0) {
+        const float angle  = ((float)(count - voltage->crossing) / adc->cycle_samples) * (float)(2.0 * M_PI);
+        adc_phase_t *phase = &adc->phase[sensor];
+        phase->real += cosf(angle);
+        phase->imag += sinf(angle);
+        phase->count++;
+    }
+#endif
+    voltage->crossing = 0;
 }
 
-static float convert_adc_to_current(const float rms_adc, const calibration_t *cal) {
-    // Convert ADC RMS to voltage at ADC pin
-    const float v_adc_rms = (rms_adc / (float)ADC_MAX_VALUE) * (float)ADC_VREF;
-    // Account for voltage divider to get actual sensor output voltage
-    const float v_sensor_rms = v_adc_rms * (float)VDIV_RATIO;
-    // Convert voltage to current using ACS712 sensitivity
-    const float current_raw = (v_sensor_rms * (float)1000.0) / (float)ACS712_MV_PER_AMP;
-    // Apply calibration: corrected = (raw * gain) + offset
-    const float current_calibrated = (current_raw * cal->gain) + cal->offset;
-
-    return current_calibrated;
+static void readings_track(adc_system_t *adc, const uint32_t value) {
+
+    adc_tracker_t *tracker = &adc->tracker;
+    tracker->samples++;
+    if (value + tracker->hysteresis < tracker->level)
+        tracker->armed = true;
+    else if (tracker->armed && tracker->last < tracker->level && value >= tracker->level) {
+        // upward crossing, interpolated between previous and present sample
+        const float fraction = (float)(tracker->level - tracker->last) / (float)(value - tracker->last);
+        if (tracker->crossing_valid) {
+            const float period = (float)(tracker->samples - tracker->crossing_index) + (fraction - tracker->crossing_fraction);
+            if (period >= ((float)ADC_SENSOR_RATE_HZ / AC_FREQUENCY_MAX_HZ) && period <= ((float)ADC_SENSOR_RATE_HZ / AC_FREQUENCY_MIN_HZ)) {
+                tracker->period_sum += period;
+                tracker->period_count++;
+            }
+        }
+        tracker->crossing_index    = tracker->samples;
+        tracker->crossing_fraction = fraction;
+        tracker->crossing_valid    = true;
+        tracker->armed             = false;
+        tracker->cycle             = true;
+    }
+    tracker->last = value;
 }
 
-static float convert_adc_to_voltage(const float rms_adc, const calibration_t *cal) {
-    // Convert ADC RMS to voltage at ADC pin
-    const float v_adc_rms = (rms_adc / (float)ADC_MAX_VALUE) * (float)ADC_VREF;
-    // Account for voltage divider to get actual sensor output voltage
-    const float v_sensor_rms = v_adc_rms * (float)VDIV_RATIO;
-    // Convert sensor voltage to actual AC voltage using ZMPT101B ratio
-    const float voltage_raw = v_sensor_rms / (float)ZMPT101B_RATIO;
-    // Apply calibration: corrected = (raw * gain) + offset
-    const float voltage_calibrated = (voltage_raw * cal->gain) + cal->offset;
+static void readings_cycle_queue(adc_system_t *adc) {
 
-    return voltage_calibrated;
+    // accumulators over the cycle just ended (since the previous boundary), for output off the acquisition path: never waits, dropped if output is behind
+    adc_cycle_t cycle = { .cycle = adc->cycle_count++, .time = esp_timer_get_time() };
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        cycle.accum[i].count       = adc->window.accum[i].count - adc->cycle.accum[i].count;
+        cycle.accum[i].sum         = adc->window.accum[i].sum - adc->cycle.accum[i].sum;
+        cycle.accum[i].sum_squares = adc->window.accum[i].sum_squares - adc->cycle.accum[i].sum_squares;
+    }
+    if (xQueueSend(adc->cycle_queue, &cycle, 0) != pdTRUE)
+        adc->cycle_dropped++;
 }
 
-static float calculate_zero_offset(const uint32_t *samples, const uint32_t count) {
+static void readings_cycle(adc_system_t *adc) {
 
-    if (count == 0)
-        return 0.0;
-    float sum = 0.0;
-    for (int i = 0; i < count; i++)
-        sum += (float)samples[i];
-    return sum / (float)count;
+    // whole cycle boundary at end of pattern round: the window can end here
+    adc->tracker.cycle = false;
+    if (!adc->tracker.aligned) {
+        readings_window_reset(&adc->window);
+        adc->tracker.aligned = true;
+        return;
+    }
+    if (adc->tracker.resync) { // cycle spans samples lost, so is dropped and the next starts here
+        adc->window         = adc->cycle;
+        adc->tracker.resync = false;
+        return;
+    }
+    adc->window.cycles++;
+    if (adc->cycle_queue != NULL)
+        readings_cycle_queue(adc);
+    adc->cycle = adc->window;
+    if (adc->capture.running && --adc->capture.cycles == 0) {
+        adc->capture.running = false;
+        adc->capture.done    = true;
+    }
+    if (adc->capture.armed) {
+        adc->capture.armed   = false;
+        adc->capture.running = true;
+    }
 }
 
-static float calculate_phase_angle(const uint32_t *voltage_samples, const uint32_t *current_samples, const uint32_t count, const float voltage_offset, const float current_offset) {
-
-    if (count < SAMPLES_PER_CYCLE * 2)
-        return 0.0;
-
-    int start = SAMPLES_PER_CYCLE, end = (int)count - SAMPLES_PER_CYCLE;
-    int voltage_crossing = -1;
-    for (int i = start; i < end && voltage_crossing < 0; i++)
-        if ((float)voltage_samples[i - 1] < voltage_offset && (float)voltage_samples[i] >= voltage_offset)
-            voltage_crossing = i;
-    if (voltage_crossing < 0)
-        return 0.0;
-    if (voltage_crossing + SAMPLES_PER_CYCLE < end)
-        end = voltage_crossing + SAMPLES_PER_CYCLE;
+static void readings_goertzel(adc_system_t *adc, const int sensor) {
 
-    for (int i = voltage_crossing; i < end; i++)
-        if ((float)current_samples[i - 1] < current_offset && (float)current_samples[i] >= current_offset) {
-            const float phase_angle = (((float)(i - voltage_crossing)) / (float)SAMPLES_PER_CYCLE) * (float)360.0;
-            return phase_angle > (float)180.0 ? phase_angle - (float)360.0 : phase_angle; // Normalize to ±180°
+    // block complete: harmonic phasors referenced to the last sample of the block
+    adc_goertzel_t *goertzel = &adc->goertzel[sensor];
+    for (int h = 0; h < HARMONICS_NUM; h++) {
+        const float real = goertzel->s1[h] - (adc->goertzel_cos[h] * goertzel->s2[h]), imag = adc->goertzel_sin[h] * goertzel->s2[h];
+        goertzel->power[h] += (real * real) + (imag * imag);
+        if (h == 0) {
+            goertzel->real = real;
+            goertzel->imag = imag;
         }
-
-    return 0.0;
+        goertzel->s1[h] = 0.0;
+        goertzel->s2[h] = 0.0;
+    }
+    goertzel->blocks++;
+    goertzel->count = 0;
+    goertzel->ready = true;
+#if PHASE_GOERTZEL
+    if (sensor >= NUM_DEVICES) { // voltage completes after current in the same pattern round: accumulate V·conj(I)
+        adc_goertzel_t *current = &adc->goertzel[sensor - NUM_DEVICES];
+        if (current->ready) {
+            adc_phase_t *phase = &adc->phase[sensor - NUM_DEVICES];
+            phase->real += (goertzel->real * current->real) + (goertzel->imag * current->imag);
+            phase->imag += (goertzel->imag * current->real) - (goertzel->real * current->imag);
+            phase->count++;
+        }
+        current->ready = goertzel->ready = false;
+    }
+#endif
 }
 
-static void readings_calculate(adc_system_t *adc, adc_result_t *readings) {
-
-    for (int d = 0, c = 0, v = NUM_DEVICES; d < NUM_DEVICES; d++, c++, v++) {
-
-        if (adc->sample_count[c] < ADC_SAMPLE_THRESHOLD_MIN) {
-            adc->zero_offset[c]       = 0.0;
-            readings[d].current_fault = FAULT_SAMPLES_CNT;
-            adc->fault_count[c][FAULT_SAMPLES_CNT]++;
-        } else {
-            const float zero_offset = calculate_zero_offset(adc->samples[c], adc->sample_count[c]);
-            const float current_rms = convert_adc_to_current(calculate_rms(adc->samples[c], adc->sample_count[c], zero_offset), &current_calibration[d]);
-            adc->zero_offset[c]     = zero_offset;
-            readings[d].current_rms = current_rms;
+static void readings_extract(const uint8_t *buffer, const uint32_t length, adc_system_t *adc) {
 
-            readings[d].current_fault = FAULT_NONE;
-            if (zero_offset < ZERO_OFFSET_LOWER || zero_offset > ZERO_OFFSET_UPPER) {
-                adc->fault_count[c][FAULT_ZERO_OFFSET]++;
-                readings[d].current_fault = FAULT_ZERO_OFFSET;
-            }
-            if (isnan(current_rms)) {
-                adc->fault_count[c][FAULT_ISNOTNUMBER]++;
-                readings[d].current_fault = FAULT_ISNOTNUMBER;
-            } else if (current_rms < 0) {
-                adc->fault_count[c][FAULT_BELOW_RANGE]++;
-                readings[d].current_fault = FAULT_BELOW_RANGE;
-            } else if (current_rms > MAX_CURRENT_A) {
-                adc->fault_count[c][FAULT_ABOVE_RANGE]++;
-                readings[d].current_fault = FAULT_ABOVE_RANGE;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-align"
+    const uint32_t *results = (const uint32_t *)buffer; // frame is word aligned, one TYPE2 result per word
+#pragma GCC diagnostic pop
+    const uint32_t results_count = length / SOC_ADC_DIGI_RESULT_BYTES;
+    for (uint32_t i = 0; i < results_count; i++) {
+        const uint32_t result = results[i];
+        const int sensor      = adc_channel_to_sensor[ADC_RESULT_SOURCE(result)];
+        if (sensor < 0)
+            continue;
+        const uint32_t raw    = ADC_RESULT_DATA(result);
+        const uint32_t value  = adc_sensor_to_linear[sensor][raw];
+        const int32_t centred = (int32_t)value - ADC_MIDPOINT;
+        if (adc->capture.running && (adc->capture.sensors & (1UL << sensor))) {
+            adc->capture.buffer[adc->capture.count++] = (uint16_t)raw;
+            if (adc->capture.count == adc->capture.size) {
+                adc->capture.running = false;
+                adc->capture.done    = true;
             }
         }
-
-        if (adc->sample_count[v] < ADC_SAMPLE_THRESHOLD_MIN) {
-            adc->zero_offset[v]       = 0.0;
-            readings[d].voltage_fault = FAULT_SAMPLES_CNT;
-            adc->fault_count[v][FAULT_SAMPLES_CNT]++;
+        adc_accum_t *accum = &adc->window.accum[sensor];
+        accum->count++;
+        accum->sum += centred;
+        accum->sum_squares += (uint32_t)(centred * centred);
+        accum->min               = __MIN(accum->min, value);
+        accum->max               = __MAX(accum->max, value);
+        adc_crossing_t *crossing = &adc->crossing[sensor];
+        if (crossing->last < crossing->level && value >= crossing->level && (float)accum->count > adc->cycle_samples)
+            readings_crossing(adc, sensor, accum->count);
+        crossing->last           = value;
+        adc_goertzel_t *goertzel = &adc->goertzel[sensor];
+        const float x            = (float)((int32_t)value - (int32_t)crossing->level);
+        for (int h = 0; h < HARMONICS_NUM; h++) {
+            const float s0  = x + (adc->goertzel_coeff[h] * goertzel->s1[h]) - goertzel->s2[h];
+            goertzel->s2[h] = goertzel->s1[h];
+            goertzel->s1[h] = s0;
+        }
+        if (++goertzel->count >= adc->goertzel_length)
+            readings_goertzel(adc, sensor);
+        if (sensor < NUM_DEVICES) {
+            adc_skew_t *skew    = &adc->skew[sensor];
+            skew->current       = centred;
+            skew->current_valid = true;
         } else {
-            const float zero_offset = calculate_zero_offset(adc->samples[v], adc->sample_count[v]);
-            const float voltage_rms = convert_adc_to_voltage(calculate_rms(adc->samples[v], adc->sample_count[v], zero_offset), &voltage_calibration[d]);
-            adc->zero_offset[v]     = zero_offset;
-            readings[d].voltage_rms = voltage_rms;
-
-            readings[d].voltage_fault = FAULT_NONE;
-            if (zero_offset < ZERO_OFFSET_LOWER || zero_offset > ZERO_OFFSET_UPPER) {
-                adc->fault_count[v][FAULT_ZERO_OFFSET]++;
-                readings[d].voltage_fault = FAULT_ZERO_OFFSET;
-            }
-            if (isnan(voltage_rms)) {
-                adc->fault_count[v][FAULT_ISNOTNUMBER]++;
-                readings[d].voltage_fault = FAULT_ISNOTNUMBER;
-            } else if (voltage_rms < 0) {
-                adc->fault_count[v][FAULT_BELOW_RANGE]++;
-                readings[d].voltage_fault = FAULT_BELOW_RANGE;
-            } else if (voltage_rms > MAX_VOLTAGE_V) {
-                adc->fault_count[v][FAULT_ABOVE_RANGE]++;
-                readings[d].voltage_fault = FAULT_ABOVE_RANGE;
+            adc_skew_t *skew = &adc->skew[sensor - NUM_DEVICES];
+            if (skew->current_valid && skew->voltage_valid) {
+                // voltage is converted ADC_SKEW_SLOTS after current: interpolate back to the current conversion time
+                const int32_t voltage = (skew->voltage * ADC_SKEW_SLOTS) + (centred * (NUM_SENSORS - ADC_SKEW_SLOTS));
+                adc_power_t *power    = &adc->window.power[sensor - NUM_DEVICES];
+                power->count++;
+                power->sum_voltage += voltage;
+                power->sum_current += skew->current;
+                power->sum_product += voltage * skew->current;
             }
+            skew->voltage       = centred;
+            skew->voltage_valid = true;
+            skew->current_valid = false;
         }
-
-        readings[d].phase_angle =
-            (readings[d].current_fault == FAULT_NONE && readings[d].voltage_fault == FAULT_NONE)
-                ? calculate_phase_angle(adc->samples[v], adc->samples[c], __MIN(adc->sample_count[v], adc->sample_count[c]), adc->zero_offset[v], adc->zero_offset[c])
-                : (float)0.0;
+        if (sensor == adc->tracker.sensor)
+            readings_track(adc, value);
+        if (sensor == NUM_SENSORS - 1 && adc->tracker.cycle)
+            readings_cycle(adc);
     }
 }
 
-static esp_err_t readings_process(adc_system_t *adc, adc_result_t *readings) {
-
-    ESP_ERROR_CHECK(readings_collect(adc));
+static void readings_begin(adc_system_t *adc) {
 
-    readings_calculate(adc, readings);
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        adc->crossing[i].crossing = 0;
+        adc->goertzel[i]          = (adc_goertzel_t) { 0 };
+    }
+    memset(adc->phase, 0, sizeof(adc->phase));
+    adc->tracker.period_sum   = 0.0;
+    adc->tracker.period_count = 0;
+#if !ADC_ACQUIRE_CONTINUOUS
+    // acquisition restarts, so nothing carries over and the window starts at the first cycle boundary
+    readings_window_reset(&adc->window);
+    memset(adc->skew, 0, sizeof(adc->skew));
+    adc->tracker.crossing_valid = adc->tracker.armed = adc->tracker.cycle = adc->tracker.aligned = false;
+#endif
+}
 
-    if (debug_enabled())
-        for (int i = 0; i < NUM_SENSORS; i++) {
-            uint32_t min = 0xFFFFFFFF, max = 0;
-            for (int j = 0; j < adc->sample_count[i]; j++) {
-                if (adc->samples[i][j] < min)
-                    min = adc->samples[i][j];
-                if (adc->samples[i][j] > max)
-                    max = adc->samples[i][j];
-            }
-            DEBUG_PRINT("# sensor[%d] gpio%02d (device %d, %s): samples=%lu, offset=%.1f, min=%lu, max=%lu, range=%lu\n", i, adc_sensor_pins[i],
-                        (i < NUM_DEVICES) ? i + 1 : i - NUM_DEVICES + 1, (i < NUM_DEVICES) ? "current" : "voltage", adc->sample_count[i], adc->zero_offset[i], min, max, max - min);
-        }
+static void readings_end(adc_system_t *adc) {
+
+    // window ends at the last cycle boundary and the partial cycle carries over, or without cycles (no voltage) takes everything; a window before that
+    // was dropped (processing having fallen behind) is carried into this one, as a longer window, so that its samples and energy are not lost
+    if (adc->result_windows == 0)
+        readings_window_reset(&adc->result);
+    adc->result_windows++;
+    if (adc->cycle.cycles > 0) {
+        readings_window_add(&adc->result, &adc->cycle);
+        readings_window_subtract(&adc->window, &adc->cycle);
+    } else {
+        readings_window_add(&adc->result, &adc->window);
+        readings_window_reset(&adc->window);
+    }
+    readings_window_reset(&adc->cycle);
 
-    return ESP_OK;
+    adc->result_goertzel_length    = adc->goertzel_length;
+    adc->result_goertzel_frequency = adc->frequency;
+    adc->frequency_measured        = adc->tracker.period_count > 0;
+    if (adc->frequency_measured)
+        readings_tune(adc, ((float)ADC_SENSOR_RATE_HZ * (float)adc->tracker.period_count) / adc->tracker.period_sum);
 }
 
-// ------------------------------------------------------------------------------------------------------------------------
+static int64_t readings_duration(const adc_system_t *adc) {
 
-#define OUTPUT_PRINT                           printf
-#define OUTPUT_FLUSH()                         fflush(stdout)
-#define OUTPUT_BEGIN(type, timestamp, counter) OUTPUT_PRINT("%016" PRIx64 " " type " %016" PRIx64, timestamp, counter)
-#define OUTPUT_END()                           OUTPUT_PRINT("\n"), OUTPUT_FLUSH()
+    // windowed: whole cycles after the first boundary
+    return (int64_t)(((float)(NUM_CYCLES_TO_SAMPLE + 1) * (float)(1000 * US_PER_MS)) / adc->frequency);
+}
 
-static void output_display_init(const int64_t timestamp, const uint64_t counter) {
+static void readings_feedback(adc_system_t *adc) {
+
+    // levels from processing of a completed window, applied as they arrive
+    adc_feedback_t *feedback;
+    while ((feedback = (adc_feedback_t *)ring_read_begin(&adc->feedback_ring)) != NULL) {
+        for (int i = 0; i < NUM_SENSORS; i++)
+            if (feedback->level[i] > 0)
+                adc->crossing[i].level = feedback->level[i];
+        adc_tracker_t *tracker = &adc->tracker;
+        if (feedback->tracker_sensor != tracker->sensor)
+            tracker->crossing_valid = tracker->armed = false;
+        tracker->sensor = feedback->tracker_sensor;
+        if (feedback->tracker_sensor >= 0) {
+            tracker->level      = feedback->tracker_level;
+            tracker->hysteresis = feedback->tracker_hysteresis;
+        }
+        ring_read_end(&adc->feedback_ring);
+    }
+}
+
+static void readings_resync(adc_system_t *adc) {
+
+    // samples lost to a recovery: nothing in progress may span the gap, so the partial cycle is dropped and the window resumes at the next boundary
+    adc_tracker_t *tracker = &adc->tracker;
+    if (tracker->aligned) {
+        adc->window     = adc->cycle;
+        tracker->resync = true;
+    }
+    tracker->crossing_valid = tracker->armed = tracker->cycle = false;
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        adc->crossing[i].crossing = 0;
+        memset(adc->goertzel[i].s1, 0, sizeof(adc->goertzel[i].s1));
+        memset(adc->goertzel[i].s2, 0, sizeof(adc->goertzel[i].s2));
+        adc->goertzel[i].count = 0;
+    }
+    for (int d = 0; d < NUM_DEVICES; d++)
+        adc->skew[d].current_valid = adc->skew[d].voltage_valid = false;
+    if (adc->capture.running) { // ends at the gap, with what it has
+        adc->capture.running = false;
+        adc->capture.done    = true;
+    }
+}
+
+static esp_err_t readings_recover(adc_system_t *adc, esp_err_t error) {
+
+    // tiered, cheapest first: restart the driver in place (ms), else recreate it, else give up so that the powermon restarts (seconds)
+    adc_recovery_t *recovery = &adc->recovery;
+    while (recovery->attempts < ADC_RECOVER_RESTARTS + ADC_RECOVER_REINITS) {
+        recovery->error = error; // reported by the processing task, as output may wait on its lock
+        recovery->failures++;
+        if (recovery->attempts++ < ADC_RECOVER_RESTARTS) {
+            (void)adc_continuous_stop(adc->handle);
+            (void)adc_continuous_flush_pool(adc->handle);
+            error = adc_continuous_start(adc->handle);
+            if (error == ESP_OK)
+                recovery->restarts++;
+        } else {
+            readings_close(adc);
+            if ((error = readings_open(adc)) == ESP_OK)
+                error = adc_continuous_start(adc->handle);
+            if (error == ESP_OK)
+                recovery->reinits++;
+        }
+        if (error == ESP_OK) {
+            recovery->frame_time = esp_timer_get_time();
+            readings_resync(adc);
+            return ESP_OK;
+        }
+    }
+    return error;
+}
+
+static esp_err_t readings_collect(adc_system_t *adc, const int64_t until_time) {
+
+    esp_err_t ret;
+    readings_begin(adc);
+#if !ADC_ACQUIRE_CONTINUOUS
+    if ((ret = adc_continuous_start(adc->handle)) != ESP_OK && (ret = readings_recover(adc, ret)) != ESP_OK)
+        return ret;
+#endif
+    uint32_t bytes_read      = 0;
+    adc->recovery.frame_time = esp_timer_get_time();
+    while (esp_timer_get_time() < until_time && !adc->acquire_stop) { // Fixed timing, sleeping until frames are ready then draining all of them
+        (void)ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ADC_READ_TIMEOUT_MS));
+        bool frames = false;
+        while ((ret = adc_continuous_read(adc->handle, adc->buffer, (uint32_t)adc->buffer_size, &bytes_read, 0)) == ESP_OK && bytes_read > 0) {
+            PERF_BEGIN(extract_begin);
+            readings_extract(adc->buffer, bytes_read, adc);
+            PERF_END(PERF_EXTRACT, extract_begin);
+            frames = true;
+        }
+        const int64_t read_time = esp_timer_get_time();
+        if (frames) {
+            adc->recovery.frame_time = read_time;
+            adc->recovery.attempts   = 0;
+        }
+        if (ret == ESP_ERR_TIMEOUT && (read_time - adc->recovery.frame_time) > ((int64_t)ADC_STALL_TIMEOUT_MS * US_PER_MS))
+            ret = ESP_ERR_INVALID_STATE; // stalled, not merely drained
+        if (ret != ESP_OK && ret != ESP_ERR_TIMEOUT && (ret = readings_recover(adc, ret)) != ESP_OK)
+            return ret;
+        readings_feedback(adc);
+    }
+#if !ADC_ACQUIRE_CONTINUOUS
+    (void)adc_continuous_stop(adc->handle); // if it failed, the next start does too, and is recovered
+#endif
+    readings_end(adc);
+
+    return ESP_OK;
+}
+
+static void readings_report(adc_system_t *adc, const int64_t time) {
+
+    // completed window to processing, dropped if processing has fallen behind
+    adc_report_t *report = (adc_report_t *)ring_write_begin(&adc->report_ring);
+    if (report == NULL) {
+        adc->windows_dropped++; // carried into the next, see readings_end
+        return;
+    }
+    report->time   = time;
+    report->window = adc->result;
+    memcpy(report->goertzel, adc->goertzel, sizeof(report->goertzel));
+    report->goertzel_length    = adc->result_goertzel_length;
+    report->goertzel_frequency = adc->result_goertzel_frequency;
+    memcpy(report->phase, adc->phase, sizeof(report->phase));
+    report->frequency          = adc->frequency;
+    report->frequency_measured = adc->frequency_measured;
+    report->windows            = adc->result_windows;
+    adc->result_windows        = 0;
+    ring_write_end(&adc->report_ring);
+    xTaskNotifyGive(adc->process_task);
+}
+
+static void readings_schedule_tick(void *parameters) {
+
+    // esp_timer task, on the grid: wakes acquisition to end the window at its time (windowed, to start one)
+    adc_system_t *adc       = (adc_system_t *)parameters;
+    const TaskHandle_t task = adc->acquire_task;
+    adc->schedule.ticks++;
+    if (task != NULL) // a tick already dispatched as acquisition ends
+        xTaskNotifyGive(task);
+}
+
+static esp_err_t readings_schedule_init(adc_system_t *adc) {
+
+    const esp_timer_create_args_t timer_args = {
+        .callback              = readings_schedule_tick,
+        .arg                   = adc,
+        .dispatch_method       = ESP_TIMER_TASK,
+        .name                  = "schedule",
+        .skip_unhandled_events = false,
+    };
+    return esp_timer_create(&timer_args, &adc->schedule.timer);
+}
+
+static esp_err_t readings_schedule_begin(adc_system_t *adc) {
+
+    // periodic alarms are each a period after the last alarm, not after the last was handled, so the grid does not drift
+    adc_schedule_t *schedule = &adc->schedule;
+    settings_t in_use;
+    settings_read(&in_use, NULL);
+    (void)esp_timer_stop(schedule->timer);
+    schedule->period  = in_use.period_read;
+    schedule->ticks   = 0;
+    schedule->handled = 0;
+    schedule->start   = esp_timer_get_time(); // before the timer, so that no tick is earlier than its time
+    return esp_timer_start_periodic(schedule->timer, (uint64_t)schedule->period * US_PER_MS);
+}
+
+static void readings_schedule_term(adc_system_t *adc) {
+
+    // stopped before deleted, as a running timer cannot be: no ticks after this, and any in dispatch find no task to notify
+    if (adc->schedule.timer != NULL) {
+        (void)esp_timer_stop(adc->schedule.timer);
+        (void)esp_timer_delete(adc->schedule.timer);
+        adc->schedule.timer = NULL;
+    }
+}
+
+static int64_t readings_schedule_time(const adc_schedule_t *schedule, const uint32_t tick) {
+    return schedule->start + ((int64_t)tick * (int64_t)schedule->period * US_PER_MS);
+}
+
+static void readings_schedule_handled(adc_schedule_t *schedule, const int64_t tick_time) {
+
+    const int64_t lateness = esp_timer_get_time() - tick_time;
+    const uint32_t jitter  = lateness > 0 ? (uint32_t)lateness : 0;
+    schedule->reports++;
+    schedule->jitter_sum += jitter;
+    if (jitter > schedule->jitter_max)
+        schedule->jitter_max = jitter;
+    if (jitter > SCHEDULE_LATE_US)
+        schedule->late++;
+}
+
+#if ADC_ACQUIRE_CONTINUOUS
+static int64_t readings_schedule_next(adc_schedule_t *schedule) {
+
+    // continuous: the window ends on the next tick, unless the last ended so late (e.g. recovering) that it has passed, when it ends on the first tick
+    // ahead instead, so that its samples are kept in a longer window rather than reported as an empty one, and the ticks skipped are late
+    const int64_t now    = esp_timer_get_time();
+    const uint32_t ticks = now > schedule->start ? (uint32_t)((now - schedule->start) / ((int64_t)schedule->period * US_PER_MS)) : 0; // at or before now
+    if (ticks > schedule->handled) {
+        schedule->late += ticks - schedule->handled;
+        schedule->handled = ticks;
+    }
+    return readings_schedule_time(schedule, schedule->handled + 1);
+}
+#else
+static int64_t readings_schedule_wait(adc_system_t *adc) {
+
+    // windowed: the window starts on the next tick, and ticks missed while acquiring are late and skipped
+    adc_schedule_t *schedule = &adc->schedule;
+    while (schedule->ticks == schedule->handled) {
+        if (adc->acquire_stop)
+            return esp_timer_get_time(); // ending, see readings_term
+        (void)ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    const uint32_t ticks = schedule->ticks;
+    schedule->late += ticks - schedule->handled - 1;
+    schedule->handled = ticks;
+    const int64_t tick_time = readings_schedule_time(schedule, ticks);
+    readings_schedule_handled(schedule, tick_time);
+    return tick_time;
+}
+#endif
+
+static void readings_task(void *parameters) {
+
+    adc_system_t *adc = (adc_system_t *)parameters;
+    esp_err_t ret     = ESP_OK;
+#if ADC_ACQUIRE_CONTINUOUS
+    // started here rather than in readings_init, so that the pool does not overflow before there is a task to drain it
+    adc->overflows = 0;
+    if ((ret = adc_continuous_start(adc->handle)) != ESP_OK)
+        ret = readings_recover(adc, ret);
+#endif
+    if (ret == ESP_OK)
+        ret = readings_schedule_begin(adc);
+    int64_t read_time = adc->schedule.start;
+    while (ret == ESP_OK && !adc->acquire_stop) {
+#if ADC_ACQUIRE_CONTINUOUS
+        const int64_t read_time_until = readings_schedule_next(&adc->schedule);
+#else
+        read_time                     = readings_schedule_wait(adc);
+        const int64_t read_time_until = esp_timer_get_time() + readings_duration(adc);
+#endif
+        if ((ret = readings_collect(adc, read_time_until)) != ESP_OK)
+            break;
+#if ADC_ACQUIRE_CONTINUOUS
+        readings_schedule_handled(&adc->schedule, read_time_until);
+        adc->schedule.handled++;
+#endif
+        readings_report(adc, read_time);
+        read_time = read_time_until;
+        settings_t in_use;
+        settings_read(&in_use, NULL);
+        if (adc->schedule.period != in_use.period_read) { // grid restarts from here
+            ret       = readings_schedule_begin(adc);
+            read_time = adc->schedule.start;
+        }
+    }
+    readings_schedule_term(adc);
+    adc->acquire_task  = NULL;
+    adc->acquire_error = ret;
+    xTaskNotifyGive(adc->process_task);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t readings_start(adc_system_t *adc) {
+
+    // acquisition on its own core, so that processing and output never hold it up
+    adc->process_task  = xTaskGetCurrentTaskHandle();
+    adc->acquire_error = ESP_OK;
+    esp_err_t ret;
+    if ((ret = readings_schedule_init(adc)) != ESP_OK)
+        return ret;
+    if (xTaskCreatePinnedToCore(readings_task, "acquire", ACQUIRE_TASK_STACK, adc, ACQUIRE_TASK_PRIORITY, &adc->acquire_task, ACQUIRE_TASK_CORE) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+static esp_err_t readings_term(adc_system_t *adc) {
+
+    // acquisition ended first if still running (as on restart by command), which stops the timer, so that neither it nor the driver is in use as they go
+    const TaskHandle_t task = adc->acquire_task;
+    adc->acquire_stop       = true;
+    if (task != NULL)
+        xTaskNotifyGive(task);
+    for (int waited = 0; adc->acquire_task != NULL && waited < ADC_STOP_TIMEOUT_MS; waited += ADC_READ_TIMEOUT_MS)
+        __delay(ADC_READ_TIMEOUT_MS);
+    if (adc->acquire_task != NULL)
+        return ESP_ERR_TIMEOUT; // still running, so all is left in place for it rather than freed under it
+    readings_schedule_term(adc);
+    readings_close(adc);
+    if (adc->buffer) {
+        free(adc->buffer);
+        adc->buffer = NULL;
+    }
+    return ESP_OK;
+}
+
+//
+
+static int64_t calculate_quotient(const int64_t sum, const uint32_t count) { return (sum >= 0 ? sum : sum - (int64_t)count + 1) / (int64_t)count; } // floor
+
+// Σ(x - x̄)(y - ȳ) = Σxy - ΣxΣy/n, exact in integers for any window length: with Σx = q·n + r and Σy = s·n + t (0 <= r, t < n),
+// ΣxΣy/n = q·Σy + r·s + r·t/n, of which r·t < n² fits 64 bits unsigned, so only the fraction of r·t/n is rounded
+static double calculate_comoment(const int64_t sum_xy, const int64_t sum_x, const int64_t sum_y, const uint32_t count) {
+
+    const int64_t quotient_x = calculate_quotient(sum_x, count), remainder_x = sum_x - (quotient_x * (int64_t)count);
+    const int64_t quotient_y = calculate_quotient(sum_y, count), remainder_y = sum_y - (quotient_y * (int64_t)count);
+    const uint64_t remainders = (uint64_t)remainder_x * (uint64_t)remainder_y;
+    return (double)(sum_xy - (quotient_x * sum_y) - (remainder_x * quotient_y) - (int64_t)(remainders / count)) - ((double)(remainders % count) / (double)count);
+}
+
+static float calculate_rms(const adc_accum_t *accum) {
+
+    if (accum->count == 0)
+        return 0.0;
+    const double sum_squares = calculate_comoment((int64_t)accum->sum_squares, accum->sum, accum->sum, accum->count);
+    return sum_squares > 0.0 ? sqrtf((float)(sum_squares / (double)accum->count)) : (float)0.0;
+}
+
+static float calculate_rms_offset(const adc_accum_t *accum, const float zero_offset) {
+
+    // about a given offset rather than the mean of the samples, Σ(x - o)² = Σx² - 2oΣx + no², so that a partial cycle does not bias it
+    if (accum->count == 0)
+        return 0.0;
+    const double offset      = (double)zero_offset - (double)ADC_MIDPOINT, count = (double)accum->count;
+    const double sum_squares = (double)accum->sum_squares - (2.0 * offset * (double)accum->sum) + (count * offset * offset);
+    return sum_squares > 0.0 ? sqrtf((float)(sum_squares / count)) : (float)0.0;
+}
+
+static float calculate_noise(const adc_goertzel_t *goertzel, const uint32_t length, const float rms) {
+
+    // power outside the harmonics is broadband noise, less the noise in the harmonic bins (2/N of its power each): returns noise power, or -1 if none
+    if (goertzel->blocks == 0 || length <= 2 * HARMONICS_NUM)
+        return -1.0;
+    float power_harmonics = 0.0;
+    for (int h = 0; h < HARMONICS_NUM; h++)
+        power_harmonics += goertzel->power[h];
+    const float residual = (rms * rms) - ((power_harmonics * (float)2.0) / ((float)goertzel->blocks * (float)length * (float)length));
+    return __MAX(residual, (float)0.0) / ((float)1.0 - ((float)(2 * HARMONICS_NUM) / (float)length));
+}
+
+static float calculate_denoise(const float rms, const float noise) {
+
+    // uncorrelated noise adds in power, RMS² = signal² + noise², so is subtracted in quadrature
+    const float power = (rms * rms) - (noise * noise);
+    return power > 0 ? sqrtf(power) : (float)0.0;
+}
+
+static float convert_adc_to_current(const float rms_adc, const settings_scale_t *scale, const int device) {
+    // Prebaked sensor conversion and calibration: corrected = (raw * gain) + offset
+    return (rms_adc * scale->current_scale[device]) + scale->current_offset[device];
+}
+
+static float convert_adc_to_voltage(const float rms_adc, const settings_scale_t *scale, const int device) {
+    // Prebaked sensor conversion and calibration: corrected = (raw * gain) + offset
+    return (rms_adc * scale->voltage_scale[device]) + scale->voltage_offset[device];
+}
+
+static float convert_adc_to_power(const float power_adc, const settings_scale_t *scale, const int device) {
+    // Scale the product by both sensor conversions per ADC count and calibration gains (calibration offsets only apply to RMS)
+    return power_adc * scale->voltage_scale[device] * scale->current_scale[device];
+}
+
+static float calculate_power(const adc_power_t *power, const float frequency) {
+
+    if (power->count == 0)
+        return 0.0;
+    // linear interpolation attenuates the fundamental by |H|, with |H|² = a² + b² + 2ab·cos(ωT) for weights a, b over the round period T
+    const double weight_a = (double)ADC_SKEW_SLOTS / NUM_SENSORS, weight_b = 1.0 - weight_a, omega_t = (2.0 * M_PI * frequency * NUM_SENSORS) / ADC_SAMPLE_RATE_HZ;
+    const double gain = sqrt((weight_a * weight_a) + (weight_b * weight_b) + (2.0 * weight_a * weight_b * cos(omega_t)));
+    return (float)(calculate_comoment(power->sum_product, power->sum_voltage, power->sum_current, power->count) / ((double)power->count * (double)NUM_SENSORS * gain));
+}
+
+static float calculate_zero_offset(const adc_accum_t *accum) {
+
+    if (accum->count == 0)
+        return 0.0;
+    return (float)ADC_MIDPOINT + (float)((double)accum->sum / (double)accum->count);
+}
+
+static adc_fault_t calculate_fault(const float zero_offset, const float value, const float value_max, uint32_t *fault_count) {
+
+    // of a sensor with enough samples, as windows and cycles: each fault found is counted (if fault_count), the last is returned
+    adc_fault_t fault = FAULT_NONE, range = FAULT_NONE;
+    if (zero_offset < ZERO_OFFSET_LOWER || zero_offset > ZERO_OFFSET_UPPER) {
+        fault = FAULT_ZERO_OFFSET;
+        if (fault_count != NULL)
+            fault_count[fault]++;
+    }
+    if (isnan(value))
+        range = FAULT_ISNOTNUMBER;
+    else if (value < 0)
+        range = FAULT_BELOW_RANGE;
+    else if (value > value_max)
+        range = FAULT_ABOVE_RANGE;
+    if (range != FAULT_NONE) {
+        fault = range;
+        if (fault_count != NULL)
+            fault_count[fault]++;
+    }
+    return fault;
+}
+
+static float calculate_phase_angle(const adc_phase_t *phase, const float frequency) {
+
+    if (phase->count == 0)
+        return 0.0;
+#if PHASE_GOERTZEL
+    // voltage block ends ADC_SKEW_SLOTS after current block: remove the rotation
+    const float skew  = (float)((2.0 * M_PI * ADC_SKEW_SLOTS) / ADC_SAMPLE_RATE_HZ) * frequency;
+    const float angle = atan2f(phase->imag, phase->real) - skew;
+    return remainderf(angle, (float)(2.0 * M_PI)) * (float)(180.0 / M_PI); // ±180°
+#else
+    (void)frequency;                                                 // crossings are counted in cycles
+    return atan2f(phase->imag, phase->real) * (float)(180.0 / M_PI); // Circular mean, ±180°
+#endif
+}
+
+static void calculate_harmonics(const adc_goertzel_t *goertzel, const uint32_t length, adc_harmonics_t *harmonics) {
+
+    *harmonics = (adc_harmonics_t) { 0 };
+    // |X| = N·A/2 for amplitude A, so RMS = |X|·√2/N
+    if (goertzel->blocks == 0 || sqrtf((goertzel->power[0] * (float)2.0) / (float)goertzel->blocks) / (float)length < (float)HARMONICS_FUNDAMENTAL_MIN)
+        return;
+    float power_harmonics = 0.0;
+    for (int h = 1; h < HARMONICS_NUM; h++) {
+        power_harmonics += goertzel->power[h];
+        for (int t = 0; t < HARMONICS_TOP; t++)
+            if (harmonics->top[t].order == 0 || goertzel->power[h] > goertzel->power[harmonics->top[t].order - 1]) {
+                memmove(&harmonics->top[t + 1], &harmonics->top[t], sizeof(adc_harmonic_t) * (size_t)(HARMONICS_TOP - t - 1));
+                harmonics->top[t].order = (uint8_t)(h + 1);
+                break;
+            }
+    }
+    harmonics->thd = sqrtf(power_harmonics / goertzel->power[0]) * (float)100.0;
+    for (int t = 0; t < HARMONICS_TOP && harmonics->top[t].order > 0; t++)
+        harmonics->top[t].percent = sqrtf(goertzel->power[harmonics->top[t].order - 1] / goertzel->power[0]) * (float)100.0;
+}
+
+static float readings_denoise(adc_system_t *adc, const adc_report_t *report, const int sensor, const float rms) {
+
+    // noise floor averaged over windows, where the residual is small enough to be noise not signal (e.g. interharmonics)
+    if (!(NOISE_FLOOR_SENSORS & (1UL << sensor)))
+        return rms;
+    const float noise = calculate_noise(&report->goertzel[sensor], report->goertzel_length, rms);
+    if (noise >= 0) {
+        const float weight = (float)1.0 / (float)__MIN(adc->windows + 1, NOISE_FLOOR_WINDOWS), power = adc->noise[sensor] * adc->noise[sensor];
+        adc->noise[sensor] = sqrtf(power + ((__MIN(noise, (float)(NOISE_FLOOR_MAX * NOISE_FLOOR_MAX)) - power) * weight));
+    }
+    return calculate_denoise(rms, adc->noise[sensor]);
+}
+
+static float readings_offset(adc_system_t *adc, const int sensor, const adc_accum_t *accum) {
+
+    // window means averaged over windows, restarting from the window mean at boot or on a step (e.g. sensor reconnected) so as to converge at once
+    const float mean  = calculate_zero_offset(accum);
+    float *offset     = &adc->zero_offset[sensor];
+    uint32_t *windows = &adc->zero_offset_windows[sensor];
+
+    adc->zero_offset_delta[sensor] = *windows > 0 ? mean - *offset : (float)0.0;
+    if (fabsf(mean - *offset) > (float)OFFSET_TRACK_STEP)
+        *windows = 0;
+    *offset += (mean - *offset) / (float)__MIN(*windows + 1, OFFSET_TRACK_WINDOWS);
+    if (*windows < OFFSET_TRACK_WINDOWS)
+        (*windows)++;
+    return *offset;
+}
+
+static float readings_rms(const adc_system_t *adc, const adc_window_t *window, const int sensor) {
+
+    // about the window mean if whole cycles, else (no voltage to find cycles by) about the tracked offset
+    return window->cycles > 0 ? calculate_rms(&window->accum[sensor]) : calculate_rms_offset(&window->accum[sensor], adc->zero_offset[sensor]);
+}
+
+static void readings_calculate(adc_system_t *adc, const adc_report_t *report, adc_result_t *readings) {
+
+    settings_scale_t scale;
+    settings_read(NULL, &scale);
+    const adc_window_t *result = &report->window;
+    adc_feedback_t feedback    = { 0 };
+    int reference_sensor       = -1;
+    float reference_rms        = (float)FREQUENCY_SIGNAL_MIN;
+    for (int d = 0, c = 0, v = NUM_DEVICES; d < NUM_DEVICES; d++, c++, v++) {
+
+        adc->samples[c] = result->accum[c].count;
+        if (result->accum[c].count < ADC_SAMPLE_THRESHOLD_MIN) {
+            adc->rms[c]               = 0.0;
+            readings[d].current_fault = FAULT_SAMPLES_CNT;
+            adc->fault_count[c][FAULT_SAMPLES_CNT]++;
+        } else {
+            const float zero_offset = readings_offset(adc, c, &result->accum[c]);
+            const float current_adc = readings_denoise(adc, report, c, readings_rms(adc, result, c));
+            const float current_rms = convert_adc_to_current(current_adc, &scale, d);
+            adc->rms[c]             = current_adc;
+            feedback.level[c]       = (uint32_t)lroundf(zero_offset);
+            readings[d].current_rms = current_rms;
+
+            readings[d].current_fault = calculate_fault(zero_offset, current_rms, (float)MAX_CURRENT_A, adc->fault_count[c]);
+        }
+
+        adc->samples[v] = result->accum[v].count;
+        if (result->accum[v].count < ADC_SAMPLE_THRESHOLD_MIN) {
+            adc->rms[v]               = 0.0;
+            readings[d].voltage_fault = FAULT_SAMPLES_CNT;
+            adc->fault_count[v][FAULT_SAMPLES_CNT]++;
+        } else {
+            const float zero_offset = readings_offset(adc, v, &result->accum[v]);
+            const float voltage_adc = readings_denoise(adc, report, v, readings_rms(adc, result, v));
+            const float voltage_rms = convert_adc_to_voltage(voltage_adc, &scale, d);
+            adc->rms[v]             = voltage_adc;
+            feedback.level[v]       = (uint32_t)lroundf(zero_offset);
+            readings[d].voltage_rms = voltage_rms;
+
+            readings[d].voltage_fault = calculate_fault(zero_offset, voltage_rms, (float)MAX_VOLTAGE_V, adc->fault_count[v]);
+            if (readings[d].voltage_fault == FAULT_NONE && voltage_adc > reference_rms) {
+                reference_sensor = v;
+                reference_rms    = voltage_adc;
+            }
+        }
+
+        if (readings[d].current_fault == FAULT_NONE && readings[d].voltage_fault == FAULT_NONE) {
+            readings[d].phase_angle    = calculate_phase_angle(&report->phase[d], report->goertzel_frequency);
+            readings[d].power_real     = convert_adc_to_power(calculate_power(&result->power[d], report->frequency), &scale, d);
+            readings[d].power_apparent = readings[d].voltage_rms * readings[d].current_rms;
+            readings[d].power_factor   = readings[d].power_apparent > 0 ? fmaxf((float)-1.0, fminf((float)1.0, readings[d].power_real / readings[d].power_apparent)) : (float)0.0;
+        } else
+            readings[d].phase_angle = readings[d].power_real = readings[d].power_apparent = readings[d].power_factor = 0.0;
+        calculate_harmonics(&report->goertzel[v], report->goertzel_length, &readings[d].voltage_harmonics);
+        calculate_harmonics(&report->goertzel[c], report->goertzel_length, &readings[d].current_harmonics);
+    }
+
+    // track frequency on the largest voltage, crossing at its offset with hysteresis of half RMS (~0.35 peak)
+    feedback.tracker_sensor = reference_sensor;
+    if (reference_sensor >= 0) {
+        feedback.tracker_level      = feedback.level[reference_sensor];
+        feedback.tracker_hysteresis = (uint32_t)(reference_rms / (float)2.0);
+    }
+    adc_feedback_t *feedback_slot = (adc_feedback_t *)ring_write_begin(&adc->feedback_ring);
+    if (feedback_slot != NULL) {
+        *feedback_slot = feedback;
+        ring_write_end(&adc->feedback_ring);
+    }
+    adc->windows++;
+}
+
+static void readings_recovery_debug(adc_recovery_t *recovery) {
+
+    // attempts since the last window, with the last error, as acquisition counts them but does not output
+    const uint32_t failures = recovery->failures;
+    if (failures != recovery->reported) {
+        const esp_err_t error = recovery->error;
+        DEBUG_PRINT("# adc recovery: error %d (%s), attempts %lu\n", error, esp_err_to_name(error), failures - recovery->reported);
+        recovery->reported = failures;
+    }
+}
+
+static void readings_process(adc_system_t *adc, const adc_report_t *report, adc_result_t *readings) {
+
+    readings_calculate(adc, report, readings);
+    readings_recovery_debug(&adc->recovery);
+
+    if (debug_enabled())
+        for (int i = 0; i < NUM_SENSORS; i++) {
+            const uint32_t min = report->window.accum[i].count > 0 ? report->window.accum[i].min : 0, max = report->window.accum[i].max;
+            DEBUG_PRINT("# sensor[%d] gpio%02d (device %d, %s): samples=%lu, offset=%.1f, min=%lu, max=%lu, range=%lu\n", i, adc_sensor_pins[i],
+                        (i < NUM_DEVICES) ? i + 1 : i - NUM_DEVICES + 1, (i < NUM_DEVICES) ? "current" : "voltage", report->window.accum[i].count, adc->zero_offset[i], min, max,
+                        max - min);
+        }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define OUTPUT_PRINT                           output_print
+#define OUTPUT_LOCK()                          xSemaphoreTake(__output_lock, portMAX_DELAY) // records from main, stream and command tasks, held only while formatting
+#define OUTPUT_UNLOCK()                        xSemaphoreGive(__output_lock)
+#define OUTPUT_BEGIN(type, timestamp, counter) output_begin(), OUTPUT_PRINT("%016" PRIx64 " " type " %016" PRIx64, timestamp, counter)
+#define OUTPUT_END()                           output_end(true)
+
+#if NUM_DEVICES > PROTOCOL_DEVICES_MAX || HARMONICS_TOP != PROTOCOL_HARMONICS_TOP
+#error "protocol limits do not match configuration"
+#endif
+#if (OUTPUT_RING_SIZE & (OUTPUT_RING_SIZE - 1)) != 0
+#error OUTPUT_RING_SIZE must be a power of 2
+#endif
+_Static_assert(NUM_FAULTS == PROTOCOL_FAULTS_NUM, "protocol fault codes do not match");
+_Static_assert(NUM_EVENTS == PROTOCOL_EVENTS_NUM, "protocol event codes do not match");
+#if PERF_INSTRUMENT
+_Static_assert(NUM_PERF_STAGES == PROTOCOL_PERF_STAGES && PERF_BUCKETS == PROTOCOL_PERF_BUCKETS && PERF_CORES == PROTOCOL_PERF_CORES && PERF_TASKS == PROTOCOL_PERF_TASKS,
+               "protocol perf layout does not match");
+#endif
+_Static_assert(sizeof(protocol_header_t) + sizeof(protocol_diag_t) + (NUM_SENSORS * sizeof(protocol_diag_sensor_t)) + PROTOCOL_CRC_SIZE <= PROTOCOL_RECORD_MAX,
+               "protocol record too small");
+
+typedef struct {
+    uint16_t length;
+    uint8_t data[OUTPUT_RECORD_SIZE];
+} output_slot_t;
+
+typedef struct {
+    ring_t ring;           // formatted records, to the writer
+    output_slot_t *slot;   // being formatted, under lock
+    output_slot_t discard; // formatted into when the ring is full
+    TaskHandle_t task;     // writer
+    uint32_t bytes_queued;
+    uint32_t bytes_sent;
+    uint32_t dropped; // records, as ring full or host not reading
+    uint32_t peak;    // records queued, most
+} output_queue_t;
+
+static output_slot_t output_slots[OUTPUT_RING_SIZE];
+static output_queue_t output_queue;
+
+static SemaphoreHandle_t __output_lock = NULL;
+static bool __output_binary             = false;
+static void __output_init(void) {
+    __output_lock = xSemaphoreCreateMutex();
+    (void)ring_init(&output_queue.ring, output_slots, sizeof(output_slot_t), OUTPUT_RING_SIZE);
+    gpio_input_enable(GPIO_BINARY_MODE);
+    gpio_set_pull_mode(GPIO_BINARY_MODE, GPIO_PULLUP_ONLY);
+    if (gpio_get_level(GPIO_BINARY_MODE) == 0)
+        __output_binary = true;
+}
+#define output_binary() (__output_binary)
+
+static void output_begin(void) {
+    OUTPUT_LOCK();
+    output_slot_t *slot       = (output_slot_t *)ring_write_begin(&output_queue.ring);
+    output_queue.slot         = slot != NULL ? slot : &output_queue.discard;
+    output_queue.slot->length = 0;
+}
+
+static void output_vprint(const char *format, va_list arguments) {
+    // truncated to the slot, keeping space for the line end
+    output_slot_t *slot = output_queue.slot;
+    const size_t space  = sizeof(slot->data) - 1 - slot->length;
+    const int length    = vsnprintf((char *)&slot->data[slot->length], space, format, arguments);
+    if (length > 0)
+        slot->length = (uint16_t)(slot->length + __MIN((size_t)length, space - 1));
+}
+
+static void __attribute__((format(printf, 1, 2))) output_print(const char *format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    output_vprint(format, arguments);
+    va_end(arguments);
+}
+
+static void output_end(const bool line) {
+    // record to the writer, never waiting on the host: dropped if the ring is full
+    if (line)
+        output_queue.slot->data[output_queue.slot->length++] = '\n';
+    if (output_queue.slot == &output_queue.discard)
+        output_queue.dropped++;
+    else {
+        output_queue.bytes_queued += output_queue.slot->length;
+        ring_write_end(&output_queue.ring);
+        output_queue.peak = __MAX(output_queue.peak, ring_count(&output_queue.ring));
+        if (output_queue.task != NULL)
+            xTaskNotifyGive(output_queue.task);
+    }
+    OUTPUT_UNLOCK();
+}
+
+static void __attribute__((format(printf, 1, 2))) output_debug(const char *format, ...) {
+    // a record of its own, line end included, so that text from any task lands between records, never inside a binary frame
+    output_begin();
+    va_list arguments;
+    va_start(arguments, format);
+    output_vprint(format, arguments);
+    va_end(arguments);
+    output_end(false);
+}
+
+static void output_send(const output_slot_t *slot) {
+    size_t sent = 0;
+    while (sent < slot->length) {
+        const size_t queued = tinyusb_cdcacm_write_queue(TINYUSB_CDC_ACM_0, &slot->data[sent], slot->length - sent);
+        sent += queued;
+        if (tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0, pdMS_TO_TICKS(OUTPUT_FLUSH_TIMEOUT_MS)) != ESP_OK && queued == 0)
+            break; // host not reading: abandon, the client resynchronises on the next delimiter or line
+    }
+    OUTPUT_LOCK();
+    output_queue.bytes_sent += (uint32_t)sent;
+    if (sent < slot->length)
+        output_queue.dropped++;
+    OUTPUT_UNLOCK();
+}
+
+static void output_task(void *parameters) {
+
+    (void)parameters;
+    while (true) {
+        const output_slot_t *slot = (const output_slot_t *)ring_read_begin(&output_queue.ring);
+        if (slot == NULL) {
+            (void)ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        output_send(slot);
+        ring_read_end(&output_queue.ring);
+    }
+}
+
+static uint8_t output_record[PROTOCOL_RECORD_MAX];
+
+static uint8_t *output_binary_begin(const protocol_type_t type, const int64_t timestamp, const uint64_t counter) {
+    output_begin();
+    *(protocol_header_t *)output_record = (protocol_header_t) { .type = (uint8_t)type, .version = PROTOCOL_VERSION, .timestamp = timestamp, .counter = counter };
+    return &output_record[sizeof(protocol_header_t)];
+}
+
+static void output_binary_end(const uint8_t *record_end) {
+    const size_t length                          = (size_t)(record_end - output_record);
+    ((protocol_header_t *)output_record)->length = (uint16_t)(length - sizeof(protocol_header_t));
+    output_queue.slot->length                    = (uint16_t)protocol_frame_encode(output_record, length, output_queue.slot->data);
+    output_end(false);
+}
+
+static void output_binary_init(const int64_t timestamp, const uint64_t counter, const settings_t *in_use) {
+    uint8_t *record       = output_binary_begin(PROTOCOL_TYPE_INIT, timestamp, counter);
+    protocol_init_t *init = (protocol_init_t *)record;
+    snprintf(init->type, sizeof(init->type), "%s", SYSTEM_TYPE);
+    snprintf(init->version, sizeof(init->version), "%s", SYSTEM_VERSION);
+    snprintf(init->platform, sizeof(init->platform), "%s", SYSTEM_PLATFORM);
+    snprintf(init->serial, sizeof(init->serial), "%s", __app_serial());
+    snprintf(init->sensor_voltage, sizeof(init->sensor_voltage), "%s", SYSTEM_SENSOR_VOLTAGE);
+    snprintf(init->sensor_current, sizeof(init->sensor_current), "%s", SYSTEM_SENSOR_CURRENT);
+    init->voltage_max    = (float)MAX_VOLTAGE_V;
+    init->current_max    = (float)MAX_CURRENT_A;
+    init->period_read    = in_use->period_read;
+    init->period_diag    = in_use->period_diag;
+    init->adc_rate       = ADC_SAMPLE_RATE_HZ;
+    init->adc_frame_size = ADC_FRAME_SIZE;
+    init->adc_pool_size  = ADC_POOL_SIZE;
+    init->adc_bits       = ADC_BIT_SIZE;
+    init->harmonics      = HARMONICS_NUM;
+    init->flags          = (uint8_t)((debug_enabled() ? PROTOCOL_INIT_DEBUG : 0) | (ADC_ACQUIRE_CONTINUOUS ? PROTOCOL_INIT_CONTINUOUS : 0) |
+                            (PHASE_GOERTZEL ? PROTOCOL_INIT_GOERTZEL : 0) | (STREAM_CYCLES ? PROTOCOL_INIT_STREAM : 0) | (STREAM_CYCLES_ALL ? PROTOCOL_INIT_STREAM_ALL : 0) |
+                            (settings_stored ? PROTOCOL_INIT_SETTINGS : 0) | (adc_linear_calibrated ? PROTOCOL_INIT_LINEAR : 0));
+    init->devices        = NUM_DEVICES;
+    record += sizeof(protocol_init_t);
+    for (int d = 0; d < NUM_DEVICES; d++, record += sizeof(protocol_calibration_t)) {
+        protocol_calibration_t *calibration = (protocol_calibration_t *)record;
+        calibration->voltage_gain           = in_use->voltage_calibration[d].gain;
+        calibration->voltage_offset         = in_use->voltage_calibration[d].offset;
+        calibration->current_gain           = in_use->current_calibration[d].gain;
+        calibration->current_offset         = in_use->current_calibration[d].offset;
+        calibration->current_rating         = in_use->current_rating[d];
+        calibration->current_pin            = (uint8_t)adc_sensor_pins[d];
+        calibration->voltage_pin            = (uint8_t)adc_sensor_pins[d + NUM_DEVICES];
+    }
+    output_binary_end(record);
+}
+
+static void output_binary_read(const int64_t timestamp, const uint64_t counter, const adc_result_t *read_data, const float frequency, const uint32_t present) {
+    uint8_t *record         = output_binary_begin(PROTOCOL_TYPE_READ, timestamp, counter);
+    protocol_read_t *header = (protocol_read_t *)record;
+    *header                 = (protocol_read_t) { .frequency = frequency, .present = (uint16_t)present, .devices = 0 };
+    record += sizeof(protocol_read_t);
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        if (!(present & (1UL << d)))
+            continue;
+        protocol_read_device_t *device = (protocol_read_device_t *)record;
+        device->voltage                = read_data[d].voltage_rms;
+        device->current                = read_data[d].current_rms;
+        device->phase                  = read_data[d].phase_angle;
+        device->power_real             = read_data[d].power_real;
+        device->power_apparent         = read_data[d].power_apparent;
+        device->power_factor           = read_data[d].power_factor;
+        device->voltage_fault          = (uint8_t)read_data[d].voltage_fault;
+        device->current_fault          = (uint8_t)read_data[d].current_fault;
+        device->energy_import          = read_data[d].energy_import;
+        device->energy_export          = read_data[d].energy_export;
+        device->run_hours              = read_data[d].run_hours;
+        record += sizeof(protocol_read_device_t);
+        header->devices++;
+    }
+    output_binary_end(record);
+}
+
+static uint8_t *output_binary_harmonics(uint8_t *record, const adc_harmonics_t *harmonics) {
+    protocol_harmonics_t *harmonics_record = (protocol_harmonics_t *)record;
+    harmonics_record->thd                  = harmonics->thd;
+    for (int t = 0; t < HARMONICS_TOP; t++) {
+        harmonics_record->order[t]   = harmonics->top[t].order;
+        harmonics_record->percent[t] = harmonics->top[t].percent;
+    }
+    return record + sizeof(protocol_harmonics_t);
+}
+
+static void output_binary_harm(const int64_t timestamp, const uint64_t counter, const adc_result_t *read_data) {
+    uint8_t *record            = output_binary_begin(PROTOCOL_TYPE_HARM, timestamp, counter);
+    *(protocol_harm_t *)record = (protocol_harm_t) { .devices = NUM_DEVICES };
+    record += sizeof(protocol_harm_t);
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        record = output_binary_harmonics(record, &read_data[d].voltage_harmonics);
+        record = output_binary_harmonics(record, &read_data[d].current_harmonics);
+    }
+    output_binary_end(record);
+}
+
+static uint8_t *output_binary_diag_sensor(uint8_t *record, const adc_system_t *read_adcs, const int sensor) {
+    protocol_diag_sensor_t *sensor_record = (protocol_diag_sensor_t *)record;
+    sensor_record->samples                = read_adcs->samples[sensor];
+    sensor_record->offset                 = read_adcs->zero_offset[sensor];
+    sensor_record->offset_delta           = read_adcs->zero_offset_delta[sensor];
+    sensor_record->noise                  = read_adcs->noise[sensor];
+    for (int f = 0; f < NUM_FAULTS; f++)
+        sensor_record->faults[f] = read_adcs->fault_count[sensor][f];
+    return record + sizeof(protocol_diag_sensor_t);
+}
+
+static void output_binary_diag(const int64_t timestamp, const uint64_t counter, const adc_system_t *read_adcs) {
+    uint8_t *record       = output_binary_begin(PROTOCOL_TYPE_DIAG, timestamp, counter);
+    protocol_diag_t *diag = (protocol_diag_t *)record;
+    diag->devices         = NUM_DEVICES;
+    diag->cycles          = read_adcs->cycle_count;
+    diag->cycles_dropped  = read_adcs->cycle_dropped;
+    diag->windows         = read_adcs->windows;
+    diag->windows_dropped = read_adcs->windows_dropped;
+    diag->adc_overflows   = read_adcs->overflows;
+    diag->adc_restarts    = read_adcs->recovery.restarts;
+    diag->adc_reinits     = read_adcs->recovery.reinits;
+    diag->schedule_jitter = read_adcs->schedule.reports > 0 ? (uint32_t)(read_adcs->schedule.jitter_sum / read_adcs->schedule.reports) : 0;
+    diag->schedule_max    = read_adcs->schedule.jitter_max;
+    diag->schedule_late   = read_adcs->schedule.late;
+    diag->output_queued   = output_queue.bytes_queued;
+    diag->output_sent     = output_queue.bytes_sent;
+    diag->output_dropped  = output_queue.dropped;
+    diag->output_peak     = output_queue.peak;
+    record += sizeof(protocol_diag_t);
+    for (int d = 0, c = 0, v = NUM_DEVICES; d < NUM_DEVICES; d++, c++, v++) {
+        record = output_binary_diag_sensor(record, read_adcs, v);
+        record = output_binary_diag_sensor(record, read_adcs, c);
+    }
+    output_binary_end(record);
+}
+
+static void output_binary_fail(const int64_t timestamp, const uint64_t counter, const char *message, const esp_err_t error) {
+    uint8_t *record       = output_binary_begin(PROTOCOL_TYPE_FAIL, timestamp, counter);
+    protocol_fail_t *fail = (protocol_fail_t *)record;
+    fail->error           = error;
+    snprintf(fail->error_name, sizeof(fail->error_name), "%s", esp_err_to_name(error));
+    snprintf(fail->message, sizeof(fail->message), "%s", message);
+    output_binary_end(record + sizeof(protocol_fail_t));
+}
+
+static void output_binary_cycl(const adc_cycle_result_t *cycle, const uint32_t dropped) {
+    uint8_t *record          = output_binary_begin(PROTOCOL_TYPE_CYCL, cycle->time, cycle->cycle);
+    protocol_cycle_t *header = (protocol_cycle_t *)record;
+    header->dropped          = dropped;
+    header->trigger          = cycle->trigger;
+    header->devices          = 0;
+    record += sizeof(protocol_cycle_t);
+    for (int d = 0; d < NUM_DEVICES; d++)
+        if (STREAM_DEVICES & (1 << d)) {
+            protocol_cycle_device_t *device = (protocol_cycle_device_t *)record;
+            device->device                  = (uint8_t)d;
+            device->voltage                 = cycle->voltage_rms[d];
+            device->current                 = cycle->current_rms[d];
+            record += sizeof(protocol_cycle_device_t);
+            header->devices++;
+        }
+    output_binary_end(record);
+}
+
+static void output_binary_evnt(const int64_t timestamp, const uint64_t counter, const adc_event_t *event) {
+    uint8_t *record        = output_binary_begin(PROTOCOL_TYPE_EVNT, timestamp, counter);
+    protocol_event_t *body = (protocol_event_t *)record;
+    body->device           = (uint8_t)event->device;
+    body->event            = (uint8_t)event->type;
+    body->active           = event->active ? 1 : 0;
+    body->fault            = (uint8_t)event->fault;
+    body->before           = event->before;
+    body->after            = event->after;
+    output_binary_end(record + sizeof(protocol_event_t));
+}
+
+#if PERF_INSTRUMENT
+static void output_binary_perf(const int64_t timestamp, const uint64_t counter, const perf_histogram_t stages[NUM_PERF_STAGES], const float idle[PERF_CORES]) {
+    uint8_t *record       = output_binary_begin(PROTOCOL_TYPE_PERF, timestamp, counter);
+    protocol_perf_t *body = (protocol_perf_t *)record;
+    for (int s = 0; s < NUM_PERF_STAGES; s++) {
+        const perf_histogram_t *histogram = &stages[s];
+        body->stages[s].count             = histogram->count;
+        body->stages[s].mean              = perf_mean(histogram);
+        body->stages[s].max               = histogram->max;
+        memcpy(body->stages[s].buckets, histogram->buckets, sizeof(body->stages[s].buckets));
+    }
+    for (int core = 0; core < PERF_CORES; core++)
+        body->idle[core] = idle[core];
+    for (int t = 0; t < PERF_TASKS; t++)
+        body->stack[t] = perf_stack(perf_tasks[t]);
+    body->heap_free = (uint32_t)esp_get_free_heap_size();
+    body->heap_min  = (uint32_t)esp_get_minimum_free_heap_size();
+    output_binary_end(record + sizeof(protocol_perf_t));
+}
+#endif
+
+static void output_display_init(const int64_t timestamp, const uint64_t counter) {
+    settings_t in_use;
+    settings_read(&in_use, NULL);
+    if (output_binary()) {
+        output_binary_init(timestamp, counter, &in_use);
+        return;
+    }
     OUTPUT_BEGIN("INIT", timestamp, counter);
-    OUTPUT_PRINT(" type=%s,vers=%s,arch=%s,serial=%s,hw-voltage=%s,hw-current=%s", SYSTEM_TYPE, SYSTEM_VERSION, SYSTEM_PLATFORM, __app_serial(), SYSTEM_SENSOR_VOLTAGE,
-                 SYSTEM_SENSOR_CURRENT);
-    OUTPUT_PRINT(",voltage-freq=%d,voltage-max=%.0f,current-max=%.0f", AC_FREQUENCY_HZ, MAX_VOLTAGE_V, MAX_CURRENT_A);
-    OUTPUT_PRINT(",devices=%d,period-read=%d,period-diag=%d,debug-pin=%s", NUM_DEVICES, REPORTINGS_PERIOD_MS, DIAGNOSTIC_PERIOD_MS, debug_enabled() ? "yes" : "no");
+    OUTPUT_PRINT(" type=%s,vers=%s,arch=%s,serial=%s,hw-voltage=%s,hw-current=", SYSTEM_TYPE, SYSTEM_VERSION, SYSTEM_PLATFORM, __app_serial(), SYSTEM_SENSOR_VOLTAGE);
+    for (int d = 0; d < NUM_DEVICES; d++)
+        OUTPUT_PRINT("%s%s-%u", d == 0 ? "" : "/", SYSTEM_SENSOR_CURRENT, in_use.current_rating[d]);
+    OUTPUT_PRINT(",voltage-freq=auto,voltage-max=%.0f,current-max=%.0f", MAX_VOLTAGE_V, MAX_CURRENT_A);
+    OUTPUT_PRINT(",devices=%d,period-read=%lu,period-diag=%lu,debug-pin=%s", NUM_DEVICES, in_use.period_read, in_use.period_diag, debug_enabled() ? "yes" : "no");
+    OUTPUT_PRINT(",adc-mode=%s,phase-mode=%s,harmonics=%d", ADC_ACQUIRE_CONTINUOUS ? "continuous" : "windowed", PHASE_GOERTZEL ? "goertzel" : "crossing", HARMONICS_NUM);
+    OUTPUT_PRINT(",stream=%s", STREAM_CYCLES ? (STREAM_CYCLES_ALL ? "all" : "triggered") : "none");
     char pins_str[MAX_STR_SIZE];
     for (int i = 0, o = 0; i < NUM_SENSORS; i++)
         o += snprintf(&pins_str[o], sizeof(pins_str) - (size_t)o, "%s%d", i == 0 ? "" : "/", adc_sensor_pins[i]);
     OUTPUT_PRINT(",adc-bits=%d,adc-rate=%dkHz,adc-size-frame=%d,adc-size-pool=%d,adc-pins=%s", ADC_BIT_SIZE, ADC_SAMPLE_RATE_HZ / 1000, ADC_FRAME_SIZE, ADC_POOL_SIZE, pins_str);
+    OUTPUT_PRINT(",adc-linear=%s", adc_linear_calibrated ? "efuse" : "none");
     OUTPUT_PRINT(",calibrations=");
     for (int d = 0; d < NUM_DEVICES; d++)
-        OUTPUT_PRINT("%s%.3f+%.1fV/%.3f+%.1fC", d == 0 ? "" : ";", voltage_calibration[d].gain, voltage_calibration[d].offset, current_calibration[d].gain,
-                     current_calibration[d].offset);
+        OUTPUT_PRINT("%s%.3f%+.1fV/%.3f%+.1fC", d == 0 ? "" : ";", in_use.voltage_calibration[d].gain, in_use.voltage_calibration[d].offset,
+                     in_use.current_calibration[d].gain, in_use.current_calibration[d].offset);
+    OUTPUT_PRINT(",settings=%s,protocol=text", settings_stored ? "stored" : "default");
     OUTPUT_END();
 }
 
 static void output_display_term(const int64_t timestamp, const uint64_t counter) {
+    if (output_binary()) {
+        output_binary_end(output_binary_begin(PROTOCOL_TYPE_TERM, timestamp, counter));
+        return;
+    }
     OUTPUT_BEGIN("TERM", timestamp, counter);
     OUTPUT_END();
 }
 
-static void output_display_read(const int64_t timestamp, const uint64_t counter, const adc_result_t *read_data) {
-    OUTPUT_BEGIN("READ", timestamp, counter);
+static bool output_read_changed(const adc_result_t *read, const adc_result_t *reported) {
+
+    // beyond a deadband of any quantity since last in READ, or a change of fault (faulted values are not meaningful, energy totals are held)
+    if (read->voltage_fault != reported->voltage_fault || read->current_fault != reported->current_fault)
+        return true;
+    if (fabsf(read->energy_import - reported->energy_import) > (float)READ_DEADBAND_ENERGY || fabsf(read->energy_export - reported->energy_export) > (float)READ_DEADBAND_ENERGY)
+        return true;
+    if (read->voltage_fault == FAULT_NONE && fabsf(read->voltage_rms - reported->voltage_rms) > (float)READ_DEADBAND_VOLTAGE)
+        return true;
+    if (read->current_fault == FAULT_NONE && fabsf(read->current_rms - reported->current_rms) > (float)READ_DEADBAND_CURRENT)
+        return true;
+    if (read->voltage_fault != FAULT_NONE || read->current_fault != FAULT_NONE)
+        return false;
+    if (fabsf(read->power_real - reported->power_real) > (float)READ_DEADBAND_POWER || fabsf(read->power_apparent - reported->power_apparent) > (float)READ_DEADBAND_POWER)
+        return true;
+    // phase of no current is of noise, so only with a load
+    return read->current_rms > (float)READ_DEADBAND_CURRENT && (fabsf(read->phase_angle - reported->phase_angle) > (float)READ_DEADBAND_PHASE ||
+                                                                fabsf(read->power_factor - reported->power_factor) > (float)READ_DEADBAND_POWER_FACTOR);
+}
+
+static uint32_t output_read_present(const adc_result_t *read_data) {
+
+    // report by exception: devices (bit mask) to include, being those changed or silent for the heartbeat, as last included are held by the host
+    static adc_result_t reported[NUM_DEVICES];
+    static uint32_t silent[NUM_DEVICES];
+    static bool started = false;
+    if (!READ_EXCEPTION)
+        return (1UL << NUM_DEVICES) - 1;
+    uint32_t present = 0;
     for (int d = 0; d < NUM_DEVICES; d++)
-        OUTPUT_PRINT(" %03.6f,%02.6f,%+04.0f,%s,%s", read_data[d].voltage_fault != FAULT_NONE ? 999.999999 : read_data[d].voltage_rms,
-                     read_data[d].current_fault != FAULT_NONE ? 99.999999 : read_data[d].current_rms,
-                     read_data[d].voltage_fault != FAULT_NONE || read_data[d].current_fault != FAULT_NONE ? 999.0 : read_data[d].phase_angle, fault2str(read_data[d].voltage_fault),
-                     fault2str(read_data[d].current_fault));
+        if (!started || ++silent[d] >= READ_HEARTBEAT || output_read_changed(&read_data[d], &reported[d])) {
+            reported[d] = read_data[d];
+            silent[d]   = 0;
+            present |= (1UL << d);
+        }
+    started = true;
+    return present;
+}
+
+static void output_display_read(const int64_t timestamp, const uint64_t counter, const adc_result_t *read_data, const float frequency) {
+    const uint32_t present = output_read_present(read_data);
+    if (output_binary()) {
+        output_binary_read(timestamp, counter, read_data, frequency, present);
+        return;
+    }
+    OUTPUT_BEGIN("READ", timestamp, counter);
+    if (READ_EXCEPTION)
+        OUTPUT_PRINT(" @%lx", present);
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        if (!(present & (1UL << d)))
+            continue;
+        const bool faulted = read_data[d].voltage_fault != FAULT_NONE || read_data[d].current_fault != FAULT_NONE;
+        OUTPUT_PRINT(" %03.6f,%02.6f,%+06.1f,%s,%s", read_data[d].voltage_fault != FAULT_NONE ? 999.999999 : read_data[d].voltage_rms,
+                     read_data[d].current_fault != FAULT_NONE ? 99.999999 : read_data[d].current_rms, faulted ? 999.0 : read_data[d].phase_angle,
+                     fault2str(read_data[d].voltage_fault), fault2str(read_data[d].current_fault));
+        OUTPUT_PRINT(",%+.3f,%.3f,%+.3f", faulted ? 99999.999 : read_data[d].power_real, faulted ? 99999.999 : read_data[d].power_apparent,
+                     faulted ? 9.999 : read_data[d].power_factor);
+        OUTPUT_PRINT(",%.1f,%.1f,%.3f", read_data[d].energy_import, read_data[d].energy_export, read_data[d].run_hours);
+    }
+    OUTPUT_PRINT(" %.3f", frequency);
+    OUTPUT_END();
+}
+
+static const char *harmonics2str(const adc_harmonics_t *harmonics, char *string, const size_t string_size) {
+    int o = snprintf(string, string_size, "%.2f", harmonics->thd);
+    for (int t = 0; t < HARMONICS_TOP && harmonics->top[t].order > 0; t++)
+        o += snprintf(&string[o], string_size - (size_t)o, "%s%d:%.2f", t == 0 ? "," : "/", harmonics->top[t].order, harmonics->top[t].percent);
+    if (harmonics->top[0].order == 0)
+        snprintf(&string[o], string_size - (size_t)o, ",-");
+    return string;
+}
+
+static void output_display_harm(const int64_t timestamp, const uint64_t counter, const adc_result_t *read_data) {
+    if (output_binary()) {
+        output_binary_harm(timestamp, counter, read_data);
+        return;
+    }
+    OUTPUT_BEGIN("HARM", timestamp, counter);
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        char harmonics_str[MAX_STR_SIZE];
+        OUTPUT_PRINT(" %s", harmonics2str(&read_data[d].voltage_harmonics, harmonics_str, sizeof(harmonics_str)));
+        OUTPUT_PRINT(";%s", harmonics2str(&read_data[d].current_harmonics, harmonics_str, sizeof(harmonics_str)));
+    }
     OUTPUT_END();
 }
 
 static void output_display_diag(const int64_t timestamp, const uint64_t counter, const adc_system_t *read_adcs) {
+    if (output_binary()) {
+        output_binary_diag(timestamp, counter, read_adcs);
+        return;
+    }
     OUTPUT_BEGIN("DIAG", timestamp, counter);
     for (int d = 0, c = 0, v = NUM_DEVICES; d < NUM_DEVICES; d++, c++, v++) {
         char faults_str[MAX_STR_SIZE];
-        OUTPUT_PRINT(" %lu,%.0f,%s", read_adcs->sample_count[v], read_adcs->zero_offset[v], faults2str(read_adcs->fault_count[v], NUM_FAULTS, faults_str, sizeof(faults_str)));
-        OUTPUT_PRINT(";%lu,%.0f,%s", read_adcs->sample_count[c], read_adcs->zero_offset[c], faults2str(read_adcs->fault_count[c], NUM_FAULTS, faults_str, sizeof(faults_str)));
+        OUTPUT_PRINT(" %lu,%.1f,%+.1f,%.1f,%s", read_adcs->samples[v], read_adcs->zero_offset[v], read_adcs->zero_offset_delta[v], read_adcs->noise[v],
+                     faults2str(read_adcs->fault_count[v], NUM_FAULTS, faults_str, sizeof(faults_str)));
+        OUTPUT_PRINT(";%lu,%.1f,%+.1f,%.1f,%s", read_adcs->samples[c], read_adcs->zero_offset[c], read_adcs->zero_offset_delta[c], read_adcs->noise[c],
+                     faults2str(read_adcs->fault_count[c], NUM_FAULTS, faults_str, sizeof(faults_str)));
+    }
+    OUTPUT_PRINT(" cycles=%lu/%lu windows=%lu/%lu overflows=%lu", read_adcs->cycle_count, read_adcs->cycle_dropped, read_adcs->windows, read_adcs->windows_dropped,
+                 read_adcs->overflows);
+    OUTPUT_PRINT(" recovered=%lu/%lu", read_adcs->recovery.restarts, read_adcs->recovery.reinits);
+    OUTPUT_PRINT(" schedule=%lu/%lu/%lu", read_adcs->schedule.reports > 0 ? (uint32_t)(read_adcs->schedule.jitter_sum / read_adcs->schedule.reports) : 0,
+                 read_adcs->schedule.jitter_max, read_adcs->schedule.late);
+    OUTPUT_PRINT(" output=%lu/%lu/%lu/%lu", output_queue.bytes_queued, output_queue.bytes_sent, output_queue.dropped, output_queue.peak);
+    OUTPUT_END();
+}
+
+#if PERF_INSTRUMENT
+static void output_display_perf(const int64_t timestamp, const uint64_t counter) {
+    perf_histogram_t stages[NUM_PERF_STAGES];
+    for (int s = 0; s < NUM_PERF_STAGES; s++)
+        perf_read((perf_stage_t)s, &stages[s]);
+    float idle[PERF_CORES];
+    perf_idle(idle);
+    if (output_binary()) {
+        output_binary_perf(timestamp, counter, stages, idle);
+        return;
+    }
+    OUTPUT_BEGIN("PERF", timestamp, counter);
+    for (int s = 0; s < NUM_PERF_STAGES; s++) {
+        const perf_histogram_t *histogram = &stages[s];
+        char buckets_str[MAX_STR_SIZE];
+        OUTPUT_PRINT(" %s=%lu,%lu,%lu,%s", stage2str((perf_stage_t)s), histogram->count, perf_mean(histogram), histogram->max,
+                     faults2str(histogram->buckets, PERF_BUCKETS, buckets_str, sizeof(buckets_str)));
     }
+    OUTPUT_PRINT(" idle=");
+    for (int core = 0; core < PERF_CORES; core++)
+        if (idle[core] < 0)
+            OUTPUT_PRINT("%s-", core == 0 ? "" : "/");
+        else
+            OUTPUT_PRINT("%s%.1f", core == 0 ? "" : "/", idle[core]);
+    OUTPUT_PRINT(" stack=");
+    for (int t = 0; t < PERF_TASKS; t++)
+        OUTPUT_PRINT("%s%lu", t == 0 ? "" : "/", perf_stack(perf_tasks[t]));
+    OUTPUT_PRINT(" heap=%lu/%lu", (uint32_t)esp_get_free_heap_size(), (uint32_t)esp_get_minimum_free_heap_size());
     OUTPUT_END();
 }
+#endif
 
 static void output_display_fail(const int64_t timestamp, const uint64_t counter, const char *message, const esp_err_t error) {
+    if (output_binary()) {
+        output_binary_fail(timestamp, counter, message, error);
+        return;
+    }
     OUTPUT_BEGIN("FAIL", timestamp, counter);
     OUTPUT_PRINT(" %s, error %d (%s)", message, error, esp_err_to_name(error));
     OUTPUT_END();
 }
 
+static void output_display_cycl(const adc_cycle_result_t *cycle, const uint32_t dropped) {
+    if (output_binary()) {
+        output_binary_cycl(cycle, dropped);
+        return;
+    }
+    OUTPUT_BEGIN("CYCL", cycle->time, (uint64_t)cycle->cycle);
+    OUTPUT_PRINT(" %lu,%08lx", dropped, cycle->trigger);
+    for (int d = 0; d < NUM_DEVICES; d++)
+        if (STREAM_DEVICES & (1 << d))
+            OUTPUT_PRINT(" %d:%.3f,%.4f", d + 1, cycle->voltage_rms[d], cycle->current_rms[d]);
+    OUTPUT_END();
+}
+
+static void output_display_evnt(const int64_t timestamp, const uint64_t counter, const adc_event_t *event) {
+    if (output_binary()) {
+        output_binary_evnt(timestamp, counter, event);
+        return;
+    }
+    OUTPUT_BEGIN("EVNT", timestamp, counter);
+    OUTPUT_PRINT(" %d:%s,%s,%.4f,%.4f,%s", event->device + 1, event2str(event->type), event->active ? "raise" : "clear", event->before, event->after, fault2str(event->fault));
+    OUTPUT_END();
+}
+
+static void output_display_cmnd(const int64_t timestamp, const char *response) {
+    if (output_binary()) {
+        uint8_t *record = output_binary_begin(PROTOCOL_TYPE_CMND, timestamp, 0);
+        snprintf(((protocol_command_t *)record)->response, PROTOCOL_RESPONSE_SIZE, "%s", response);
+        output_binary_end(record + sizeof(protocol_command_t));
+        return;
+    }
+    OUTPUT_BEGIN("CMND", timestamp, (uint64_t)0);
+    OUTPUT_PRINT(" %s", response);
+    OUTPUT_END();
+}
+
+static void output_display_capt(const int64_t timestamp, const uint32_t number, const adc_capture_t *capture, const uint32_t cycles) {
+    // always framed, as bulk binary, whether text or binary output
+    for (uint32_t offset = 0; offset < capture->count; offset += CAPTURE_CHUNK_SAMPLES) {
+        const uint16_t samples    = (uint16_t)__MIN(capture->count - offset, CAPTURE_CHUNK_SAMPLES);
+        uint8_t *record           = output_binary_begin(PROTOCOL_TYPE_CAPT, timestamp, number);
+        protocol_capture_t *chunk = (protocol_capture_t *)record;
+        chunk->capture            = number;
+        chunk->offset             = offset;
+        chunk->total              = capture->count;
+        chunk->rate               = ADC_SENSOR_RATE_HZ;
+        chunk->sensors            = capture->sensors;
+        chunk->samples            = samples;
+        chunk->cycles             = (uint8_t)cycles;
+        record += sizeof(protocol_capture_t);
+        memcpy(record, &capture->buffer[offset], samples * sizeof(uint16_t));
+        output_binary_end(record + (samples * sizeof(uint16_t)));
+    }
+}
+
 static esp_err_t output_init_usb(void) {
 
     const tusb_desc_device_t config_descriptor_device = {
@@ -532,24 +2549,614 @@ static esp_err_t output_init_usb(void) {
 
     ESP_ERROR_CHECK(esp_tusb_init_console(TINYUSB_CDC_ACM_0));
 
+    // records are written to the host by their own task, so that no other waits on it
+    if (xTaskCreatePinnedToCore(output_task, "output", OUTPUT_TASK_STACK, NULL, OUTPUT_TASK_PRIORITY, &output_queue.task, PROCESS_TASK_CORE) != pdPASS)
+        return ESP_ERR_NO_MEM;
+
     __delay(STARTUP_DELAY_MS);
 
     return ESP_OK;
 }
 
-static void output_term_usb(void) { esp_tusb_deinit_console(TINYUSB_CDC_ACM_0); }
+static void output_term_usb(void) {
+    // records queued are written first, if the host is reading
+    for (int i = 0; i < OUTPUT_RING_SIZE && ring_count(&output_queue.ring) > 0; i++)
+        __delay(OUTPUT_FLUSH_TIMEOUT_MS);
+    esp_tusb_deinit_console(TINYUSB_CDC_ACM_0);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    bool active[NUM_DEVICES][NUM_EVENTS];
+    adc_fault_t voltage_fault[NUM_DEVICES];
+    adc_fault_t current_fault[NUM_DEVICES];
+    float voltage[NUM_DEVICES]; // previous, unfaulted
+    float current[NUM_DEVICES];
+    float current_average[NUM_DEVICES];
+    uint32_t averaged[NUM_DEVICES]; // up to EVENT_CURRENT_AVERAGE
+    uint32_t holdoff[NUM_DEVICES];  // after a step
+} events_t;
+
+static _Atomic uint64_t events_count; // of cycles and windows both, so that events are numbered as one sequence
+
+static void events_output(const int64_t time, const adc_event_t *event) {
+    output_display_evnt(time, atomic_fetch_add_explicit(&events_count, 1, memory_order_relaxed) + 1, event);
+}
+
+static void events_level(events_t *events, const int64_t time, const int device, const adc_event_type_t type, const bool raise, const bool clear, const float before,
+                         const float after) {
+
+    // raised past the limit, cleared only once back past it by the hysteresis, so that a level near the limit does not chatter
+    bool *active = &events->active[device][type];
+    if (*active ? clear : raise) {
+        *active = !*active;
+        events_output(time, &(adc_event_t) { .device = device, .type = type, .active = *active, .fault = FAULT_NONE, .before = before, .after = after });
+    }
+}
+
+static void events_fault(const int64_t time, const int device, const adc_event_type_t type, adc_fault_t *fault_previous, const adc_fault_t fault,
+                         const float before, const float after) {
+
+    // on any change of fault, cleared with the fault that was
+    if (fault != *fault_previous) {
+        const bool active = fault != FAULT_NONE;
+        events_output(time, &(adc_event_t) { .device = device, .type = type, .active = active, .fault = active ? fault : *fault_previous, .before = before, .after = after });
+        *fault_previous = fault;
+    }
+}
+
+static void events_detect(events_t *events, const int64_t time, const int device, const float voltage, const float current, const adc_fault_t voltage_fault,
+                          const adc_fault_t current_fault, const float rating) {
+
+    events_fault(time, device, EVENT_VOLTAGEFAULT, &events->voltage_fault[device], voltage_fault, events->voltage[device], voltage);
+    events_fault(time, device, EVENT_CURRENTFAULT, &events->current_fault[device], current_fault, events->current[device], current);
+
+    if (voltage_fault == FAULT_NONE) {
+        const float nominal = (float)EVENT_VOLTAGE_NOMINAL, hysteresis = nominal * (float)EVENT_VOLTAGE_HYSTERESIS;
+        const float over = nominal * (float)EVENT_VOLTAGE_OVER, under = nominal * (float)EVENT_VOLTAGE_UNDER, loss = nominal * (float)EVENT_VOLTAGE_LOSS;
+        const float before = events->voltage[device];
+        events_level(events, time, device, EVENT_NOVOLTAGE, voltage < loss, voltage > loss + hysteresis, before, voltage);
+        events_level(events, time, device, EVENT_UNDERVOLTAGE, voltage < under && voltage >= loss, voltage > under + hysteresis || voltage < loss, before, voltage);
+        events_level(events, time, device, EVENT_OVERVOLTAGE, voltage > over, voltage < over - hysteresis, before, voltage);
+        events->voltage[device] = voltage;
+    }
+
+    if (current_fault == FAULT_NONE) {
+        const float over = rating * (float)EVENT_CURRENT_OVER, hysteresis = rating * (float)EVENT_CURRENT_HYSTERESIS;
+        events_level(events, time, device, EVENT_OVERCURRENT, current > over, current < over - hysteresis, events->current[device], current);
+        // a step from the average, which then follows for a while without steps, so that e.g. inrush settling to a load is one step
+        float *average = &events->current_average[device];
+        if (events->holdoff[device] > 0) {
+            events->holdoff[device]--;
+            *average = current;
+        } else if (events->averaged[device] >= EVENT_CURRENT_AVERAGE && fabsf(current - *average) > (float)EVENT_CURRENT_STEP) {
+            events_output(time, &(adc_event_t) { .device = device, .type = EVENT_CURRENTSTEP, .active = true, .fault = FAULT_NONE, .before = *average, .after = current });
+            events->holdoff[device] = EVENT_CURRENT_HOLDOFF;
+            *average                = current;
+        } else
+            *average += (current - *average) / (float)__MIN(events->averaged[device] + 1, EVENT_CURRENT_AVERAGE);
+        if (events->averaged[device] < EVENT_CURRENT_AVERAGE)
+            events->averaged[device]++;
+        events->current[device] = current;
+    }
+}
+
+static void events_cycle(events_t *events, const adc_cycle_result_t *cycle) {
+    settings_t in_use; // once per cycle, not per device
+    settings_read(&in_use, NULL);
+    for (int d = 0; d < NUM_DEVICES; d++)
+        if (EVENT_DEVICES & STREAM_DEVICES & (1 << d))
+            events_detect(events, cycle->time, d, cycle->voltage_rms[d], cycle->current_rms[d], cycle->voltage_fault[d], cycle->current_fault[d],
+                          (float)in_use.current_rating[d]);
+}
+
+static void events_window(events_t *events, const int64_t time, const adc_result_t *readings, const bool cycles) {
+    // devices with events detected on each cycle, if streamed, are not detected again on the window
+    const unsigned long devices = cycles ? EVENT_DEVICES & ~STREAM_DEVICES : EVENT_DEVICES;
+    settings_t in_use;
+    settings_read(&in_use, NULL);
+    for (int d = 0; d < NUM_DEVICES; d++)
+        if (devices & (1 << d))
+            events_detect(events, time, d, readings[d].voltage_rms, readings[d].current_rms, readings[d].voltage_fault, readings[d].current_fault,
+                          (float)in_use.current_rating[d]);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    uint32_t version;
+    uint32_t sequence;                 // of checkpoint, alternating between slots
+    double energy_import[NUM_DEVICES]; // Wh
+    double energy_export[NUM_DEVICES]; // Wh
+    double run_hours[NUM_DEVICES];
+} energy_stored_t;
+
+typedef struct {
+    energy_stored_t totals;
+    bool changed;            // since checkpoint
+    int64_t checkpoint_time; // of checkpoint (or load)
+} energy_t;
+
+static void energy_load(energy_t *energy) {
+
+    // newest of the slots: one interrupted while saved (e.g. by power loss) is not intact, so the one before it is loaded
+    nvs_handle_t handle;
+    energy->totals          = (energy_stored_t) { .version = ENERGY_VERSION, .sequence = 0 };
+    energy->changed         = false;
+    energy->checkpoint_time = esp_timer_get_time();
+    if (nvs_open(SETTINGS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return;
+    for (int slot = 0; slot < ENERGY_SLOTS; slot++) {
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        energy_stored_t stored;
+        size_t size = sizeof(energy_stored_t);
+        snprintf(key, sizeof(key), ENERGY_KEY_FORMAT, slot);
+        if (nvs_get_blob(handle, key, &stored, &size) == ESP_OK && size == sizeof(energy_stored_t) && stored.version == ENERGY_VERSION &&
+            stored.sequence >= energy->totals.sequence)
+            energy->totals = stored;
+    }
+    nvs_close(handle);
+}
+
+static esp_err_t energy_save(energy_t *energy) {
+
+    // to the slot after the newest, so the newest stays intact until this one is, and writes are spread over keys (as NVS spreads them over pages)
+    nvs_handle_t handle;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    esp_err_t err = nvs_open(SETTINGS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+        return err;
+    energy->totals.sequence++;
+    snprintf(key, sizeof(key), ENERGY_KEY_FORMAT, (int)(energy->totals.sequence % ENERGY_SLOTS));
+    if ((err = nvs_set_blob(handle, key, &energy->totals, sizeof(energy_stored_t))) == ESP_OK)
+        err = nvs_commit(handle);
+    nvs_close(handle);
+    if (err != ESP_OK)
+        energy->totals.sequence--; // not saved, so the retry is to the same slot, and the newest is not overwritten
+    return err;
+}
+
+static void energy_checkpoint(energy_t *energy, const int64_t time, const bool now) {
+
+    // if changed, at most every checkpoint period for flash wear (a failure is retried next period), so a restart loses at most the period
+    if (!energy->changed || (!now && (time - energy->checkpoint_time) < ((int64_t)ENERGY_CHECKPOINT_MS * US_PER_MS)))
+        return;
+    esp_err_t err;
+    if ((err = energy_save(energy)) == ESP_OK)
+        energy->changed = false;
+    else
+        DEBUG_PRINT("# energy checkpoint failed: error %d (%s)\n", err, esp_err_to_name(err));
+    energy->checkpoint_time = time;
+}
+
+static void energy_window(energy_t *energy, const adc_report_t *report, adc_result_t *readings) {
+
+    // real power over the window's duration: continuous acquisition has every v·i product over whole cycles (a cycle partly in one window completes in the
+    // next, one dropped is carried into the next), so this integrates energy without gaps; windowed acquisition has only the start of each period, so its
+    // power is taken as held for the period, and for those of windows dropped before it
+    for (int d = 0, c = 0; d < NUM_DEVICES; d++, c++) {
+#if ADC_ACQUIRE_CONTINUOUS
+        const double power_hours = (double)report->window.power[d].count / ((double)ADC_SENSOR_RATE_HZ * 3600.0),
+                     run_hours   = (double)report->window.accum[c].count / ((double)ADC_SENSOR_RATE_HZ * 3600.0);
+#else
+        settings_t in_use;
+        settings_read(&in_use, NULL);
+        const double power_hours = ((double)in_use.period_read * (double)report->windows) / (3600.0 * 1000.0), run_hours = power_hours;
+#endif
+        const double energy_wh = (double)readings[d].power_real * power_hours; // 0 if faulted
+        const bool running = readings[d].current_fault == FAULT_NONE && readings[d].current_rms > (float)ENERGY_RUN_CURRENT;
+        if (energy_wh > 0.0)
+            energy->totals.energy_import[d] += energy_wh;
+        else if (energy_wh < 0.0)
+            energy->totals.energy_export[d] -= energy_wh;
+        if (running)
+            energy->totals.run_hours[d] += run_hours;
+        if (energy_wh > 0.0 || energy_wh < 0.0 || running)
+            energy->changed = true;
+        readings[d].energy_import = (float)energy->totals.energy_import[d];
+        readings[d].energy_export = (float)energy->totals.energy_export[d];
+        readings[d].run_hours     = (float)energy->totals.run_hours[d];
+    }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    adc_system_t *adc;
+    events_t events; // detected on each cycle
+    adc_cycle_result_t pretrigger[STREAM_PRETRIGGER_CYCLES];
+    int pretrigger_next;
+    int pretrigger_count;
+    int posttrigger_remaining;
+    uint32_t averaged; // cycles in average, up to STREAM_AVERAGE_CYCLES
+    float voltage_average[NUM_DEVICES];
+    float current_average[NUM_DEVICES];
+} stream_t;
+
+static float stream_rms(const stream_t *stream, const adc_accum_t *accum, const int sensor) {
+    // about the tracked offset, as the mean of a cycle ending on a pattern round is biased by the fraction of a sample it is out
+    const adc_system_t *adc = stream->adc;
+    return adc->zero_offset_windows[sensor] > 0 ? calculate_rms_offset(accum, adc->zero_offset[sensor]) : calculate_rms(accum);
+}
+
+static adc_fault_t stream_fault(const adc_accum_t *accum, const float value, const float value_max) {
+    // as windows, though not counted
+    return accum->count < ADC_SAMPLE_THRESHOLD_MIN ? FAULT_SAMPLES_CNT : calculate_fault(calculate_zero_offset(accum), value, value_max, NULL);
+}
+
+static void stream_calculate(stream_t *stream, const adc_cycle_t *cycle, adc_cycle_result_t *result) {
+
+    settings_scale_t scale;
+    settings_read(NULL, &scale);
+    *result            = (adc_cycle_result_t) { .cycle = cycle->cycle, .time = cycle->time };
+    const float weight = (float)1.0 / (float)__MIN(stream->averaged + 1, STREAM_AVERAGE_CYCLES);
+    const bool armed   = stream->averaged >= STREAM_AVERAGE_CYCLES;
+    for (int d = 0, c = 0, v = NUM_DEVICES; d < NUM_DEVICES; d++, c++, v++) {
+        if (!(STREAM_DEVICES & (1 << d)))
+            continue;
+        const float voltage_rms = result->voltage_rms[d] = convert_adc_to_voltage(calculate_denoise(stream_rms(stream, &cycle->accum[v], v), stream->adc->noise[v]), &scale, d);
+        const float current_rms = result->current_rms[d] = convert_adc_to_current(calculate_denoise(stream_rms(stream, &cycle->accum[c], c), stream->adc->noise[c]), &scale, d);
+        result->voltage_fault[d] = stream_fault(&cycle->accum[v], voltage_rms, (float)MAX_VOLTAGE_V);
+        result->current_fault[d] = stream_fault(&cycle->accum[c], current_rms, (float)MAX_CURRENT_A);
+        if (armed && current_rms > (float)STREAM_TRIGGER_CURRENT_MIN && current_rms > stream->current_average[d] * (float)STREAM_TRIGGER_CURRENT_STEP)
+            result->trigger |= CYCLE_TRIGGER_CURRENT(d);
+        if (armed && voltage_rms < stream->voltage_average[d] * (float)STREAM_TRIGGER_VOLTAGE_SAG)
+            result->trigger |= CYCLE_TRIGGER_VOLTAGE(d);
+        stream->voltage_average[d] += (voltage_rms - stream->voltage_average[d]) * weight;
+        stream->current_average[d] += (current_rms - stream->current_average[d]) * weight;
+    }
+    if (stream->averaged < STREAM_AVERAGE_CYCLES)
+        stream->averaged++;
+}
+
+static void stream_process(stream_t *stream, const adc_cycle_result_t *result) {
+
+    const uint32_t dropped = stream->adc->cycle_dropped;
+    if (STREAM_CYCLES_ALL) {
+        output_display_cycl(result, dropped);
+        return;
+    }
+    // cycles before a trigger are held back, then output with it and those after it
+    if (result->trigger != 0) {
+        for (int i = 0; i < stream->pretrigger_count; i++)
+            output_display_cycl(&stream->pretrigger[(stream->pretrigger_next - stream->pretrigger_count + i + STREAM_PRETRIGGER_CYCLES) % STREAM_PRETRIGGER_CYCLES], dropped);
+        stream->pretrigger_count      = 0;
+        stream->posttrigger_remaining = STREAM_POSTTRIGGER_CYCLES;
+        output_display_cycl(result, dropped);
+    } else if (stream->posttrigger_remaining > 0) {
+        stream->posttrigger_remaining--;
+        output_display_cycl(result, dropped);
+    } else {
+        stream->pretrigger[stream->pretrigger_next] = *result;
+        stream->pretrigger_next                    = (stream->pretrigger_next + 1) % STREAM_PRETRIGGER_CYCLES;
+        if (stream->pretrigger_count < STREAM_PRETRIGGER_CYCLES)
+            stream->pretrigger_count++;
+    }
+}
+
+static void stream_task(void *parameters) {
+
+    static stream_t stream;
+    stream.adc = (adc_system_t *)parameters;
+    while (true) {
+        adc_cycle_t cycle;
+        if (xQueueReceive(stream.adc->cycle_queue, &cycle, portMAX_DELAY) == pdTRUE) {
+            adc_cycle_result_t result;
+            stream_calculate(&stream, &cycle, &result);
+            events_cycle(&stream.events, &result);
+            stream_process(&stream, &result);
+        }
+    }
+}
+
+static esp_err_t stream_init(adc_system_t *adc) {
+
+#if STREAM_CYCLES
+    QueueHandle_t queue = xQueueCreate(STREAM_QUEUE_SIZE, sizeof(adc_cycle_t));
+    if (queue == NULL)
+        return ESP_ERR_NO_MEM;
+    adc->cycle_queue = queue;
+    if (xTaskCreatePinnedToCore(stream_task, "stream", STREAM_TASK_STACK, adc, STREAM_TASK_PRIORITY, NULL, PROCESS_TASK_CORE) != pdPASS)
+        return ESP_ERR_NO_MEM;
+#else
+    (void)adc;
+#endif
+    return ESP_OK;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static QueueHandle_t command_queue  = NULL;
+static volatile bool command_restart = false; // requested, for main to restart by the same path as on failure, with energy checkpointed
+
+static void command_receive(int itf, cdcacm_event_t *event) {
+
+    (void)event;
+    static char line[COMMAND_SIZE];
+    static size_t line_length = 0;
+    uint8_t buffer[COMMAND_SIZE];
+    size_t length = 0;
+    if (tinyusb_cdcacm_read((tinyusb_cdcacm_itf_t)itf, buffer, sizeof(buffer), &length) != ESP_OK)
+        return;
+    for (size_t i = 0; i < length; i++)
+        if (buffer[i] == '\n' || buffer[i] == '\r') {
+            if (line_length > 0) {
+                line[line_length] = '\0';
+                (void)xQueueSend(command_queue, line, 0); // dropped if busy
+                line_length = 0;
+            }
+        } else if (line_length < sizeof(line) - 1)
+            line[line_length++] = (char)buffer[i];
+}
+
+static void command_respond(const char *command, const char *response) {
+    char string[PROTOCOL_RESPONSE_SIZE];
+    snprintf(string, sizeof(string), "%s: %s", command, response);
+    output_display_cmnd(esp_timer_get_time(), string);
+}
+
+static void command_capture(adc_system_t *adc, const char *command, const char *arguments) {
+
+    static uint32_t capture_number = 0;
+    adc_capture_t *capture         = &adc->capture;
+
+    // capture <cycles> <sensor>[,<sensor>...], where sensors are numbered from 0 as in debug output
+    char *end;
+    const long cycles = strtol(arguments, &end, 10);
+    uint32_t sensors  = 0, sensors_count = 0;
+    while (*end == ' ' || *end == ',') {
+        const char *start = end + 1;
+        const long sensor = strtol(start, &end, 10);
+        if (end == start || sensor < 0 || sensor >= NUM_SENSORS) {
+            sensors = 0;
+            break;
+        }
+        if (!(sensors & (1UL << sensor)))
+            sensors_count++;
+        sensors |= 1UL << sensor;
+    }
+    if (cycles < 1 || cycles > UINT8_MAX || sensors == 0 || *end != '\0') {
+        command_respond(command, "error, usage: capture <cycles> <sensor>[,<sensor>...]");
+        return;
+    }
+    if (!ADC_ACQUIRE_CONTINUOUS) {
+        command_respond(command, "error, needs continuous acquisition");
+        return;
+    }
+
+    capture->sensors = sensors;
+    capture->cycles  = (uint32_t)cycles;
+    capture->count   = 0;
+    capture->size    = (CAPTURE_SAMPLES_MAX / sensors_count) * sensors_count;
+    capture->done    = false;
+    capture->armed   = true;
+
+    const int64_t capture_time = esp_timer_get_time();
+    for (int waited = 0; !capture->done && waited < CAPTURE_TIMEOUT_MS; waited += 10)
+        __delay(10);
+    if (!capture->done) {
+        capture->armed = capture->running = false;
+        command_respond(command, "error, timeout (no voltage for cycles?)");
+        return;
+    }
+
+    output_display_capt(capture_time, ++capture_number, capture, (uint32_t)cycles - capture->cycles);
+    char response[PROTOCOL_RESPONSE_SIZE];
+    snprintf(response, sizeof(response), "ok, capture %lu, %lu samples", capture_number, capture->count);
+    command_respond(command, response);
+}
+
+// name or name.device (from 1): returns false if device invalid
+static bool command_setting_name(const char *argument, char *name, const size_t name_size, int *device) {
+    snprintf(name, name_size, "%s", argument);
+    char *separator = strchr(name, '.');
+    *device         = -1;
+    if (separator == NULL)
+        return true;
+    *separator++ = '\0';
+    char *end;
+    const long number = strtol(separator, &end, 10);
+    if (end == separator || *end != '\0' || number < 1 || number > NUM_DEVICES)
+        return false;
+    *device = (int)number - 1;
+    return true;
+}
+
+static void command_get(const char *command, const char *arguments) {
+
+    // get [<name>[.<device>]], all settings if none
+    char response[PROTOCOL_RESPONSE_SIZE], name[COMMAND_SIZE];
+    int device;
+    if (*arguments == '\0') {
+        for (size_t i = 0; i < sizeof(settings_names) / sizeof(settings_names[0]); i++)
+            if (settings_format(&settings, settings_names[i], -1, response, sizeof(response)))
+                command_respond(command, response);
+        return;
+    }
+    if (!command_setting_name(arguments, name, sizeof(name), &device) || !settings_format(&settings, name, device, response, sizeof(response))) {
+        command_respond(command, "error, unknown setting or device");
+        return;
+    }
+    command_respond(command, response);
+}
+
+static void command_settings_apply(const char *command, const settings_t *update, const bool restart) {
+    const char *error = settings_apply(update);
+    char response[PROTOCOL_RESPONSE_SIZE];
+    if (error != NULL)
+        snprintf(response, sizeof(response), "error, %s", error);
+    else
+        snprintf(response, sizeof(response), "ok%s%s", settings_stored ? "" : ", not saved", restart ? ", applies at restart" : "");
+    command_respond(command, response);
+}
+
+static void command_set(const char *command, const char *arguments) {
+
+    // set <name>[.<device>] <value>
+    char argument[COMMAND_SIZE], name[COMMAND_SIZE];
+    int device, value = 0;
+    if (sscanf(arguments, "%63s %n", argument, &value) != 1 || arguments[value] == '\0' || !command_setting_name(argument, name, sizeof(name), &device)) {
+        command_respond(command, "error, usage: set <name>[.<device>] <value>");
+        return;
+    }
+    settings_t update = settings;
+    const char *error = settings_parse(&update, name, device, &arguments[value]);
+    if (error != NULL) {
+        char response[PROTOCOL_RESPONSE_SIZE];
+        snprintf(response, sizeof(response), "error, %s", error);
+        command_respond(command, response);
+        return;
+    }
+    command_settings_apply(command, &update, memcmp(update.pins, settings.pins, sizeof(update.pins)) != 0);
+}
+
+static void command_defaults(const char *command) {
+    settings_t update;
+    settings_defaults(&update);
+    command_settings_apply(command, &update, memcmp(update.pins, settings.pins, sizeof(update.pins)) != 0);
+}
+
+// reference of 0 records the zero point (offset), otherwise gain from the zero point if recorded, else keeping the offset
+static const char *command_calibrate_sensor(calibration_t *calibration, const float raw_adc, const float per_count, const float reference, float *zero) {
+    const float raw = raw_adc * per_count;
+    if (reference <= (float)0.0) {
+        *zero               = raw;
+        calibration->offset = -raw * calibration->gain;
+        return NULL;
+    }
+    if (raw_adc < (float)CALIBRATE_SIGNAL_MIN || raw <= *zero)
+        return "reference signal too small";
+    if (*zero > (float)0.0) {
+        calibration->gain   = reference / (raw - *zero);
+        calibration->offset = -*zero * calibration->gain;
+    } else
+        calibration->gain = (reference - calibration->offset) / raw;
+    return NULL;
+}
+
+static void command_calibrate(adc_system_t *adc, const char *command, const char *arguments) {
+
+    static float calibrate_zero[NUM_SENSORS];
+
+    // calibrate <device> <volts|-> <amps|->, with the reference load connected (or 0 with none, for the zero point first)
+    char voltage_str[COMMAND_SIZE], current_str[COMMAND_SIZE], *end;
+    int device = 0, length = 0;
+    if (sscanf(arguments, "%d %63s %63s%n", &device, voltage_str, current_str, &length) != 3 || arguments[length] != '\0' || device < 1 || device > NUM_DEVICES) {
+        command_respond(command, "error, usage: calibrate <device> <volts|-> <amps|->");
+        return;
+    }
+    const int d = device - 1, c = d, v = d + NUM_DEVICES;
+    const bool voltage = strcmp(voltage_str, "-") != 0, current = strcmp(current_str, "-") != 0;
+    const float voltage_reference = voltage ? strtof(voltage_str, &end) : (float)0.0;
+    if (voltage && (end == voltage_str || *end != '\0' || voltage_reference < (float)0.0)) {
+        command_respond(command, "error, volts not a number");
+        return;
+    }
+    const float current_reference = current ? strtof(current_str, &end) : (float)0.0;
+    if (current && (end == current_str || *end != '\0' || current_reference < (float)0.0)) {
+        command_respond(command, "error, amps not a number");
+        return;
+    }
+
+    // a window wholly after the command, so with the reference applied
+    const uint32_t windows = adc->windows;
+    const int timeout_ms   = (int)settings.period_read * (CALIBRATE_WINDOWS + 1);
+    for (int waited = 0; adc->windows - windows < CALIBRATE_WINDOWS && waited < timeout_ms; waited += 10)
+        __delay(10);
+    if (adc->windows - windows < CALIBRATE_WINDOWS) {
+        command_respond(command, "error, timeout");
+        return;
+    }
+
+    settings_t update = settings;
+    const char *error = NULL;
+    if (voltage)
+        error = command_calibrate_sensor(&update.voltage_calibration[d], adc->rms[v], settings_voltage_per_count(), voltage_reference, &calibrate_zero[v]);
+    if (current && error == NULL)
+        error = command_calibrate_sensor(&update.current_calibration[d], adc->rms[c], settings_current_per_count(update.current_rating[d]), current_reference,
+                                         &calibrate_zero[c]);
+    char response[PROTOCOL_RESPONSE_SIZE];
+    if (error == NULL && (error = settings_apply(&update)) == NULL)
+        snprintf(response, sizeof(response), "ok, %.4f%+.2fV/%.4f%+.3fC%s", settings.voltage_calibration[d].gain, settings.voltage_calibration[d].offset,
+                 settings.current_calibration[d].gain, settings.current_calibration[d].offset, settings_stored ? "" : ", not saved");
+    else
+        snprintf(response, sizeof(response), "error, %s", error);
+    command_respond(command, response);
+}
+
+static void command_process(adc_system_t *adc, const char *command) {
+
+    char name[COMMAND_SIZE];
+    int arguments = 0;
+    if (sscanf(command, "%63s %n", name, &arguments) != 1)
+        return;
+    if (strcmp(name, "capture") == 0)
+        command_capture(adc, command, &command[arguments]);
+    else if (strcmp(name, "get") == 0)
+        command_get(command, &command[arguments]);
+    else if (strcmp(name, "set") == 0)
+        command_set(command, &command[arguments]);
+    else if (strcmp(name, "defaults") == 0)
+        command_defaults(command);
+    else if (strcmp(name, "calibrate") == 0)
+        command_calibrate(adc, command, &command[arguments]);
+    else if (strcmp(name, "restart") == 0) {
+        command_respond(command, "ok");
+        command_restart = true; // main checkpoints energy, and writes out the response, before restarting
+        if (adc->process_task != NULL)
+            xTaskNotifyGive(adc->process_task);
+    } else if (strcmp(name, "debug") == 0 || strcmp(name, "binary") == 0) {
+        const bool enable = strcmp(&command[arguments], "on") == 0;
+        if (!enable && strcmp(&command[arguments], "off") != 0) {
+            command_respond(command, "error, usage: debug|binary on|off");
+            return;
+        }
+        if (strcmp(name, "debug") == 0)
+            __debug_enabled = enable;
+        else
+            __output_binary = enable;
+        command_respond(command, "ok");
+    } else
+        command_respond(command, "error, unknown command");
+}
+
+static void command_task(void *parameters) {
+
+    adc_system_t *adc = (adc_system_t *)parameters;
+    while (true) {
+        char command[COMMAND_SIZE];
+        if (xQueueReceive(command_queue, command, portMAX_DELAY) == pdTRUE)
+            command_process(adc, command);
+    }
+}
+
+static esp_err_t command_init(adc_system_t *adc) {
+
+    if ((command_queue = xQueueCreate(COMMAND_QUEUE_SIZE, COMMAND_SIZE)) == NULL)
+        return ESP_ERR_NO_MEM;
+    if (xTaskCreatePinnedToCore(command_task, "command", COMMAND_TASK_STACK, adc, COMMAND_TASK_PRIORITY, NULL, PROCESS_TASK_CORE) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    return tinyusb_cdcacm_register_callback(TINYUSB_CDC_ACM_0, CDC_EVENT_RX, &command_receive);
+}
 
 // ------------------------------------------------------------------------------------------------------------------------
 
 void app_main(void) {
 
     static adc_system_t read_adcs;
+    static events_t read_events; // detected on each window, for devices without cycles
+    static energy_t read_energy; // totals, checkpointed
     int64_t read_time  = 0;
     uint64_t read_cntr = 0;
     esp_err_t ret;
 
     __app_init();
     __debug_init();
+    __output_init();
+    settings_init();
+    energy_load(&read_energy);
+    readings_linear_init();
 
     ESP_ERROR_CHECK(output_init_usb());
     output_display_init(read_time, read_cntr);
@@ -557,32 +3164,69 @@ void app_main(void) {
         output_display_fail(read_time, read_cntr, "adc failed to initialise", ret);
         return; // will reboot
     }
+    if ((ret = stream_init(&read_adcs)) != ESP_OK) {
+        output_display_fail(read_time, read_cntr, "stream failed to initialise", ret);
+        return; // will reboot
+    }
+    if ((ret = command_init(&read_adcs)) != ESP_OK) {
+        output_display_fail(read_time, read_cntr, "command failed to initialise", ret);
+        return; // will reboot
+    }
+    if ((ret = readings_start(&read_adcs)) != ESP_OK) {
+        output_display_fail(read_time, read_cntr, "adc failed to start", ret);
+        return; // will reboot
+    }
 
+    // processing and output of windows as acquisition completes them
     int64_t diag_time = esp_timer_get_time();
     while (true) {
 
-        const int64_t read_time_current = esp_timer_get_time(), read_time_waiting = (REPORTINGS_PERIOD_MS * US_PER_MS) - (read_time_current - read_time);
-        if (read_time_waiting > 0)
-            __delay(read_time_waiting / US_PER_MS);
-        read_time = esp_timer_get_time();
+        if (command_restart)
+            break; // by command
+        adc_report_t *report = (adc_report_t *)ring_read_begin(&read_adcs.report_ring);
+        if (report == NULL) {
+            if ((ret = read_adcs.acquire_error) != ESP_OK) {
+                output_display_fail(read_time, read_cntr, "adc failed to recover", ret);
+                break; // last resort, restart
+            }
+            (void)ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        PERF_BEGIN(loop_begin);
 
         adc_result_t read_data[NUM_DEVICES];
-        if ((ret = readings_process(&read_adcs, read_data)) != ESP_OK) {
-            output_display_fail(read_time, read_cntr, "adc failed to process", ret);
-            return; // will reboot
-        }
+        PERF_BEGIN(calculate_begin);
+        readings_process(&read_adcs, report, read_data);
+        energy_window(&read_energy, report, read_data);
+        PERF_END(PERF_CALCULATE, calculate_begin);
+        const float read_frequency = report->frequency_measured ? report->frequency : (float)0.0;
+        read_time                  = report->time;
+        ring_read_end(&read_adcs.report_ring);
         if (++read_cntr > 9999999999999999ULL)
             read_cntr = 1;
-        output_display_read(read_time, read_cntr, read_data);
-
-        const int64_t diag_time_current = esp_timer_get_time(), diag_time_waiting = (DIAGNOSTIC_PERIOD_MS * US_PER_MS) - (diag_time_current - diag_time);
+        PERF_BEGIN(output_begin);
+        events_window(&read_events, read_time, read_data, read_adcs.cycle_queue != NULL);
+        output_display_read(read_time, read_cntr, read_data, read_frequency);
+        output_display_harm(read_time, read_cntr, read_data);
+        PERF_END(PERF_OUTPUT, output_begin);
+        energy_checkpoint(&read_energy, esp_timer_get_time(), false);
+
+        settings_t in_use;
+        settings_read(&in_use, NULL);
+        const int64_t diag_time_current = esp_timer_get_time(), diag_time_waiting = ((int64_t)in_use.period_diag * US_PER_MS) - (diag_time_current - diag_time);
         if (diag_time_waiting <= 0) {
             output_display_diag(read_time, read_cntr, &read_adcs);
+#if PERF_INSTRUMENT
+            output_display_perf(read_time, read_cntr);
+#endif
             diag_time = diag_time_current;
         }
+        PERF_END(PERF_LOOP, loop_begin);
     }
 
-    readings_term(&read_adcs);
+    if ((ret = readings_term(&read_adcs)) != ESP_OK)
+        output_display_fail(read_time, read_cntr, "adc failed to stop", ret); // left running, as restarting stops it
+    energy_checkpoint(&read_energy, esp_timer_get_time(), true);
     output_display_term(esp_timer_get_time(), read_cntr);
     output_term_usb();
     esp_restart();
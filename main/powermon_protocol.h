@@ -0,0 +1,311 @@
+/*
+ * ESP32-S3 AC Power Monitor - binary output protocol, shared between the firmware and the client
+ *
+ * Each record is framed as 0x00, COBS(record, CRC), 0x00 so that frames can be interleaved with text lines (which never
+ * contain 0x00) and resynchronised after loss. A record is a protocol_header_t followed by the body for its type, all
+ * fields packed and little-endian. The CRC is CRC-16/CCITT-FALSE over the record, appended little-endian.
+ */
+
+#ifndef POWERMON_PROTOCOL_H
+#define POWERMON_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "protocol records are little-endian structs"
+#endif
+
+#define PROTOCOL_VERSION       13
+#define PROTOCOL_DELIMITER     0x00
+#define PROTOCOL_RECORD_MAX    1024                                                        // header, body and CRC
+#define PROTOCOL_FRAME_MAX     (2 + PROTOCOL_RECORD_MAX + (PROTOCOL_RECORD_MAX / 254) + 1) // delimiters and COBS overhead
+#define PROTOCOL_CRC_SIZE      sizeof(uint16_t)
+#define PROTOCOL_DEVICES_MAX   16
+#define PROTOCOL_FAULTS_NUM    6                                                           // as firmware fault codes, 0 is OK
+#define PROTOCOL_EVENTS_NUM    7                                                           // as firmware event codes
+#define PROTOCOL_HARMONICS_TOP 3
+#define PROTOCOL_PERF_STAGES   4                                                           // extract, calculate, output, loop
+#define PROTOCOL_PERF_BUCKETS  8                                                           // bucket n below 4^(n+1)us, the last all above
+#define PROTOCOL_PERF_CORES    2
+#define PROTOCOL_PERF_TASKS    5                                                           // acquire, main, output, stream, command
+#define PROTOCOL_STRING_SIZE   20
+#define PROTOCOL_MESSAGE_SIZE  64
+#define PROTOCOL_RESPONSE_SIZE 128
+
+typedef enum {
+    PROTOCOL_TYPE_INIT = 1,
+    PROTOCOL_TYPE_TERM,
+    PROTOCOL_TYPE_READ,
+    PROTOCOL_TYPE_HARM,
+    PROTOCOL_TYPE_DIAG,
+    PROTOCOL_TYPE_FAIL,
+    PROTOCOL_TYPE_CYCL,
+    PROTOCOL_TYPE_CMND,
+    PROTOCOL_TYPE_CAPT,
+    PROTOCOL_TYPE_EVNT,
+    PROTOCOL_TYPE_PERF,
+} protocol_type_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type; // protocol_type_t
+    uint8_t version;
+    uint16_t length; // of body
+    int64_t timestamp;
+    uint64_t counter;
+} protocol_header_t;
+
+// INIT: protocol_init_t, then devices x protocol_calibration_t (settings of each device)
+
+#define PROTOCOL_INIT_DEBUG      0x01
+#define PROTOCOL_INIT_CONTINUOUS 0x02
+#define PROTOCOL_INIT_GOERTZEL   0x04
+#define PROTOCOL_INIT_STREAM     0x08
+#define PROTOCOL_INIT_STREAM_ALL 0x10
+#define PROTOCOL_INIT_SETTINGS   0x20 // stored, else defaults
+#define PROTOCOL_INIT_LINEAR     0x40 // ADC corrected by eFuse calibration, else ideal
+
+typedef struct __attribute__((packed)) {
+    char type[PROTOCOL_STRING_SIZE];
+    char version[PROTOCOL_STRING_SIZE];
+    char platform[PROTOCOL_STRING_SIZE];
+    char serial[PROTOCOL_STRING_SIZE];
+    char sensor_voltage[PROTOCOL_STRING_SIZE];
+    char sensor_current[PROTOCOL_STRING_SIZE];
+    float voltage_max;
+    float current_max;
+    uint32_t period_read;
+    uint32_t period_diag;
+    uint32_t adc_rate;
+    uint16_t adc_frame_size;
+    uint16_t adc_pool_size;
+    uint8_t adc_bits;
+    uint8_t harmonics;
+    uint8_t flags;
+    uint8_t devices;
+} protocol_init_t;
+
+typedef struct __attribute__((packed)) {
+    float voltage_gain;
+    float voltage_offset;
+    float current_gain;
+    float current_offset;
+    uint8_t current_rating; // ACS712 variant, A
+    uint8_t current_pin;    // GPIO
+    uint8_t voltage_pin;
+} protocol_calibration_t;
+
+// READ: protocol_read_t, then devices x protocol_read_device_t (values other than energy are not meaningful if faulted), of those present in order
+
+typedef struct __attribute__((packed)) {
+    float frequency;  // 0 if not measured
+    uint16_t present; // bit per device: others unchanged since last present (report by exception)
+    uint8_t devices;
+} protocol_read_t;
+
+typedef struct __attribute__((packed)) {
+    float voltage;
+    float current;
+    float phase;
+    float power_real;
+    float power_apparent;
+    float power_factor;
+    uint8_t voltage_fault;
+    uint8_t current_fault;
+    float energy_import; // Wh, totals, meaningful even if faulted
+    float energy_export; // Wh
+    float run_hours;
+} protocol_read_device_t;
+
+// HARM: protocol_harm_t, then devices x (voltage, current) protocol_harmonics_t
+
+typedef struct __attribute__((packed)) {
+    uint8_t devices;
+} protocol_harm_t;
+
+typedef struct __attribute__((packed)) {
+    float thd;
+    uint8_t order[PROTOCOL_HARMONICS_TOP]; // 0 if none
+    float percent[PROTOCOL_HARMONICS_TOP];
+} protocol_harmonics_t;
+
+// DIAG: protocol_diag_t, then devices x (voltage, current) protocol_diag_sensor_t
+
+typedef struct __attribute__((packed)) {
+    uint8_t devices;
+    uint32_t cycles; // per-cycle records queued for streaming
+    uint32_t cycles_dropped;
+    uint32_t windows; // processed
+    uint32_t windows_dropped;
+    uint32_t adc_overflows;   // frames lost
+    uint32_t adc_restarts;    // recoveries by restarting the driver
+    uint32_t adc_reinits;     // recoveries by recreating the driver
+    uint32_t schedule_jitter; // us, mean of windows after their time on the reporting grid
+    uint32_t schedule_max;    // us
+    uint32_t schedule_late;   // windows
+    uint32_t output_queued;   // bytes
+    uint32_t output_sent;     // bytes
+    uint32_t output_dropped;  // records
+    uint32_t output_peak;     // records queued, most
+} protocol_diag_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t samples;
+    float offset;       // tracked, ADC counts
+    float offset_delta; // of last window mean from offset: near 0 once converged
+    float noise;        // RMS, ADC counts
+    uint32_t faults[PROTOCOL_FAULTS_NUM];
+} protocol_diag_sensor_t;
+
+// FAIL: protocol_fail_t
+
+typedef struct __attribute__((packed)) {
+    int32_t error;
+    char error_name[PROTOCOL_STRING_SIZE * 2];
+    char message[PROTOCOL_MESSAGE_SIZE];
+} protocol_fail_t;
+
+// CYCL: protocol_cycle_t, then devices x protocol_cycle_device_t; the header counter is the cycle number
+
+typedef struct __attribute__((packed)) {
+    uint32_t dropped; // cycles dropped so far
+    uint32_t trigger; // bit per device: current step (from bit 0), voltage sag (from bit 16)
+    uint8_t devices;
+} protocol_cycle_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t device; // from 0
+    float voltage;
+    float current;
+} protocol_cycle_device_t;
+
+// CMND: protocol_command_t, the response to a command from the host
+
+typedef struct __attribute__((packed)) {
+    char response[PROTOCOL_RESPONSE_SIZE];
+} protocol_command_t;
+
+// CAPT: protocol_capture_t, then samples x uint16_t raw ADC values, interleaved in sensor order; sent as frames in text output also
+
+typedef struct __attribute__((packed)) {
+    uint32_t capture; // number, from 1
+    uint32_t offset;  // of first sample in this chunk
+    uint32_t total;   // samples in capture
+    uint32_t rate;    // per sensor, Hz
+    uint32_t sensors; // bit mask
+    uint16_t samples; // in this chunk
+    uint8_t cycles;
+} protocol_capture_t;
+
+// EVNT: protocol_event_t, as soon as detected; the header counter is the event number
+
+typedef struct __attribute__((packed)) {
+    uint8_t device; // from 0
+    uint8_t event;  // as firmware event codes
+    uint8_t active; // raised (1) or cleared (0)
+    uint8_t fault;  // of fault events, as firmware fault codes
+    float before;   // V or A
+    float after;
+} protocol_event_t;
+
+// PERF: protocol_perf_t, with DIAG if instrumented; stage counts are since boot
+
+typedef struct __attribute__((packed)) {
+    uint32_t count;
+    uint32_t mean; // us
+    uint32_t max;  // us
+    uint32_t buckets[PROTOCOL_PERF_BUCKETS];
+} protocol_perf_stage_t;
+
+typedef struct __attribute__((packed)) {
+    protocol_perf_stage_t stages[PROTOCOL_PERF_STAGES];
+    float idle[PROTOCOL_PERF_CORES];     // percent, since last PERF (-1 if not measured)
+    uint32_t stack[PROTOCOL_PERF_TASKS]; // bytes never used, at least (0 if no task)
+    uint32_t heap_free;                  // bytes
+    uint32_t heap_min;                   // bytes free, least
+} protocol_perf_t;
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static inline uint16_t protocol_crc16(const uint8_t *data, const size_t length) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)(data[i] << 8);
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
+
+static inline size_t protocol_cobs_encode(const uint8_t *source, const size_t length, uint8_t *destination) {
+    size_t read = 0, write = 1, code_index = 0;
+    uint8_t code = 1;
+    while (read < length) {
+        if (source[read] == 0) {
+            destination[code_index] = code;
+            code                     = 1;
+            code_index               = write++;
+            read++;
+        } else {
+            destination[write++] = source[read++];
+            if (++code == 0xFF) {
+                destination[code_index] = code;
+                code                     = 1;
+                code_index               = write++;
+            }
+        }
+    }
+    destination[code_index] = code;
+    return write;
+}
+
+static inline size_t protocol_cobs_decode(const uint8_t *source, const size_t length, uint8_t *destination, const size_t destination_size) {
+    size_t read = 0, write = 0;
+    while (read < length) {
+        const uint8_t code = source[read++];
+        if (code == 0)
+            return 0;
+        for (uint8_t i = 1; i < code; i++) {
+            if (read >= length || write >= destination_size || source[read] == 0)
+                return 0;
+            destination[write++] = source[read++];
+        }
+        if (code < 0xFF && read < length) {
+            if (write >= destination_size)
+                return 0;
+            destination[write++] = 0;
+        }
+    }
+    return write;
+}
+
+// record (header, body) into frame, with space for CRC after the body in the record: returns frame size
+static inline size_t protocol_frame_encode(uint8_t *record, const size_t length, uint8_t *frame) {
+    const uint16_t crc   = protocol_crc16(record, length);
+    record[length]       = (uint8_t)(crc & 0xFF);
+    record[length + 1]   = (uint8_t)(crc >> 8);
+    frame[0]             = PROTOCOL_DELIMITER;
+    const size_t encoded = protocol_cobs_encode(record, length + PROTOCOL_CRC_SIZE, &frame[1]);
+    frame[1 + encoded]   = PROTOCOL_DELIMITER;
+    return 1 + encoded + 1;
+}
+
+// frame content (between delimiters) into record, checking CRC, version and length: returns record size (without CRC), or 0 if invalid
+static inline size_t protocol_frame_decode(const uint8_t *frame, const size_t length, uint8_t *record, const size_t record_size) {
+    const size_t decoded = protocol_cobs_decode(frame, length, record, record_size);
+    if (decoded < sizeof(protocol_header_t) + PROTOCOL_CRC_SIZE)
+        return 0;
+    const size_t size = decoded - PROTOCOL_CRC_SIZE;
+    if (protocol_crc16(record, size) != (uint16_t)(record[size] | (record[size + 1] << 8)))
+        return 0;
+    const protocol_header_t *header = (const protocol_header_t *)record;
+    if (header->version != PROTOCOL_VERSION || sizeof(protocol_header_t) + header->length != size)
+        return 0;
+    return size;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#endif // POWERMON_PROTOCOL_H
@@ -0,0 +1,105 @@
+/*
+ * ESP32-S3 AC Power Monitor - lock-free single-producer single-consumer ring, for passing records between cores
+ *
+ * Records are fixed size and written and read in place: the producer fills the slot from ring_write_begin() and publishes
+ * it with ring_write_end(), the consumer uses the slot from ring_read_begin() and releases it with ring_read_end(). Each
+ * index is written by one side only, with release/acquire ordering so that a slot's contents are visible before its index.
+ * Nothing blocks: the producer sees the ring full, and the consumer sees it empty, and each decides what to do (e.g. drop,
+ * or wait for a notification). Portable C11, with no platform dependencies.
+ *
+ * Also a sequence count, for data changed in place by one writer and copied whole by readers on other tasks or cores.
+ */
+
+#ifndef POWERMON_RING_H
+#define POWERMON_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define RING_CACHE_LINE 64 // indices on separate lines, so each side's writes do not contend with the other's
+
+typedef struct {
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t head; // free running count of writes, by producer
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t tail; // free running count of reads, by consumer
+    _Alignas(RING_CACHE_LINE) uint8_t *slots;
+    size_t size;       // of record
+    uint32_t capacity; // records, power of two
+} ring_t;
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+// storage is capacity x size bytes, capacity a power of two: returns false if not
+static inline bool ring_init(ring_t *ring, void *storage, const size_t size, const uint32_t capacity) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+        return false;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->slots    = (uint8_t *)storage;
+    ring->size     = size;
+    ring->capacity = capacity;
+    return true;
+}
+
+static inline uint32_t ring_count(ring_t *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+// producer: slot to fill, or NULL if full
+static inline void *ring_write_begin(ring_t *ring) {
+    const uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed), tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == ring->capacity)
+        return NULL;
+    return &ring->slots[(size_t)(head & (ring->capacity - 1)) * ring->size];
+}
+
+// producer: publish the slot filled
+static inline void ring_write_end(ring_t *ring) {
+    atomic_store_explicit(&ring->head, atomic_load_explicit(&ring->head, memory_order_relaxed) + 1, memory_order_release);
+}
+
+// consumer: slot to use, or NULL if empty
+static inline void *ring_read_begin(ring_t *ring) {
+    const uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed), head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail)
+        return NULL;
+    return &ring->slots[(size_t)(tail & (ring->capacity - 1)) * ring->size];
+}
+
+// consumer: release the slot used
+static inline void ring_read_end(ring_t *ring) {
+    atomic_store_explicit(&ring->tail, atomic_load_explicit(&ring->tail, memory_order_relaxed) + 1, memory_order_release);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+// odd while the writer is changing the data: a reader copies the data between seqcount_read_begin() and seqcount_read_retry(),
+// and copies again if the count was odd or has moved on, as the copy may then be partly old and partly new
+typedef _Atomic uint32_t seqcount_t;
+
+// writer: before changing the data
+static inline void seqcount_write_begin(seqcount_t *sequence) {
+    atomic_store_explicit(sequence, atomic_load_explicit(sequence, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+// writer: after changing the data
+static inline void seqcount_write_end(seqcount_t *sequence) {
+    atomic_store_explicit(sequence, atomic_load_explicit(sequence, memory_order_relaxed) + 1, memory_order_release);
+}
+
+// reader: before copying the data
+static inline uint32_t seqcount_read_begin(seqcount_t *sequence) { return atomic_load_explicit(sequence, memory_order_acquire); }
+
+// reader: after copying the data, true if the copy is not consistent and is to be made again
+static inline bool seqcount_read_retry(seqcount_t *sequence, const uint32_t begin) {
+    atomic_thread_fence(memory_order_acquire);
+    return (begin & 1) != 0 || atomic_load_explicit(sequence, memory_order_relaxed) != begin;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#endif // POWERMON_RING_H
@@ -0,0 +1,147 @@
+/*
+ * ESP32-S3 AC Power Monitor - benchmark: readings_extract, ns per sample on the host, over frames recorded from the ADC
+ * (raw TYPE2 results as read from the driver, e.g. by a debug build) or else synthesised, and the linear lookup build
+ *
+ * usage: bench_extract [frames.bin]
+ */
+
+#include "host.h"
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_SECONDS   2.0 // of samples, each pass
+#define BENCH_DURATION  1.0 // s, at least, of measurement
+#define BENCH_FREQUENCY 50.0
+
+static double bench_source(void *context, const int sensor, const double time) {
+    (void)context;
+    const double amplitude = sensor < NUM_DEVICES ? 600.0 : 1500.0, phase = sensor < NUM_DEVICES ? 0.5 : 0.0;
+    return 1800.0 + (amplitude * sin((2.0 * M_PI * BENCH_FREQUENCY * time) - phase)) + (2.0 * host_gaussian());
+}
+
+// frames as TYPE2 words, as host_frames would feed them
+static uint32_t *bench_synthesise(const double seconds, size_t *results) {
+    const uint64_t rounds = host_rounds_for(seconds);
+    uint32_t *words       = (uint32_t *)malloc(rounds * NUM_SENSORS * sizeof(uint32_t));
+    size_t count          = 0;
+    for (uint64_t round = 0; round < rounds; round++)
+        for (int sensor = 0; sensor < NUM_SENSORS; sensor++)
+            words[count++] = host_sample(bench_source(NULL, sensor, host_round_time(round, sensor))) |
+                             ((uint32_t)ADC_SOURCE(ADC_SENSOR_UNIT(sensor), adc_sensor_to_channel[sensor]) << 12);
+    *results = count;
+    return words;
+}
+
+static uint32_t *bench_load(const char *path, size_t *results) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+    (void)fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    (void)fseek(file, 0, SEEK_SET);
+    uint32_t *words = size >= (long)sizeof(uint32_t) ? (uint32_t *)malloc((size_t)size) : NULL;
+    *results        = words != NULL ? fread(words, sizeof(uint32_t), (size_t)size / sizeof(uint32_t), file) : 0;
+    fclose(file);
+    return words;
+}
+
+// in frames of the driver's size, repeated until long enough to time: returns ns per result
+static double bench_extract(adc_system_t *adc, const uint32_t *words, const size_t results) {
+    uint64_t extracted = 0;
+    int passes         = 0;
+    const double begin = host_now();
+    double end;
+    do {
+        for (size_t offset = 0; offset < results; offset += ADC_SAMPLE_SIZE) {
+            const size_t length = __MIN((size_t)ADC_SAMPLE_SIZE, results - offset);
+            readings_extract((const uint8_t *)&words[offset], (uint32_t)(length * ADC_RESULT_BYTES), adc);
+            extracted += length;
+        }
+        passes++;
+        if ((passes % 8) == 0) { // windows end as on the device, so that accumulators and cycles do not grow without bound
+            adc_result_t readings[NUM_DEVICES];
+            (void)host_window(adc, readings);
+        }
+        end = host_now();
+    } while (end - begin < BENCH_DURATION);
+    return ((end - begin) * 1e9) / (double)extracted;
+}
+
+// decode alone, to a per-sensor sum: by the lookups of readings_extract, or by the linear scan of channels that they replaced
+static volatile int64_t bench_sink;
+
+static double bench_decode(const uint32_t *words, const size_t results, const bool scan) {
+    int64_t sums[NUM_SENSORS] = { 0 };
+    uint64_t decoded          = 0;
+    const double begin        = host_now();
+    double end;
+    do {
+        for (size_t i = 0; i < results; i++) {
+            const uint32_t result = words[i];
+            int sensor            = -1;
+            if (scan) {
+                for (int s = 0; s < NUM_SENSORS && sensor < 0; s++)
+                    if (ADC_SOURCE(ADC_SENSOR_UNIT(s), adc_sensor_to_channel[s]) == ADC_RESULT_SOURCE(result))
+                        sensor = s;
+            } else
+                sensor = adc_channel_to_sensor[ADC_RESULT_SOURCE(result)];
+            if (sensor >= 0)
+                sums[sensor] += adc_sensor_to_linear[sensor][ADC_RESULT_DATA(result)];
+        }
+        decoded += results;
+        end = host_now();
+    } while (end - begin < BENCH_DURATION);
+    for (int s = 0; s < NUM_SENSORS; s++)
+        bench_sink += sums[s];
+    return ((end - begin) * 1e9) / (double)decoded;
+}
+
+static double bench_linear(const bool calibrated) {
+    static uint16_t linear[ADC_MAX_VALUE + 1];
+    host_cali          = calibrated;
+    int builds         = 0;
+    const double begin = host_now();
+    double end;
+    do {
+        (void)readings_linear_unit(ADC_UNIT_1, linear);
+        builds++;
+        end = host_now();
+    } while (end - begin < BENCH_DURATION);
+    host_cali = false;
+    return ((end - begin) * 1e6) / (double)builds;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+
+    static adc_system_t adc;
+    host_init(&adc);
+
+    // a window first, so that crossing levels and the frequency tracker are fed back as in steady state
+    host_frames(&adc, host_rounds_for(1.0), bench_source, NULL);
+    adc_result_t readings[NUM_DEVICES];
+    (void)host_window(&adc, readings);
+    host_frames(&adc, host_rounds_for(1.0), bench_source, NULL);
+    (void)host_window(&adc, readings);
+
+    size_t results  = 0;
+    uint32_t *words = argc > 1 ? bench_load(argv[1], &results) : bench_synthesise(BENCH_SECONDS, &results);
+    if (words == NULL || results == 0) {
+        fprintf(stderr, "bench_extract: no frames%s%s\n", argc > 1 ? " in " : "", argc > 1 ? argv[1] : "");
+        return EXIT_FAILURE;
+    }
+
+    const double ns_per_result = bench_extract(&adc, words, results);
+    const double load          = (ns_per_result * ADC_SAMPLE_RATE_HZ) / 1e7; // percent of one core at the sample rate
+    printf("bench_extract: %s, %zu results, %d sensors, %d harmonics, goertzel phase %d\n", argc > 1 ? argv[1] : "synthesised", results, NUM_SENSORS, HARMONICS_NUM,
+           PHASE_GOERTZEL);
+    printf("  readings_extract: %.1f ns/sample, %.1f us/frame (%d samples), %.2f%% of a host core at %d Hz\n", ns_per_result, (ns_per_result * ADC_SAMPLE_SIZE) / 1000.0,
+           ADC_SAMPLE_SIZE, load, ADC_SAMPLE_RATE_HZ);
+    printf("  decode only: %.2f ns/sample by lookup, %.2f ns/sample by scan of channels\n", bench_decode(words, results, false), bench_decode(words, results, true));
+    printf("  readings_linear_unit: %.1f us (ideal), %.1f us (calibrated, per unit at boot)\n", bench_linear(false), bench_linear(true));
+
+    free(words);
+    readings_term(&adc);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+/*
+ * ESP32-S3 AC Power Monitor - benchmark: cost of the Goertzel bank against harmonic count, as ns per sample of readings_extract
+ * on the host (built as bench_harmonics_<n> with HARMONICS_NUM n, see the Makefile, which fits the cost per harmonic over them)
+ */
+
+#include "host.h"
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_SECONDS   2.0  // of samples, each pass
+#define BENCH_DURATION  0.25 // s, at least, of each measurement
+#define BENCH_REPEATS   5    // measurements, of which the fastest is taken
+#define BENCH_FREQUENCY 50.0
+
+// distorted, so that every harmonic in the bank has a signal to track (no effect on cost, but as on the device)
+static double bench_source(void *context, const int sensor, const double time) {
+    (void)context;
+    const double angle = (2.0 * M_PI * BENCH_FREQUENCY * time) - (sensor < NUM_DEVICES ? 0.5 : 0.0), amplitude = sensor < NUM_DEVICES ? 600.0 : 400.0;
+    return 1800.0 + (amplitude * (sin(angle) + (0.2 * sin(3.0 * angle)) + (0.1 * sin(5.0 * angle)))) + (2.0 * host_gaussian());
+}
+
+static double bench_extract(adc_system_t *adc, const uint32_t *words, const size_t results) {
+    uint64_t extracted = 0;
+    int passes         = 0;
+    const double begin = host_now();
+    double end;
+    do {
+        for (size_t offset = 0; offset < results; offset += ADC_SAMPLE_SIZE) {
+            const size_t length = __MIN((size_t)ADC_SAMPLE_SIZE, results - offset);
+            readings_extract((const uint8_t *)&words[offset], (uint32_t)(length * ADC_RESULT_BYTES), adc);
+            extracted += length;
+        }
+        if ((++passes % 2) == 0) {
+            adc_result_t readings[NUM_DEVICES];
+            (void)host_window(adc, readings);
+        }
+        end = host_now();
+    } while (end - begin < BENCH_DURATION);
+    return ((end - begin) * 1e9) / (double)extracted;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+
+    static adc_system_t adc;
+    host_init(&adc);
+
+    // a window first, so that crossing levels are fed back as in steady state
+    host_frames(&adc, host_rounds_for(1.0), bench_source, NULL);
+    adc_result_t readings[NUM_DEVICES];
+    (void)host_window(&adc, readings);
+
+    const uint64_t rounds = host_rounds_for(BENCH_SECONDS);
+    uint32_t *words       = (uint32_t *)malloc(rounds * NUM_SENSORS * sizeof(uint32_t));
+    size_t results        = 0;
+    for (uint64_t round = 0; round < rounds; round++)
+        for (int sensor = 0; sensor < NUM_SENSORS; sensor++)
+            words[results++] = host_sample(bench_source(NULL, sensor, host_round_time(round, sensor))) |
+                               ((uint32_t)ADC_SOURCE(ADC_SENSOR_UNIT(sensor), adc_sensor_to_channel[sensor]) << 12);
+
+    double fastest = INFINITY;
+    for (int r = 0; r < BENCH_REPEATS; r++)
+        fastest = fmin(fastest, bench_extract(&adc, words, results));
+    printf("bench_harmonics: %2d harmonics, readings_extract %.2f ns/sample\n", HARMONICS_NUM, fastest);
+
+    free(words);
+    readings_term(&adc);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,464 @@
+/*
+ * ESP32-S3 AC Power Monitor - host harness: the firmware compiled on Linux against shims of ESP-IDF (tests/stubs), so that
+ * acquisition and processing can be driven with synthetic frames and checked against double precision references
+ *
+ * The shims are single threaded: tasks are not run, the ADC driver delivers no frames of its own (frames are fed to
+ * readings_extract, see host_frames), time is host_time, and NVS is a store of keyed blobs in memory.
+ */
+
+#ifndef POWERMON_HOST_H
+#define POWERMON_HOST_H
+
+#define app_main powermon_app_main
+#include "powermon.c"
+#undef app_main
+
+#include <stdarg.h>
+#include <time.h>
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define HOST_TASKS_MAX   8
+#define HOST_NVS_KEYS    8
+#define HOST_NVS_BLOB    4096
+#define HOST_RATE_SENSOR ((double)ADC_SAMPLE_RATE_HZ / (double)NUM_SENSORS)
+
+static int64_t host_time = 1;     // us, as esp_timer_get_time
+static bool host_cali    = false; // eFuse calibration present (a curve slightly bowed from ideal), else none
+static int host_adc;              // of which the address is the driver handle, as not NULL
+static char host_tasks[HOST_TASKS_MAX];
+static int host_tasks_created;
+
+typedef struct {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint8_t data[HOST_NVS_BLOB];
+    size_t size; // 0 = absent
+} host_nvs_key_t;
+
+static host_nvs_key_t host_nvs[HOST_NVS_KEYS];
+static uint32_t host_nvs_sets;
+static bool host_nvs_fail;        // all calls fail, as without NVS
+static bool host_nvs_fail_writes; // writes fail though opening succeeds, as with NVS full
+
+typedef struct QueueDefinition {
+    UBaseType_t length, size, head, count;
+    uint8_t data[];
+} host_queue_t;
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+int64_t esp_timer_get_time(void) { return host_time; }
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle) {
+    *handle = (esp_timer_handle_t)(uintptr_t)args;
+    return ESP_OK;
+}
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    (void)timer;
+    (void)period;
+    return ESP_OK;
+}
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    (void)timer;
+    return ESP_OK;
+}
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    (void)timer;
+    return ESP_OK;
+}
+
+uint32_t esp_cpu_get_cycle_count(void) {
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(((uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec) * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ / 1000ULL);
+}
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type) {
+    (void)type;
+    memset(mac, 0, 6);
+    return ESP_OK;
+}
+void esp_restart(void) {}
+uint32_t esp_get_free_heap_size(void) { return 0; }
+uint32_t esp_get_minimum_free_heap_size(void) { return 0; }
+
+esp_err_t gpio_input_enable(gpio_num_t gpio) {
+    (void)gpio;
+    return ESP_OK;
+}
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio, gpio_pull_mode_t pull) {
+    (void)gpio;
+    (void)pull;
+    return ESP_OK;
+}
+int gpio_get_level(gpio_num_t gpio) {
+    (void)gpio;
+    return 1; // pulled up: not debug
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+esp_err_t adc_continuous_new_handle(const adc_continuous_handle_cfg_t *config, adc_continuous_handle_t *handle) {
+    (void)config;
+    *handle = (adc_continuous_handle_t)(void *)&host_adc;
+    return ESP_OK;
+}
+esp_err_t adc_continuous_config(adc_continuous_handle_t handle, const adc_continuous_config_t *config) {
+    (void)handle;
+    (void)config;
+    return ESP_OK;
+}
+esp_err_t adc_continuous_register_event_callbacks(adc_continuous_handle_t handle, const adc_continuous_evt_cbs_t *callbacks, void *context) {
+    (void)handle;
+    (void)callbacks;
+    (void)context;
+    return ESP_OK;
+}
+esp_err_t adc_continuous_start(adc_continuous_handle_t handle) {
+    (void)handle;
+    return ESP_OK;
+}
+esp_err_t adc_continuous_stop(adc_continuous_handle_t handle) {
+    (void)handle;
+    return ESP_OK;
+}
+esp_err_t adc_continuous_read(adc_continuous_handle_t handle, uint8_t *buffer, uint32_t length, uint32_t *read, uint32_t timeout) {
+    (void)handle;
+    (void)buffer;
+    (void)length;
+    (void)timeout;
+    *read = 0;
+    return ESP_ERR_TIMEOUT; // frames are fed to readings_extract directly, see host_frames
+}
+esp_err_t adc_continuous_flush_pool(adc_continuous_handle_t handle) {
+    (void)handle;
+    return ESP_OK;
+}
+esp_err_t adc_continuous_deinit(adc_continuous_handle_t handle) {
+    (void)handle;
+    return ESP_OK;
+}
+esp_err_t adc_continuous_io_to_channel(int io, adc_unit_t *unit, adc_channel_t *channel) {
+    // ESP32-S3: GPIO1 to 10 are ADC1 channels 0 to 9, GPIO11 to 20 are ADC2 channels 0 to 9
+    if (io < 1 || io > 20)
+        return ESP_ERR_INVALID_ARG;
+    *unit    = io <= 10 ? ADC_UNIT_1 : ADC_UNIT_2;
+    *channel = (adc_channel_t)(io <= 10 ? io - 1 : io - 11);
+    return ESP_OK;
+}
+
+esp_err_t adc_cali_create_scheme_curve_fitting(const adc_cali_curve_fitting_config_t *config, adc_cali_handle_t *handle) {
+    *handle = (adc_cali_handle_t)(uintptr_t)config;
+    return host_cali ? ESP_OK : ESP_ERR_NOT_SUPPORTED;
+}
+esp_err_t adc_cali_delete_scheme_curve_fitting(adc_cali_handle_t handle) {
+    (void)handle;
+    return ESP_OK;
+}
+esp_err_t adc_cali_raw_to_voltage(adc_cali_handle_t handle, int raw, int *voltage) {
+    (void)handle;
+    const double x = (double)raw / ADC_MAX_VALUE;
+    *voltage       = (int)(ADC_VREF * 1000.0 * (x + (0.05 * x * (1.0 - x))));
+    return ESP_OK;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack, void *parameters, UBaseType_t priority, TaskHandle_t *task) {
+    return xTaskCreatePinnedToCore(function, name, stack, parameters, priority, task, 0);
+}
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack, void *parameters, UBaseType_t priority, TaskHandle_t *task, BaseType_t core) {
+    (void)function;
+    (void)name;
+    (void)stack;
+    (void)parameters;
+    (void)priority;
+    (void)core;
+    if (host_tasks_created == HOST_TASKS_MAX - 1) // the last is the current task
+        return pdFALSE;
+    if (task != NULL)
+        *task = (TaskHandle_t)&host_tasks[host_tasks_created];
+    host_tasks_created++;
+    return pdPASS; // not run
+}
+void vTaskDelete(TaskHandle_t task) { (void)task; }
+void vTaskDelay(TickType_t ticks) { host_time += (int64_t)ticks * US_PER_MS; }
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return (TaskHandle_t)&host_tasks[HOST_TASKS_MAX - 1]; }
+TaskHandle_t xTaskGetHandle(const char *name) {
+    (void)name;
+    return NULL;
+}
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+    (void)clear;
+    (void)wait;
+    return 0;
+}
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    (void)task;
+    return pdPASS;
+}
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+    (void)task;
+    (void)woken;
+}
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    (void)task;
+    return 0;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    host_queue_t *queue = (host_queue_t *)calloc(1, sizeof(host_queue_t) + (length * item_size));
+    if (queue != NULL) {
+        queue->length = length;
+        queue->size   = item_size;
+    }
+    return queue;
+}
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) {
+    (void)wait;
+    if (queue->count == queue->length)
+        return pdFALSE;
+    memcpy(&queue->data[((queue->head + queue->count) % queue->length) * queue->size], item, queue->size);
+    queue->count++;
+    return pdTRUE;
+}
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) {
+    (void)wait;
+    if (queue->count == 0)
+        return pdFALSE;
+    memcpy(item, &queue->data[queue->head * queue->size], queue->size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    return pdTRUE;
+}
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return xQueueCreate(1, 0); }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait) {
+    (void)semaphore;
+    (void)wait;
+    return pdTRUE;
+}
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    (void)semaphore;
+    return pdTRUE;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static host_nvs_key_t *host_nvs_find(const char *key, const bool create) {
+    for (int i = 0; i < HOST_NVS_KEYS; i++)
+        if (host_nvs[i].size > 0 && strcmp(host_nvs[i].key, key) == 0)
+            return &host_nvs[i];
+    if (create)
+        for (int i = 0; i < HOST_NVS_KEYS; i++)
+            if (host_nvs[i].size == 0) {
+                snprintf(host_nvs[i].key, sizeof(host_nvs[i].key), "%s", key);
+                return &host_nvs[i];
+            }
+    return NULL;
+}
+esp_err_t nvs_flash_init(void) { return host_nvs_fail ? ESP_FAIL : ESP_OK; }
+esp_err_t nvs_flash_erase(void) {
+    memset(host_nvs, 0, sizeof(host_nvs));
+    return ESP_OK;
+}
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *handle) {
+    (void)name;
+    (void)open_mode;
+    *handle = 1;
+    return host_nvs_fail ? ESP_FAIL : ESP_OK;
+}
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length) {
+    (void)handle;
+    const host_nvs_key_t *stored = host_nvs_find(key, false);
+    if (stored == NULL)
+        return ESP_ERR_NVS_NOT_FOUND;
+    if (*length < stored->size)
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    memcpy(value, stored->data, stored->size);
+    *length = stored->size;
+    return ESP_OK;
+}
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+    (void)handle;
+    host_nvs_key_t *stored = host_nvs_find(key, true);
+    if (host_nvs_fail || host_nvs_fail_writes || stored == NULL || length == 0 || length > sizeof(stored->data))
+        return ESP_FAIL;
+    memcpy(stored->data, value, length);
+    stored->size = length;
+    host_nvs_sets++;
+    return ESP_OK;
+}
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    (void)handle;
+    return host_nvs_fail ? ESP_FAIL : ESP_OK;
+}
+void nvs_close(nvs_handle_t handle) { (void)handle; }
+
+esp_err_t tinyusb_driver_install(const tinyusb_config_t *config) {
+    (void)config;
+    return ESP_OK;
+}
+esp_err_t tusb_cdc_acm_init(const tinyusb_config_cdcacm_t *config) {
+    (void)config;
+    return ESP_OK;
+}
+esp_err_t tinyusb_cdcacm_read(tinyusb_cdcacm_itf_t itf, uint8_t *buffer, size_t size, size_t *read) {
+    (void)itf;
+    (void)buffer;
+    (void)size;
+    *read = 0;
+    return ESP_OK;
+}
+size_t tinyusb_cdcacm_write_queue(tinyusb_cdcacm_itf_t itf, const uint8_t *buffer, size_t size) {
+    (void)itf;
+    (void)buffer;
+    return size;
+}
+esp_err_t tinyusb_cdcacm_write_flush(tinyusb_cdcacm_itf_t itf, uint32_t timeout) {
+    (void)itf;
+    (void)timeout;
+    return ESP_OK;
+}
+esp_err_t tinyusb_cdcacm_register_callback(tinyusb_cdcacm_itf_t itf, cdcacm_event_type_t event, tusb_cdcacm_callback_t callback) {
+    (void)itf;
+    (void)event;
+    (void)callback;
+    return ESP_OK;
+}
+esp_err_t esp_tusb_init_console(int itf) {
+    (void)itf;
+    return ESP_OK;
+}
+esp_err_t esp_tusb_deinit_console(int itf) {
+    (void)itf;
+    return ESP_OK;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static int host_checks, host_failures;
+
+#define CHECK(condition, ...) host_check((condition), __FILE__, __LINE__, __VA_ARGS__)
+
+static void __attribute__((format(printf, 4, 5))) host_check(const bool passed, const char *file, const int line, const char *format, ...) {
+    host_checks++;
+    if (!passed) {
+        host_failures++;
+        fprintf(stderr, "%s:%d: FAILED: ", file, line);
+        va_list arguments;
+        va_start(arguments, format);
+        vfprintf(stderr, format, arguments);
+        va_end(arguments);
+        fputc('\n', stderr);
+    }
+}
+
+static int host_exit(const char *name) {
+    printf("%s: %d checks, %d failed\n", name, host_checks, host_failures);
+    return host_failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static double host_relative(const double value, const double reference) { return fabs(value - reference) / fmax(fabs(reference), 1e-300); }
+
+static double host_now(void) {
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + ((double)now.tv_nsec * 1e-9);
+}
+
+// xorshift64*, so that runs are repeatable
+static uint64_t host_random_state = 0x9E3779B97F4A7C15ULL;
+static double host_uniform(void) {
+    host_random_state ^= host_random_state >> 12;
+    host_random_state ^= host_random_state << 25;
+    host_random_state ^= host_random_state >> 27;
+    return (double)((host_random_state * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0; // [0, 1)
+}
+static double host_gaussian(void) {
+    const double u = host_uniform(), v = host_uniform();
+    return sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * v);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+// sample of a sensor at a time (s, from the first sample), as linear ADC counts
+typedef double (*host_source_t)(void *context, const int sensor, const double time);
+
+static uint64_t host_rounds; // pattern rounds generated
+
+static uint32_t host_sample(const double value) { return (uint32_t)lround(fmin(fmax(value, 0.0), (double)ADC_MAX_VALUE)); }
+
+static double host_round_time(const uint64_t round, const int sensor) { return (double)((round * NUM_SENSORS) + (uint64_t)sensor) / (double)ADC_SAMPLE_RATE_HZ; }
+
+// pattern rounds as TYPE2 frames into acquisition, each sensor sampled at its own slot time, advancing host time to match
+static void host_frames(adc_system_t *adc, const uint64_t rounds, host_source_t source, void *context) {
+    uint32_t frame[ADC_SAMPLE_SIZE];
+    uint32_t sources[NUM_SENSORS];
+    for (int sensor = 0; sensor < NUM_SENSORS; sensor++)
+        sources[sensor] = (uint32_t)ADC_SOURCE(ADC_SENSOR_UNIT(sensor), adc_sensor_to_channel[sensor]) << 12;
+    int length = 0;
+    for (uint64_t round = 0; round < rounds; round++, host_rounds++) {
+        for (int sensor = 0; sensor < NUM_SENSORS; sensor++)
+            frame[length++] = host_sample(source(context, sensor, host_round_time(host_rounds, sensor))) | sources[sensor];
+        if (length == ADC_SAMPLE_SIZE || round + 1 == rounds) {
+            readings_extract((const uint8_t *)frame, (uint32_t)length * ADC_RESULT_BYTES, adc);
+            length = 0;
+        }
+    }
+    host_time = (int64_t)(host_round_time(host_rounds, 0) * 1e6) + 1;
+}
+
+static uint64_t host_rounds_for(const double seconds) { return (uint64_t)llround(seconds * HOST_RATE_SENSOR); }
+
+static void host_init(adc_system_t *adc) {
+    memset(adc, 0, sizeof(*adc));
+    (void)nvs_flash_init();
+    settings_init();
+    readings_linear_init();
+    __output_init();
+    if (readings_init(adc) != ESP_OK) {
+        fprintf(stderr, "host: readings_init failed\n");
+        exit(EXIT_FAILURE);
+    }
+    adc->process_task = xTaskGetCurrentTaskHandle();
+    readings_begin(adc);
+}
+
+// completed window through reporting and processing as on the device, then levels back to acquisition: report valid until the next
+static const adc_report_t *host_window(adc_system_t *adc, adc_result_t readings[NUM_DEVICES]) {
+    readings_end(adc);
+    readings_report(adc, host_time);
+    const adc_report_t *report = (const adc_report_t *)ring_read_begin(&adc->report_ring);
+    readings_process(adc, report, readings);
+    ring_read_end(&adc->report_ring);
+    readings_feedback(adc);
+    readings_begin(adc);
+    return report;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#endif // POWERMON_HOST_H
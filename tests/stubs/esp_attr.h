@@ -0,0 +1,8 @@
+// Host shim of ESP-IDF, as used by powermon.c: see tests/host.h
+
+#ifndef HOST_ESP_ATTR_H
+#define HOST_ESP_ATTR_H
+
+#define IRAM_ATTR
+
+#endif // HOST_ESP_ATTR_H
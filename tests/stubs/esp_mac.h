@@ -0,0 +1,13 @@
+// Host shim of ESP-IDF, as used by powermon.c: see tests/host.h
+
+#ifndef HOST_ESP_MAC_H
+#define HOST_ESP_MAC_H
+
+#include "esp_err.h"
+#include <stdint.h>
+
+typedef enum { ESP_MAC_EFUSE_FACTORY } esp_mac_type_t;
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type);
+
+#endif // HOST_ESP_MAC_H
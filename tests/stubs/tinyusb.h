@@ -0,0 +1,33 @@
+// Host shim of ESP-IDF, as used by powermon.c: see tests/host.h
+
+#ifndef HOST_TINYUSB_H
+#define HOST_TINYUSB_H
+
+#include "esp_err.h"
+#include "esp_system.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TUSB_DESC_DEVICE       1
+#define TUSB_CLASS_MISC        0xEF
+#define MISC_SUBCLASS_COMMON   2
+#define MISC_PROTOCOL_IAD      1
+#define CFG_TUD_ENDPOINT0_SIZE 64
+
+typedef struct {
+    uint8_t bLength, bDescriptorType;
+    uint16_t bcdUSB;
+    uint8_t bDeviceClass, bDeviceSubClass, bDeviceProtocol, bMaxPacketSize0;
+    uint16_t idVendor, idProduct, bcdDevice;
+    uint8_t iManufacturer, iProduct, iSerialNumber, bNumConfigurations;
+} tusb_desc_device_t;
+
+typedef struct {
+    const tusb_desc_device_t *device_descriptor;
+    const char **string_descriptor;
+    bool external_phy;
+} tinyusb_config_t;
+
+esp_err_t tinyusb_driver_install(const tinyusb_config_t *config);
+
+#endif // HOST_TINYUSB_H
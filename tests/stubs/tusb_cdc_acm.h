@@ -0,0 +1,36 @@
+// Host shim of ESP-IDF, as used by powermon.c: see tests/host.h
+
+#ifndef HOST_TUSB_CDC_ACM_H
+#define HOST_TUSB_CDC_ACM_H
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum { TINYUSB_CDC_ACM_0 = 0 } tinyusb_cdcacm_itf_t;
+typedef enum { TINYUSB_USBDEV_0 } tinyusb_usbdev_t;
+typedef enum { CDC_EVENT_RX, CDC_EVENT_RX_WANTED_CHAR, CDC_EVENT_LINE_STATE_CHANGED, CDC_EVENT_LINE_CODING_CHANGED } cdcacm_event_type_t;
+
+typedef struct {
+    cdcacm_event_type_t type;
+} cdcacm_event_t;
+
+typedef void (*tusb_cdcacm_callback_t)(int itf, cdcacm_event_t *event);
+
+typedef struct {
+    tinyusb_usbdev_t usb_dev;
+    tinyusb_cdcacm_itf_t cdc_port;
+    size_t rx_unread_buf_sz;
+    tusb_cdcacm_callback_t callback_rx;
+    tusb_cdcacm_callback_t callback_rx_wanted_char;
+    tusb_cdcacm_callback_t callback_line_state_changed;
+    tusb_cdcacm_callback_t callback_line_coding_changed;
+} tinyusb_config_cdcacm_t;
+
+esp_err_t tusb_cdc_acm_init(const tinyusb_config_cdcacm_t *config);
+esp_err_t tinyusb_cdcacm_read(tinyusb_cdcacm_itf_t itf, uint8_t *buffer, size_t size, size_t *read);
+size_t tinyusb_cdcacm_write_queue(tinyusb_cdcacm_itf_t itf, const uint8_t *buffer, size_t size);
+esp_err_t tinyusb_cdcacm_write_flush(tinyusb_cdcacm_itf_t itf, uint32_t timeout);
+esp_err_t tinyusb_cdcacm_register_callback(tinyusb_cdcacm_itf_t itf, cdcacm_event_type_t event, tusb_cdcacm_callback_t callback);
+
+#endif // HOST_TUSB_CDC_ACM_H
@@ -0,0 +1,11 @@
+// Host shim of ESP-IDF, as used by powermon.c: see tests/host.h
+
+#ifndef HOST_TUSB_CONSOLE_H
+#define HOST_TUSB_CONSOLE_H
+
+#include "esp_err.h"
+
+esp_err_t esp_tusb_init_console(int itf);
+esp_err_t esp_tusb_deinit_console(int itf);
+
+#endif // HOST_TUSB_CONSOLE_H
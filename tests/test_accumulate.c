@@ -0,0 +1,201 @@
+/*
+ * ESP32-S3 AC Power Monitor - test: integer accumulation of samples and of skew-compensated v·i, and the exact comoment
+ * Σxy - ΣxΣy/n, against double precision (Welford) and exact (128-bit) references
+ */
+
+#include "host.h"
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define TEST_FREQUENCY 50.0
+#define TEST_PHASE     0.6   // radians, current behind voltage
+#define TEST_WELFORD   1e-9  // relative, double reference accumulated over millions of samples
+#define TEST_EXACT     1e-15 // relative, to exact integers: the comoment is only rounded to double at the end
+#define TEST_RMS       1e-6  // relative, as float
+
+typedef struct {
+    uint64_t count;
+    double mean, m2; // Welford
+    __int128 sum, sum_squares;
+    int32_t min, max;
+} test_moment_t;
+
+typedef struct {
+    uint64_t count;
+    double mean_x, mean_y, c2; // Welford co-moment
+    __int128 sum_x, sum_y, sum_xy;
+} test_comoment_t;
+
+typedef struct {
+    double offset[NUM_SENSORS], amplitude[NUM_SENSORS], phase[NUM_SENSORS];
+    test_moment_t moment[NUM_SENSORS];
+    test_comoment_t comoment[NUM_DEVICES];
+    int32_t current[NUM_DEVICES], voltage[NUM_DEVICES]; // as acquisition pairs them, see readings_extract
+    bool current_valid[NUM_DEVICES], voltage_valid[NUM_DEVICES];
+} test_signal_t;
+
+static void test_moment(test_moment_t *m, const int32_t x) {
+    m->min = m->count == 0 || x < m->min ? x : m->min;
+    m->max = m->count == 0 || x > m->max ? x : m->max;
+    m->count++;
+    const double delta = (double)x - m->mean;
+    m->mean += delta / (double)m->count;
+    m->m2 += delta * ((double)x - m->mean);
+    m->sum += x;
+    m->sum_squares += (__int128)x * x;
+}
+
+static void test_comoment(test_comoment_t *m, const int32_t x, const int32_t y) {
+    m->count++;
+    const double delta_x = (double)x - m->mean_x;
+    m->mean_x += delta_x / (double)m->count;
+    m->mean_y += ((double)y - m->mean_y) / (double)m->count;
+    m->c2 += delta_x * ((double)y - m->mean_y);
+    m->sum_x += x;
+    m->sum_y += y;
+    m->sum_xy += (__int128)x * y;
+}
+
+// exact n·Σxy - ΣxΣy in 128 bits, then divided by n once
+static double test_exact(const __int128 sum_xy, const __int128 sum_x, const __int128 sum_y, const uint64_t count) {
+    return (double)((long double)(((__int128)count * sum_xy) - (sum_x * sum_y)) / (long double)count);
+}
+
+static double test_source(void *context, const int sensor, const double time) {
+    test_signal_t *signal = (test_signal_t *)context;
+    const uint32_t value  = host_sample(signal->offset[sensor] + (signal->amplitude[sensor] * sin((2.0 * M_PI * TEST_FREQUENCY * time) - signal->phase[sensor])));
+    const int32_t centred = (int32_t)value - ADC_MIDPOINT;
+    const int device      = sensor % NUM_DEVICES;
+    test_moment(&signal->moment[sensor], centred);
+    if (sensor < NUM_DEVICES) {
+        signal->current[device]       = centred;
+        signal->current_valid[device] = true;
+    } else {
+        if (signal->current_valid[device] && signal->voltage_valid[device])
+            test_comoment(&signal->comoment[device], (signal->voltage[device] * ADC_SKEW_SLOTS) + (centred * (NUM_SENSORS - ADC_SKEW_SLOTS)), signal->current[device]);
+        signal->voltage[device]       = centred;
+        signal->voltage_valid[device] = true;
+        signal->current_valid[device] = false;
+    }
+    return (double)value;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static void test_window(const char *name, const double current_offset, const double current_amplitude, const double voltage_offset, const double voltage_amplitude,
+                        const double seconds) {
+
+    static adc_system_t adc;
+    static test_signal_t signal;
+    host_init(&adc);
+    memset(&signal, 0, sizeof(signal));
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        const double scale                = 1.0 - (0.15 * d); // devices differ, so that no two sensors are alike
+        signal.offset[d]                  = current_offset;
+        signal.amplitude[d]               = current_amplitude * scale;
+        signal.phase[d]                   = TEST_PHASE;
+        signal.offset[d + NUM_DEVICES]    = voltage_offset;
+        signal.amplitude[d + NUM_DEVICES] = voltage_amplitude * scale;
+    }
+
+    // no voltage reference fed back, so no cycles: the window is every sample
+    host_frames(&adc, host_rounds_for(seconds), test_source, &signal);
+    readings_end(&adc);
+    const adc_window_t *window = &adc.result;
+
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        const adc_accum_t *accum = &window->accum[i];
+        const test_moment_t *m   = &signal.moment[i];
+        CHECK(accum->count == m->count && accum->sum == (int64_t)m->sum && accum->sum_squares == (uint64_t)m->sum_squares, "%s: sensor %d sums", name, i);
+        CHECK(accum->min == (uint32_t)(m->min + ADC_MIDPOINT) && accum->max == (uint32_t)(m->max + ADC_MIDPOINT), "%s: sensor %d min %lu, max %lu, reference %ld, %ld", name,
+              i, (unsigned long)accum->min, (unsigned long)accum->max, (long)(m->min + ADC_MIDPOINT), (long)(m->max + ADC_MIDPOINT));
+        const double comoment = calculate_comoment((int64_t)accum->sum_squares, accum->sum, accum->sum, accum->count);
+        CHECK(host_relative(comoment, m->m2) < TEST_WELFORD, "%s: sensor %d Σx² - (Σx)²/n = %.10g, Welford %.10g", name, i, comoment, m->m2);
+        CHECK(host_relative(comoment, test_exact(m->sum_squares, m->sum, m->sum, m->count)) < TEST_EXACT, "%s: sensor %d not exact", name, i);
+        const double rms = sqrt(m->m2 / (double)m->count);
+        CHECK(host_relative(calculate_rms(accum), rms) < TEST_RMS || (rms < 1e-3 && calculate_rms(accum) < 1e-3f), "%s: sensor %d rms %.6f, reference %.6f", name, i,
+              (double)calculate_rms(accum), rms);
+        CHECK(host_relative(calculate_zero_offset(accum), m->mean + ADC_MIDPOINT) < TEST_RMS, "%s: sensor %d offset %.6f, reference %.6f", name, i,
+              (double)calculate_zero_offset(accum), m->mean + ADC_MIDPOINT);
+    }
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        const adc_power_t *power = &window->power[d];
+        const test_comoment_t *m = &signal.comoment[d];
+        CHECK(power->count == m->count && power->sum_voltage == (int64_t)m->sum_x && power->sum_current == (int64_t)m->sum_y && power->sum_product == (int64_t)m->sum_xy,
+              "%s: device %d power sums", name, d);
+        const double comoment = calculate_comoment(power->sum_product, power->sum_voltage, power->sum_current, power->count);
+        const double scale    = sqrt(signal.moment[d].m2 * signal.moment[d + NUM_DEVICES].m2) * NUM_SENSORS; // as the comoment is small near quadrature
+        CHECK(fabs(comoment - m->c2) < TEST_WELFORD * fmax(scale, 1.0), "%s: device %d Σvi - ΣvΣi/n = %.10g, Welford %.10g", name, d, comoment, m->c2);
+        CHECK(fabs(comoment - test_exact(m->sum_xy, m->sum_x, m->sum_y, m->count)) <= TEST_EXACT * fmax(fabs(comoment), 1.0), "%s: device %d not exact", name, d);
+    }
+    readings_term(&adc);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+// n samples of which k at a and n - k at b, as accumulated
+static void test_limit(const char *name, const uint32_t count, const uint32_t k, const int32_t a, const int32_t b) {
+
+    const __int128 sum = ((__int128)k * a) + ((__int128)(count - k) * b), sum_squares = ((__int128)k * a * a) + ((__int128)(count - k) * b * b);
+    CHECK(sum >= INT64_MIN && sum <= INT64_MAX && sum_squares <= UINT64_MAX, "%s: accumulators overflow", name);
+    const adc_accum_t accum = { .count = count, .sum = (int64_t)sum, .sum_squares = (uint64_t)sum_squares };
+    const double comoment   = calculate_comoment((int64_t)accum.sum_squares, accum.sum, accum.sum, accum.count);
+    const double exact      = test_exact(sum_squares, sum, sum, count);
+    CHECK(exact == 0.0 ? comoment == 0.0 : host_relative(comoment, exact) < TEST_EXACT, "%s: Σx² - (Σx)²/n = %.17g, exact %.17g", name, comoment, exact);
+    const double rms = sqrt(exact / (double)count);
+    CHECK(exact == 0.0 ? calculate_rms(&accum) == 0.0f : host_relative(calculate_rms(&accum), rms) < TEST_RMS, "%s: rms %.9g, exact %.9g", name, (double)calculate_rms(&accum),
+          rms);
+}
+
+static void test_limits(void) {
+
+    // the window count (uint32_t) is the limit, as full scale samples over UINT32_MAX of them fit the 64-bit sums
+    const int32_t low = -ADC_MIDPOINT, high = ADC_MAX_VALUE - ADC_MIDPOINT, voltage_high = high * NUM_SENSORS, voltage_low = low * NUM_SENSORS;
+    CHECK((__int128)UINT32_MAX * low * low <= UINT64_MAX, "Σx² fits");
+    CHECK((__int128)UINT32_MAX * voltage_low * low <= INT64_MAX && (__int128)UINT32_MAX * voltage_high * low >= INT64_MIN, "Σvi fits");
+    const uint32_t counts[] = { UINT32_MAX, UINT32_MAX - 1, (1UL << 31) + 1, 240001 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        const uint32_t n = counts[c];
+        char name[64];
+        snprintf(name, sizeof(name), "n=%lu dc low", (unsigned long)n);
+        test_limit(name, n, n, low, 0);
+        snprintf(name, sizeof(name), "n=%lu dc high", (unsigned long)n);
+        test_limit(name, n, 0, 0, high);
+        snprintf(name, sizeof(name), "n=%lu full swing", (unsigned long)n);
+        test_limit(name, n, n / 2, low, high);
+        snprintf(name, sizeof(name), "n=%lu one outlier", (unsigned long)n);
+        test_limit(name, n, 1, low, high);
+        snprintf(name, sizeof(name), "n=%lu one step", (unsigned long)n);
+        test_limit(name, n, n / 3, high - 1, high);
+
+        // power: voltage (scaled by NUM_SENSORS) at full swing against current at full swing, in and out of phase
+        const uint32_t k = n / 2;
+        for (int sign = -1; sign <= 1; sign += 2) {
+            const __int128 sum_v = ((__int128)k * voltage_low) + ((__int128)(n - k) * voltage_high);
+            const __int128 sum_i = sign > 0 ? ((__int128)k * low) + ((__int128)(n - k) * high) : ((__int128)k * high) + ((__int128)(n - k) * low);
+            const __int128 sum_p = sign > 0 ? ((__int128)k * voltage_low * low) + ((__int128)(n - k) * voltage_high * high)
+                                            : ((__int128)k * voltage_low * high) + ((__int128)(n - k) * voltage_high * low);
+            const double comoment = calculate_comoment((int64_t)sum_p, (int64_t)sum_v, (int64_t)sum_i, n);
+            const double exact    = test_exact(sum_p, sum_v, sum_i, n);
+            CHECK(host_relative(comoment, exact) < TEST_EXACT, "n=%lu power %+d: Σvi - ΣvΣi/n = %.17g, exact %.17g", (unsigned long)n, sign, comoment, exact);
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+
+    const double period = (double)REPORTINGS_PERIOD_MS / 1000.0, period_max = (double)SETTINGS_PERIOD_READ_MAX_MS / 1000.0;
+
+    test_window("sine", 1800.0, 1200.0, 1760.0, 1500.0, period);
+    test_window("sine longest", 1800.0, 1200.0, 1760.0, 1500.0, period_max);
+    test_window("dc offset", 3900.0, 20.0, 150.0, 30.0, period);
+    test_window("dc offset longest", 3900.0, 20.0, 150.0, 30.0, period_max);
+    test_window("dc only", 4095.0, 0.0, 0.0, 0.0, period);
+    test_window("full scale", 2048.0, 2600.0, 2048.0, 2600.0, period);
+    test_window("full scale longest", 2048.0, 2600.0, 2048.0, 2600.0, period_max);
+    test_limits();
+
+    return host_exit("test_accumulate");
+}
@@ -0,0 +1,319 @@
+/*
+ * ESP32-S3 AC Power Monitor - test: energy and run hours, integrated over windows of synthetic samples for constant import
+ * and export, for power that changes sign within and between windows, for currents either side of the running threshold, and
+ * for windows dropped as processing falls behind;
+ * and the checkpoints of the totals to the fake NVS, alternating between slots by sequence, through failed and torn saves
+ */
+
+#include "host.h"
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define TEST_WINDOWS        12     // of TEST_PERIOD
+#define TEST_PERIOD         5.0    // s, of each window
+#define TEST_OFFSET         1800.0 // ADC counts
+#define TEST_VOLTAGE        400.0  // ADC counts amplitude, ~230V at the default scale
+#define TEST_NOISE          1.0    // ADC counts RMS, white
+#define TEST_ERROR_CONSTANT 0.005  // relative, of energy and run hours from power and time
+#define TEST_ERROR_CHANGING 0.02   // relative to the reference, as windows end on cycle boundaries either side of the changes
+#define TEST_IDLE_POWER     0.1    // W, at most, of noise on an idle device
+
+typedef enum {
+    TEST_CONSTANT = 0, // at phase throughout
+    TEST_HALVES,       // at phase for the first half of each period, reversed for the second
+    TEST_QUARTERS,     // at phase for three quarters of each period, reversed for the last
+    TEST_ALTERNATE,    // at phase for even periods, reversed for odd
+} test_pattern_t;
+
+typedef struct {
+    double current; // A RMS, 0 = idle
+    double phase;   // degrees, of current after voltage: 0 imports, 180 exports
+    test_pattern_t pattern;
+} test_device_t;
+
+typedef struct {
+    test_device_t devices[NUM_DEVICES];
+    double amplitude[NUM_DEVICES]; // ADC counts, of current
+} test_signal_t;
+
+static double test_source(void *context, const int sensor, const double time) {
+    const test_signal_t *signal = (const test_signal_t *)context;
+    const double angle          = 2.0 * M_PI * 50.0 * time;
+    if (sensor >= NUM_DEVICES)
+        return TEST_OFFSET + (TEST_VOLTAGE * sin(angle)) + (TEST_NOISE * host_gaussian());
+    const test_device_t *device = &signal->devices[sensor];
+    const double within         = fmod(time, TEST_PERIOD) / TEST_PERIOD, period = floor(time / TEST_PERIOD);
+    bool reversed               = false;
+    switch (device->pattern) {
+    case TEST_HALVES:
+        reversed = within >= 0.5;
+        break;
+    case TEST_QUARTERS:
+        reversed = within >= 0.75;
+        break;
+    case TEST_ALTERNATE:
+        reversed = fmod(period, 2.0) >= 1.0;
+        break;
+    case TEST_CONSTANT:
+    default:
+        break;
+    }
+    const double phase = (device->phase + (reversed ? 180.0 : 0.0)) * M_PI / 180.0;
+    return TEST_OFFSET + (signal->amplitude[sensor] * sin(angle - phase)) + (TEST_NOISE * host_gaussian());
+}
+
+// windows into the energy totals, with the readings of the last, and processing held up for the first held after the second (so that the ring fills and
+// windows are dropped, to be carried into the next): returns the time the windows cover, as the firmware counts it
+static double test_run(test_signal_t *signal, energy_t *energy, adc_result_t readings[NUM_DEVICES], const int held) {
+
+    static adc_system_t adc;
+    host_init(&adc);
+    settings_scale_t scale;
+    settings_read(NULL, &scale);
+    for (int d = 0; d < NUM_DEVICES; d++)
+        signal->amplitude[d] = signal->devices[d].current > 0.0 ? (M_SQRT2 * (signal->devices[d].current - (double)scale.current_offset[d])) / (double)scale.current_scale[d] : 0.0;
+
+    memset(host_nvs, 0, sizeof(host_nvs));
+    energy_load(energy);
+    const uint64_t rounds = host_rounds_for(TEST_PERIOD);
+    uint64_t counted      = 0;
+    for (int w = 0; w < TEST_WINDOWS; w++) {
+        host_frames(&adc, rounds, test_source, signal);
+        if (w >= 2 && w < 2 + held) {
+            readings_end(&adc);
+            readings_report(&adc, host_time);
+            readings_begin(&adc);
+            continue;
+        }
+        const adc_report_t *report = host_window(&adc, readings);
+        energy_window(energy, report, readings);
+        counted += report->window.power[0].count;
+    }
+    const adc_report_t *report; // those still queued, when held up
+    while ((report = (const adc_report_t *)ring_read_begin(&adc.report_ring)) != NULL) {
+        readings_process(&adc, report, readings);
+        energy_window(energy, report, readings);
+        counted += report->window.power[0].count;
+        ring_read_end(&adc.report_ring);
+    }
+    CHECK((adc.windows_dropped > 0) == (held > REPORT_RING_SIZE), "run: %lu windows dropped, held for %d", (unsigned long)adc.windows_dropped, held);
+    readings_term(&adc);
+    return (double)counted / HOST_RATE_SENSOR; // s, of windows ended, less the partial cycle carried from the last
+}
+
+static double test_hours(const double seconds) { return seconds / 3600.0; }
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static void test_constant(void) {
+
+    static test_signal_t signal = { .devices = {
+                                        { .current = 5.0, .phase = 0.0 },    // import, unity power factor
+                                        { .current = 2.0, .phase = 180.0 },  // export
+                                        { .current = 3.0, .phase = 60.0 },   // import, lagging
+                                        { .current = 1.0, .phase = -120.0 }, // export, leading
+                                        { .current = 0.0 },                  // idle
+                                    } };
+    energy_t energy;
+    adc_result_t readings[NUM_DEVICES];
+    const double seconds = test_run(&signal, &energy, readings, 0);
+
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        const double power = (double)readings[d].power_real, expected = fabs(power) * test_hours(seconds);
+        const double import = energy.totals.energy_import[d], export = energy.totals.energy_export[d], hours = energy.totals.run_hours[d];
+        if (signal.devices[d].current == 0.0) {
+            CHECK(import < TEST_IDLE_POWER * test_hours(seconds) && export < TEST_IDLE_POWER * test_hours(seconds), "constant: device %d idle, %.6f/%.6fWh", d, import,
+                  export);
+            CHECK(hours == 0.0, "constant: device %d idle, %.6fh run", d, hours);
+        } else {
+            const bool importing = cos(signal.devices[d].phase * M_PI / 180.0) > 0.0;
+            CHECK(importing ? power > 0.0 : power < 0.0, "constant: device %d power %.3fW of the wrong sign", d, power);
+            CHECK(host_relative(importing ? import : export, expected) < TEST_ERROR_CONSTANT, "constant: device %d %s %.6fWh, expected %.6fWh", d,
+                  importing ? "import" : "export", importing ? import : export, expected);
+            CHECK((importing ? export : import) == 0.0, "constant: device %d %s %.6fWh, expected none", d, importing ? "export" : "import", importing ? export : import);
+            CHECK(host_relative(hours, test_hours(seconds)) < TEST_ERROR_CONSTANT, "constant: device %d %.6fh run, expected %.6fh", d, hours, test_hours(seconds));
+        }
+        CHECK((double)readings[d].energy_import == (double)(float)import && (double)readings[d].energy_export == (double)(float)export &&
+                  (double)readings[d].run_hours == (double)(float)hours,
+              "constant: device %d totals not reported", d);
+        printf("  constant device %d: %8.3fW over %.1fs, import %9.6fWh, export %9.6fWh, run %.6fh\n", d, power, seconds, import, export, hours);
+    }
+}
+
+static void test_changing(void) {
+
+    // each against a reference at the same current throughout, as the net of each window is integrated: reversals within one cancel
+    static test_signal_t signal = { .devices = {
+                                        { .current = 4.0, .pattern = TEST_CONSTANT },                 // reference
+                                        { .current = 4.0, .pattern = TEST_HALVES },                   // nets to none
+                                        { .current = 4.0, .pattern = TEST_QUARTERS },                 // nets to half import
+                                        { .current = 4.0, .pattern = TEST_ALTERNATE },                // half the windows import, half export
+                                        { .current = 4.0, .phase = 180.0, .pattern = TEST_QUARTERS }, // nets to half export
+                                    } };
+    energy_t energy;
+    adc_result_t readings[NUM_DEVICES];
+    (void)test_run(&signal, &energy, readings, 0);
+
+    const double reference                = energy.totals.energy_import[0];
+    const double expected[NUM_DEVICES][2] = { { 1.0, 0.0 }, { 0.0, 0.0 }, { 0.5, 0.0 }, { 0.5, 0.5 }, { 0.0, 0.5 } }; // import, export, of reference
+    for (int d = 1; d < NUM_DEVICES; d++) {
+        const double import = energy.totals.energy_import[d] / reference, export = energy.totals.energy_export[d] / reference;
+        CHECK(fabs(import - expected[d][0]) < TEST_ERROR_CHANGING && fabs(export - expected[d][1]) < TEST_ERROR_CHANGING,
+              "changing: device %d import %.4f, export %.4f of reference, expected %.2f, %.2f", d, import, export, expected[d][0], expected[d][1]);
+        CHECK(host_relative(energy.totals.run_hours[d], energy.totals.run_hours[0]) < TEST_ERROR_CONSTANT, "changing: device %d %.6fh run, reference %.6fh", d,
+              energy.totals.run_hours[d], energy.totals.run_hours[0]);
+        printf("  changing device %d: import %.4f, export %.4f of reference %.6fWh\n", d, import, export, reference);
+    }
+}
+
+static void test_running(void) {
+
+    // current either side of ENERGY_RUN_CURRENT, with voltage on all
+    static test_signal_t signal = { .devices = {
+                                        { .current = ENERGY_RUN_CURRENT * 0.5 },
+                                        { .current = ENERGY_RUN_CURRENT * 0.8 },
+                                        { .current = ENERGY_RUN_CURRENT * 1.25 },
+                                        { .current = ENERGY_RUN_CURRENT * 3.0 },
+                                        { .current = 0.0 },
+                                    } };
+    energy_t energy;
+    adc_result_t readings[NUM_DEVICES];
+    const double seconds = test_run(&signal, &energy, readings, 0);
+
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        const double hours = energy.totals.run_hours[d];
+        if (signal.devices[d].current > ENERGY_RUN_CURRENT)
+            CHECK(host_relative(hours, test_hours(seconds)) < TEST_ERROR_CONSTANT, "running: device %d at %.3fA (%.3fA) %.6fh run, expected %.6fh", d,
+                  signal.devices[d].current, (double)readings[d].current_rms, hours, test_hours(seconds));
+        else
+            CHECK(hours == 0.0, "running: device %d at %.3fA (%.3fA) %.6fh run, expected none", d, signal.devices[d].current, (double)readings[d].current_rms, hours);
+        printf("  running device %d: %.3fA, run %.6fh of %.6fh\n", d, (double)readings[d].current_rms, hours, test_hours(seconds));
+    }
+}
+
+static void test_dropped(void) {
+
+    // processing held up for more windows than the ring holds: those dropped are carried into the next, so none of the time or energy is lost
+    static test_signal_t signal = { .devices = {
+                                        { .current = 5.0, .phase = 0.0 },   // import
+                                        { .current = 2.0, .phase = 180.0 }, // export
+                                        { .current = 3.0, .phase = 60.0 },  // import, lagging
+                                        { .current = 1.0, .phase = 0.0 },
+                                        { .current = 0.0 }, // idle
+                                    } };
+    energy_t energy;
+    adc_result_t readings[NUM_DEVICES];
+    const double seconds = test_run(&signal, &energy, readings, REPORT_RING_SIZE + 2), total = TEST_WINDOWS * TEST_PERIOD;
+
+    CHECK(total - seconds < 3.0 / 50.0, "dropped: %.3fs counted of %.1fs", seconds, total); // less the cycles before the first boundary and after the last
+    for (int d = 0; d < NUM_DEVICES - 1; d++) {
+        const double power = (double)readings[d].power_real, expected = fabs(power) * test_hours(total);
+        const double energy_wh = power > 0.0 ? energy.totals.energy_import[d] : energy.totals.energy_export[d];
+        CHECK(host_relative(energy_wh, expected) < TEST_ERROR_CONSTANT, "dropped: device %d %.6fWh, expected %.6fWh", d, energy_wh, expected);
+        CHECK(host_relative(energy.totals.run_hours[d], test_hours(total)) < TEST_ERROR_CONSTANT, "dropped: device %d %.6fh run, expected %.6fh", d,
+              energy.totals.run_hours[d], test_hours(total));
+        printf("  dropped device %d: %8.3fW, %9.6fWh of %9.6fWh, run %.6fh\n", d, power, energy_wh, expected, energy.totals.run_hours[d]);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static host_nvs_key_t *test_slot(const int slot) {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    snprintf(key, sizeof(key), ENERGY_KEY_FORMAT, slot);
+    return host_nvs_find(key, false);
+}
+
+static uint32_t test_slot_sequence(const int slot) {
+    const host_nvs_key_t *stored = test_slot(slot);
+    return stored != NULL && stored->size == sizeof(energy_stored_t) ? ((const energy_stored_t *)stored->data)->sequence : 0;
+}
+
+// a window of constant power on device 0, as processing would give it
+static void test_window(energy_t *energy, const float power, const double hours) {
+    adc_report_t report = { 0 };
+    adc_result_t readings[NUM_DEVICES];
+    memset(readings, 0, sizeof(readings));
+    report.window.power[0].count = report.window.accum[0].count = (uint32_t)llround(hours * 3600.0 * HOST_RATE_SENSOR);
+    readings[0].power_real       = power;
+    readings[0].current_rms      = (float)1.0;
+    energy_window(energy, &report, readings);
+}
+
+static void test_checkpoint(void) {
+
+    const int64_t period = (int64_t)ENERGY_CHECKPOINT_MS * US_PER_MS;
+    energy_t energy, loaded;
+    memset(host_nvs, 0, sizeof(host_nvs));
+    host_nvs_sets = 0;
+    host_time     = 1;
+
+    energy_load(&energy);
+    CHECK(energy.totals.sequence == 0 && energy.totals.energy_import[0] == 0.0 && !energy.changed, "checkpoint: empty store not loaded as zero");
+    energy_checkpoint(&energy, host_time + period, true);
+    CHECK(host_nvs_sets == 0, "checkpoint: unchanged totals saved");
+
+    // saved only when changed and a period on, or at once if asked (as before restarting)
+    test_window(&energy, (float)1000.0, 0.01);
+    energy_checkpoint(&energy, host_time + period - 1, false);
+    CHECK(host_nvs_sets == 0 && energy.changed, "checkpoint: saved before the period");
+    energy_checkpoint(&energy, host_time + period, false);
+    CHECK(host_nvs_sets == 1 && !energy.changed && energy.totals.sequence == 1 && test_slot_sequence(1) == 1, "checkpoint: first not saved as sequence 1 in slot 1");
+    test_window(&energy, (float)-500.0, 0.01);
+    energy_checkpoint(&energy, host_time + period + 1, true);
+    CHECK(host_nvs_sets == 2 && energy.totals.sequence == 2 && test_slot_sequence(0) == 2 && test_slot_sequence(1) == 1, "checkpoint: second not in slot 0");
+    energy_load(&loaded);
+    CHECK(loaded.totals.sequence == 2 && loaded.totals.energy_import[0] == 10.0 && loaded.totals.energy_export[0] == 5.0, "checkpoint: newest not loaded, %lu",
+          (unsigned long)loaded.totals.sequence);
+
+    // a failed save is retried next period, into the slot after the newest, so that the newest stays intact until the retry is
+    test_window(&energy, (float)1000.0, 0.01);
+    host_nvs_fail_writes = true;
+    energy_checkpoint(&energy, host_time + (3 * period), false);
+    host_nvs_fail_writes = false;
+    CHECK(energy.changed && test_slot_sequence(0) == 2 && test_slot_sequence(1) == 1, "checkpoint: failed save not left to retry");
+    host_nvs_fail = true;
+    energy_checkpoint(&energy, host_time + (4 * period), false);
+    host_nvs_fail = false;
+    CHECK(energy.changed && test_slot_sequence(0) == 2 && test_slot_sequence(1) == 1, "checkpoint: failed open not left to retry");
+    energy_checkpoint(&energy, host_time + (4 * period) + 1, false);
+    CHECK(energy.changed, "checkpoint: failed save retried before the period");
+    energy_checkpoint(&energy, host_time + (5 * period), false);
+    CHECK(!energy.changed && test_slot_sequence(0) == 2 && test_slot_sequence(1) == 3, "checkpoint: retry saved as %lu/%lu in slots 0/1, expected 2/3",
+          (unsigned long)test_slot_sequence(0), (unsigned long)test_slot_sequence(1));
+    energy_load(&loaded);
+    CHECK(loaded.totals.sequence == 3 && loaded.totals.energy_import[0] == 20.0, "checkpoint: retry not loaded");
+
+    // newest torn (e.g. power lost while saving) or of another version: the one before is loaded
+    host_nvs_key_t *newest = test_slot(1);
+    newest->size--;
+    energy_load(&loaded);
+    CHECK(loaded.totals.sequence == 2 && loaded.totals.energy_import[0] == 10.0, "checkpoint: torn newest loaded, %lu", (unsigned long)loaded.totals.sequence);
+    newest->size++;
+    ((energy_stored_t *)newest->data)->version = ENERGY_VERSION + 1;
+    energy_load(&loaded);
+    CHECK(loaded.totals.sequence == 2, "checkpoint: newest of another version loaded");
+    ((energy_stored_t *)newest->data)->version = ENERGY_VERSION;
+
+    // and on from the loaded, alternating
+    energy_load(&energy);
+    test_window(&energy, (float)1000.0, 0.01);
+    energy_checkpoint(&energy, host_time, true);
+    CHECK(energy.totals.sequence == 4 && test_slot_sequence(0) == 4 && test_slot_sequence(1) == 3, "checkpoint: after load not alternating, %lu/%lu",
+          (unsigned long)test_slot_sequence(0), (unsigned long)test_slot_sequence(1));
+    printf("  checkpoint: %lu saves, slots at sequences %lu/%lu\n", (unsigned long)host_nvs_sets, (unsigned long)test_slot_sequence(0),
+           (unsigned long)test_slot_sequence(1));
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+
+    test_constant();
+    test_changing();
+    test_running();
+    test_dropped();
+    test_checkpoint();
+
+    return host_exit("test_energy");
+}
@@ -0,0 +1,117 @@
+/*
+ * ESP32-S3 AC Power Monitor - test: integer accumulation of RMS and zero offset against the float path it replaced
+ * (mean, then RMS about it, each summed in float over the samples of the window), both against a double reference
+ */
+
+#include "host.h"
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define TEST_FREQUENCY        50.0
+#define TEST_SAMPLES_FLOAT    320  // per sensor, as the float path's window (5 cycles at 64 per cycle)
+#define TEST_INTEGER_RMS      1e-6 // relative, integer path at any window length (float rounding of the result only)
+#define TEST_INTEGER_OFFSET   1e-3 // ADC counts, integer path at any window length
+#define TEST_FLOAT_RMS_SHORT  1e-5 // relative, float path over its own window
+#define TEST_FLOAT_RMS_LONG   1e-2 // relative, float path over windows of seconds: drifts, so bounded loosely
+#define TEST_FLOAT_OFFSET     2.0  // ADC counts, float path over windows of seconds
+#define TEST_AGREE_SHORT      1e-5 // relative, integer and float paths over the float path's window
+
+typedef struct {
+    double offset[NUM_SENSORS], amplitude[NUM_SENSORS];
+    uint32_t *samples[NUM_SENSORS];
+    uint32_t count[NUM_SENSORS], size;
+} test_signal_t;
+
+static double test_source(void *context, const int sensor, const double time) {
+    test_signal_t *signal = (test_signal_t *)context;
+    const uint32_t value  = host_sample(signal->offset[sensor] + (signal->amplitude[sensor] * sin(2.0 * M_PI * TEST_FREQUENCY * time)) + host_gaussian());
+    if (signal->count[sensor] < signal->size)
+        signal->samples[sensor][signal->count[sensor]++] = value;
+    return (double)value;
+}
+
+// as replaced: float sums over the stored samples
+static float test_float_offset(const uint32_t *samples, const uint32_t count) {
+    float sum = 0.0;
+    for (uint32_t i = 0; i < count; i++)
+        sum += (float)samples[i];
+    return sum / (float)count;
+}
+
+static float test_float_rms(const uint32_t *samples, const uint32_t count, const float zero_offset) {
+    float sum_squares = 0.0;
+    for (uint32_t i = 0; i < count; i++)
+        sum_squares += ((float)samples[i] - zero_offset) * ((float)samples[i] - zero_offset);
+    return sqrtf(sum_squares / (float)count);
+}
+
+// two pass, in double
+static void test_reference(const uint32_t *samples, const uint32_t count, double *offset, double *rms) {
+    double sum = 0.0, sum_squares = 0.0;
+    for (uint32_t i = 0; i < count; i++)
+        sum += (double)samples[i];
+    *offset = sum / (double)count;
+    for (uint32_t i = 0; i < count; i++)
+        sum_squares += ((double)samples[i] - *offset) * ((double)samples[i] - *offset);
+    *rms = sqrt(sum_squares / (double)count);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static void test_window(const uint64_t rounds) {
+
+    static adc_system_t adc;
+    static test_signal_t signal;
+    host_init(&adc);
+    signal.size = (uint32_t)rounds;
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        signal.offset[i]    = 1700.0 + (40.0 * i);
+        signal.amplitude[i] = 20.0 + (150.0 * i); // from near idle to most of the range
+        signal.samples[i]   = (uint32_t *)malloc(rounds * sizeof(uint32_t));
+        signal.count[i]     = 0;
+    }
+    host_frames(&adc, rounds, test_source, &signal);
+    readings_end(&adc); // no cycles, so every sample
+
+    const bool is_short      = rounds <= TEST_SAMPLES_FLOAT;
+    double float_error_max   = 0.0;
+    double integer_error_max = 0.0;
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        const adc_accum_t *accum = &adc.result.accum[i];
+        double offset, rms;
+        test_reference(signal.samples[i], signal.count[i], &offset, &rms);
+
+        const float integer_offset = calculate_zero_offset(accum), integer_rms = calculate_rms(accum);
+        const float float_offset = test_float_offset(signal.samples[i], signal.count[i]), float_rms = test_float_rms(signal.samples[i], signal.count[i], float_offset);
+        const double integer_error = host_relative(integer_rms, rms), float_error = host_relative(float_rms, rms);
+        integer_error_max          = fmax(integer_error_max, integer_error);
+        float_error_max            = fmax(float_error_max, float_error);
+
+        CHECK(accum->count == signal.count[i], "%llu rounds: sensor %d count %lu", (unsigned long long)rounds, i, (unsigned long)accum->count);
+        CHECK(integer_error < TEST_INTEGER_RMS, "%llu rounds: sensor %d integer rms %.6f, reference %.6f", (unsigned long long)rounds, i, (double)integer_rms, rms);
+        CHECK(fabs(integer_offset - offset) < TEST_INTEGER_OFFSET, "%llu rounds: sensor %d integer offset %.4f, reference %.4f", (unsigned long long)rounds, i,
+              (double)integer_offset, offset);
+        CHECK(float_error < (is_short ? TEST_FLOAT_RMS_SHORT : TEST_FLOAT_RMS_LONG), "%llu rounds: sensor %d float rms %.6f, reference %.6f", (unsigned long long)rounds, i,
+              (double)float_rms, rms);
+        CHECK(fabs(float_offset - offset) < TEST_FLOAT_OFFSET, "%llu rounds: sensor %d float offset %.4f, reference %.4f", (unsigned long long)rounds, i,
+              (double)float_offset, offset);
+        if (is_short)
+            CHECK(host_relative(integer_rms, float_rms) < TEST_AGREE_SHORT, "%llu rounds: sensor %d integer rms %.6f, float %.6f", (unsigned long long)rounds, i,
+                  (double)integer_rms, (double)float_rms);
+        free(signal.samples[i]);
+    }
+    printf("  %7llu samples/sensor: rms error (relative, worst sensor) integer %.1e, float %.1e\n", (unsigned long long)rounds, integer_error_max, float_error_max);
+    readings_term(&adc);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+
+    test_window(TEST_SAMPLES_FLOAT);
+    test_window(host_rounds_for(1.0));
+    test_window(host_rounds_for((double)REPORTINGS_PERIOD_MS / 1000.0));
+    test_window(host_rounds_for((double)SETTINGS_PERIOD_READ_MAX_MS / 1000.0));
+
+    return host_exit("test_float");
+}
@@ -0,0 +1,91 @@
+/*
+ * ESP32-S3 AC Power Monitor - test: noise floor subtraction, of known white noise on sines (with harmonics) and on idle
+ * channels, that the noise floor is estimated from the power outside the harmonics and subtracted in quadrature so as to
+ * recover the RMS of the clean signal, and so that an idle channel reads about 0 rather than its noise
+ */
+
+#include "host.h"
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define TEST_WINDOWS     (NOISE_FLOOR_WINDOWS + 4) // of REPORTINGS_PERIOD_MS, so the floor is averaged over as many as it can be
+#define TEST_OFFSET      1800.0                    // ADC counts
+#define TEST_QUANTISE    (1.0 / 12.0)              // ADC counts², noise power of rounding to whole counts
+#define TEST_ERROR_NOISE 0.05                      // relative, of the noise floor estimate
+#define TEST_ERROR_CLEAN 0.005                     // relative, of the subtracted RMS from the clean RMS
+#define TEST_ERROR_IDLE  0.25                      // of the noise RMS, of the subtracted RMS of an idle channel
+
+typedef struct {
+    double amplitude;    // ADC counts, 0 = idle
+    double harmonics[2]; // 3 and 5, relative to the fundamental
+    double noise;        // ADC counts RMS, white
+} test_channel_t;
+
+// currents then voltages, as sensors: voltages in range so that frequency is tracked, small currents where noise is a large part, and idle channels
+static const test_channel_t test_channels[NUM_SENSORS] = {
+    { .amplitude = 600.0, .noise = 4.0 },
+    { .amplitude = 50.0, .harmonics = { 0.3, 0.1 }, .noise = 6.0 },
+    { .amplitude = 20.0, .noise = 3.0 },
+    { .amplitude = 0.0, .noise = 5.0 },
+    { .amplitude = 0.0, .noise = 1.5 },
+    { .amplitude = 400.0, .noise = 3.0 },
+    { .amplitude = 380.0, .harmonics = { 0.05, 0.02 }, .noise = 5.0 },
+    { .amplitude = 400.0, .noise = 2.0 },
+    { .amplitude = 390.0, .noise = 7.0 },
+    { .amplitude = 0.0, .noise = 4.0 },
+};
+
+static double test_source(void *context, const int sensor, const double time) {
+    (void)context;
+    const test_channel_t *channel = &test_channels[sensor];
+    const double angle            = (2.0 * M_PI * 50.0 * time) - (sensor < NUM_DEVICES ? 0.5 : 0.0);
+    return TEST_OFFSET + (channel->amplitude * (sin(angle) + (channel->harmonics[0] * sin(3.0 * angle)) + (channel->harmonics[1] * sin(5.0 * angle)))) +
+           (channel->noise * host_gaussian());
+}
+
+static double test_clean(const test_channel_t *channel) {
+    return channel->amplitude * sqrt((1.0 + (channel->harmonics[0] * channel->harmonics[0]) + (channel->harmonics[1] * channel->harmonics[1])) / 2.0);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+
+    _Static_assert(NUM_SENSORS == 10, "test channels are for 5 devices");
+    static adc_system_t adc;
+    adc_result_t readings[NUM_DEVICES];
+    host_init(&adc);
+
+    const uint64_t rounds = host_rounds_for((double)REPORTINGS_PERIOD_MS / 1000.0);
+    for (int w = 0; w < TEST_WINDOWS; w++) {
+        host_frames(&adc, rounds, test_source, NULL);
+        (void)host_window(&adc, readings);
+    }
+
+    for (int sensor = 0; sensor < NUM_SENSORS; sensor++) {
+        const test_channel_t *channel = &test_channels[sensor];
+        const double noise = sqrt((channel->noise * channel->noise) + TEST_QUANTISE), clean = test_clean(channel), raw = sqrt((clean * clean) + (noise * noise));
+        const double estimate = (double)adc.noise[sensor], subtracted = (double)adc.rms[sensor];
+        CHECK(host_relative(estimate, noise) < TEST_ERROR_NOISE, "sensor %d: noise floor %.3f, expected %.3f", sensor, estimate, noise);
+        if (channel->amplitude > 0.0) {
+            CHECK(host_relative(subtracted, clean) < TEST_ERROR_CLEAN, "sensor %d: rms %.4f, clean %.4f (with noise %.4f)", sensor, subtracted, clean, raw);
+            printf("  sensor %d: clean %8.3f, with noise %8.3f (%+.2f%%), subtracted %8.3f (%+.3f%%), noise floor %.3f of %.3f\n", sensor, clean, raw,
+                   ((raw / clean) - 1.0) * 100.0, subtracted, ((subtracted / clean) - 1.0) * 100.0, estimate, noise);
+        } else {
+            CHECK(subtracted < TEST_ERROR_IDLE * noise, "sensor %d: idle rms %.4f, noise %.4f", sensor, subtracted, noise);
+            printf("  sensor %d: idle, with noise %8.3f, subtracted %8.3f, noise floor %.3f of %.3f\n", sensor, raw, subtracted, estimate, noise);
+        }
+    }
+    settings_scale_t scale;
+    settings_read(NULL, &scale);
+    for (int d = 0; d < NUM_DEVICES; d++)
+        if (test_channels[d].amplitude == 0.0) { // as reported: about 0A, not the noise scaled
+            const float noise = convert_adc_to_current((float)test_channels[d].noise, &scale, d);
+            const float limit = convert_adc_to_current((float)(TEST_ERROR_IDLE * test_channels[d].noise), &scale, d);
+            CHECK(readings[d].current_rms < limit, "device %d: idle current %.4fA, limit %.4fA", d, (double)readings[d].current_rms, (double)limit);
+            printf("  device %d: idle current %.4fA, of noise %.4fA\n", d, (double)readings[d].current_rms, (double)noise);
+        }
+
+    readings_term(&adc);
+    return host_exit("test_noise");
+}
@@ -0,0 +1,172 @@
+/*
+ * ESP32-S3 AC Power Monitor - test: phase angle of each method (built as test_phase_goertzel and test_phase_crossing, with
+ * PHASE_GOERTZEL 1 and 0) against known offsets between voltage and current, with harmonics and noise, and then against
+ * each other: each writes its angles to test_phase_<method>.out, and compares with those of the other if written
+ */
+
+#include "host.h"
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define TEST_AMPLITUDE_VOLTAGE 400.0  // ADC counts, ~230V at the default scale: in range, so tracked for frequency
+#define TEST_OFFSET            1800.0 // ADC counts
+#define TEST_NOISE             3.0    // ADC counts RMS, white
+#define TEST_ERROR_GOERTZEL(f) 0.1    // degrees, from the known offset: of the fundamental, with the conversion skew removed
+// degrees: crossings in whole samples (4.5° at 50Hz), and the skew of voltage after current (half a sample) not removed
+#define TEST_ERROR_CROSSING(f) ((360.0 * (f) / ADC_SENSOR_RATE_HZ) * (1.0 + ((double)ADC_SKEW_SLOTS / NUM_SENSORS)))
+#define TEST_ERROR_AGREE(f)    (TEST_ERROR_GOERTZEL(f) + TEST_ERROR_CROSSING(f))
+#define TEST_CASES_MAX         32
+
+#if PHASE_GOERTZEL
+#define TEST_METHOD       "goertzel"
+#define TEST_METHOD_OTHER "crossing"
+#define TEST_ERROR        TEST_ERROR_GOERTZEL
+#else
+#define TEST_METHOD       "crossing"
+#define TEST_METHOD_OTHER "goertzel"
+#define TEST_ERROR        TEST_ERROR_CROSSING
+#endif
+
+typedef struct {
+    double frequency, phase, amplitude, harmonics[3]; // harmonics 3, 5, 7 relative to the fundamental of the current
+    double noise;
+} test_signal_t;
+
+// harmonics in sine phase with the fundamental of the current, so that its zero crossings stay those of the fundamental: where crossing phase
+// is of the fundamental as Goertzel phase is, so the two can be compared (else crossings measure the distorted waveform, by design)
+static double test_source(void *context, const int sensor, const double time) {
+    const test_signal_t *signal = (const test_signal_t *)context;
+    const double angle          = 2.0 * M_PI * signal->frequency * time;
+    double value;
+    if (sensor >= NUM_DEVICES)
+        value = TEST_AMPLITUDE_VOLTAGE * sin(angle);
+    else {
+        const double lagged = angle - (signal->phase * M_PI / 180.0), amplitude = signal->amplitude * (1.0 - (0.1 * sensor)); // devices differ
+        value               = amplitude * (sin(lagged) + (signal->harmonics[0] * sin(3.0 * lagged)) + (signal->harmonics[1] * sin(5.0 * lagged)) +
+                             (signal->harmonics[2] * sin(7.0 * lagged)));
+    }
+    return TEST_OFFSET + value + (signal->noise * host_gaussian());
+}
+
+static double test_difference(const double a, const double b) { return fabs(remainder(a - b, 360.0)); }
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static double test_results[TEST_CASES_MAX][NUM_DEVICES], test_frequencies[TEST_CASES_MAX];
+static int test_cases;
+
+static void test_case(const char *name, test_signal_t *signal) {
+
+    static adc_system_t adc;
+    adc_result_t readings[NUM_DEVICES];
+    host_init(&adc);
+
+    // windows first, as at boot: the first feeds back crossing levels and the voltage to track, the second the frequency, then the window measured
+    const uint64_t rounds = host_rounds_for((double)REPORTINGS_PERIOD_MS / 1000.0);
+    for (int w = 0; w < 2; w++) {
+        host_frames(&adc, rounds, test_source, signal);
+        (void)host_window(&adc, readings);
+    }
+    host_frames(&adc, rounds, test_source, signal);
+    const adc_report_t *report = host_window(&adc, readings);
+
+    CHECK(report->frequency_measured && fabs((double)report->frequency - signal->frequency) < 0.01, "%s: frequency %.3f, expected %.3f", name,
+          (double)report->frequency, signal->frequency);
+    double error_max = 0.0;
+    for (int d = 0; d < NUM_DEVICES; d++) {
+        const double phase = (double)readings[d].phase_angle, error = test_difference(phase, signal->phase);
+        error_max          = fmax(error_max, error);
+        CHECK(report->phase[d].count > 0, "%s: device %d no phase", name, d);
+        CHECK(error < TEST_ERROR(signal->frequency), "%s: device %d phase %.3f, expected %.3f", name, d, phase, signal->phase);
+        test_results[test_cases][d] = phase;
+    }
+    test_frequencies[test_cases] = signal->frequency;
+    printf("  %-24s phase %7.2f, %s error %.2f (within %.2f)\n", name, signal->phase, TEST_METHOD, error_max, TEST_ERROR(signal->frequency));
+    test_cases++;
+    readings_term(&adc);
+}
+
+// a window after a step in frequency is reported with the tuning it was acquired at, not that readings_end retunes to for the next
+static void test_step(void) {
+
+    static adc_system_t adc;
+    adc_result_t readings[NUM_DEVICES];
+    host_init(&adc);
+    test_signal_t signal  = { .frequency = 50.0, .phase = 30.0, .amplitude = 800.0 };
+    const uint64_t rounds = host_rounds_for((double)REPORTINGS_PERIOD_MS / 1000.0);
+    for (int w = 0; w < 2; w++) {
+        host_frames(&adc, rounds, test_source, &signal);
+        (void)host_window(&adc, readings);
+    }
+    const uint32_t length = adc.goertzel_length;
+    signal.frequency      = 60.0;
+    host_frames(&adc, rounds, test_source, &signal);
+    const adc_report_t *report = host_window(&adc, readings);
+    CHECK(fabs((double)report->frequency - 60.0) < 0.1 && adc.goertzel_length != length, "step: frequency %.3f, not retuned", (double)report->frequency);
+    CHECK(report->goertzel_length == length && fabs((double)report->goertzel_frequency - 50.0) < 0.01, "step: reported length %lu at %.3f, acquired %lu at 50",
+          (unsigned long)report->goertzel_length, (double)report->goertzel_frequency, (unsigned long)length);
+    readings_term(&adc);
+}
+
+// angles of the other method, by case and device, as written by test_write
+static void test_compare(const char *path) {
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("  %s not written: no comparison with " TEST_METHOD_OTHER " (run test_phase_" TEST_METHOD_OTHER ")\n", path);
+        return;
+    }
+    double error_max = 0.0;
+    int compared     = 0;
+    for (int c = 0; c < test_cases; c++)
+        for (int d = 0; d < NUM_DEVICES; d++) {
+            double other;
+            if (fscanf(file, "%lf", &other) != 1)
+                break;
+            const double error = test_difference(test_results[c][d], other);
+            error_max          = fmax(error_max, error);
+            CHECK(error < TEST_ERROR_AGREE(test_frequencies[c]), "case %d: device %d phase %.3f, " TEST_METHOD_OTHER " %.3f", c, d, test_results[c][d], other);
+            compared++;
+        }
+    fclose(file);
+    CHECK(compared == test_cases * NUM_DEVICES, "%s: %d angles, expected %d", path, compared, test_cases * NUM_DEVICES);
+    printf("  against " TEST_METHOD_OTHER ": %d angles, largest difference %.2f (within %.2f at 50Hz)\n", compared, error_max, TEST_ERROR_AGREE(50.0));
+}
+
+static void test_write(const char *path) {
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        CHECK(false, "%s: cannot write", path);
+        return;
+    }
+    for (int c = 0; c < test_cases; c++)
+        for (int d = 0; d < NUM_DEVICES; d++)
+            fprintf(file, "%.6f\n", test_results[c][d]);
+    fclose(file);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+
+    const double phases[] = { 0.0, 30.0, 60.0, 90.0, 150.0, -20.0, -75.0 }; // current lagging (inductive) and leading (capacitive)
+    for (size_t p = 0; p < sizeof(phases) / sizeof(phases[0]); p++) {
+        char name[64];
+        snprintf(name, sizeof(name), "clean %+.0f", phases[p]);
+        test_case(name, &(test_signal_t) { .frequency = 50.0, .phase = phases[p], .amplitude = 1200.0 });
+        snprintf(name, sizeof(name), "noise %+.0f", phases[p]);
+        test_case(name, &(test_signal_t) { .frequency = 50.0, .phase = phases[p], .amplitude = 600.0, .noise = TEST_NOISE });
+        snprintf(name, sizeof(name), "harmonics %+.0f", phases[p]);
+        test_case(name, &(test_signal_t) { .frequency = 50.0, .phase = phases[p], .amplitude = 800.0, .harmonics = { 0.3, 0.15, 0.05 }, .noise = TEST_NOISE });
+    }
+    test_case("off nominal 47.5Hz +40", &(test_signal_t) { .frequency = 47.5, .phase = 40.0, .amplitude = 800.0, .harmonics = { 0.2, 0.1, 0.0 }, .noise = TEST_NOISE });
+    test_case("off nominal 60Hz +40", &(test_signal_t) { .frequency = 60.0, .phase = 40.0, .amplitude = 800.0, .harmonics = { 0.2, 0.1, 0.0 }, .noise = TEST_NOISE });
+
+    test_step();
+
+    test_compare("test_phase_" TEST_METHOD_OTHER ".out");
+    test_write("test_phase_" TEST_METHOD ".out");
+
+    return host_exit("test_phase_" TEST_METHOD);
+}
@@ -0,0 +1,247 @@
+/*
+ * ESP32-S3 AC Power Monitor - test: binary protocol framing (powermon_protocol.h), round trips of every record type at the
+ * sizes the firmware sends, COBS over runs of zeros and of non-zeros, and rejection of corrupted, truncated and empty frames
+ */
+
+#include "host.h"
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define TEST_CORRUPTIONS 4 // values xored into each byte of a frame in turn
+
+static void test_random(uint8_t *data, const size_t length, const double zeros) {
+    for (size_t i = 0; i < length; i++)
+        data[i] = host_uniform() < zeros ? 0 : (uint8_t)(1 + (host_uniform() * 255.0));
+}
+
+static bool test_delimited(const uint8_t *frame, const size_t size) {
+    if (size < 2 || frame[0] != PROTOCOL_DELIMITER || frame[size - 1] != PROTOCOL_DELIMITER)
+        return false;
+    for (size_t i = 1; i < size - 1; i++)
+        if (frame[i] == PROTOCOL_DELIMITER)
+            return false;
+    return true;
+}
+
+// record of a type with a body of random content: returns record size (without CRC)
+static size_t test_record(uint8_t *record, const protocol_type_t type, const size_t body, const uint64_t counter) {
+    protocol_header_t *header = (protocol_header_t *)record;
+    header->type              = (uint8_t)type;
+    header->version           = PROTOCOL_VERSION;
+    header->length            = (uint16_t)body;
+    header->timestamp         = (int64_t)(host_uniform() * 1e12);
+    header->counter           = counter;
+    test_random(&record[sizeof(protocol_header_t)], body, 0.3);
+    return sizeof(protocol_header_t) + body;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static void test_crc(void) {
+    const char *check = "123456789";
+    CHECK(protocol_crc16((const uint8_t *)check, strlen(check)) == 0x29B1, "CRC-16/CCITT-FALSE of \"123456789\" is 0x%04X, expected 0x29B1",
+          protocol_crc16((const uint8_t *)check, strlen(check)));
+    CHECK(protocol_crc16(NULL, 0) == 0xFFFF, "CRC of nothing is the initial value");
+}
+
+static void test_cobs_round(const char *name, const uint8_t *data, const size_t length) {
+    static uint8_t encoded[PROTOCOL_FRAME_MAX * 2], decoded[PROTOCOL_FRAME_MAX * 2];
+    const size_t size = protocol_cobs_encode(data, length, encoded);
+    CHECK(size <= length + (length / 254) + 1, "%s (%zu bytes): encoded in %zu bytes, over the overhead", name, length, size);
+    bool zeros = false;
+    for (size_t i = 0; i < size; i++)
+        zeros |= encoded[i] == 0;
+    CHECK(!zeros, "%s (%zu bytes): encoded has zeros", name, length);
+    const size_t decoded_length = protocol_cobs_decode(encoded, size, decoded, sizeof(decoded));
+    CHECK(decoded_length == length && memcmp(decoded, data, length) == 0, "%s (%zu bytes): decoded %zu bytes, not as encoded", name, length, decoded_length);
+    if (length > 0)
+        CHECK(protocol_cobs_decode(encoded, size, decoded, length - 1) == 0, "%s (%zu bytes): decoded into too small a buffer", name, length);
+}
+
+static void test_cobs(void) {
+    static uint8_t data[PROTOCOL_RECORD_MAX * 2];
+
+    // runs of zeros, each a code byte
+    memset(data, 0, sizeof(data));
+    for (size_t length = 1; length <= 600; length++)
+        test_cobs_round("zeros", data, length);
+
+    // runs of non-zeros about the 254 of a full block, alone and between zeros
+    const size_t runs[] = { 1, 253, 254, 255, 256, 507, 508, 509, 762, PROTOCOL_RECORD_MAX };
+    for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+        memset(data, 0xA5, runs[r]);
+        test_cobs_round("non-zeros", data, runs[r]);
+        data[0] = 0;
+        memset(&data[1], 0xA5, runs[r]);
+        data[runs[r] + 1] = 0;
+        test_cobs_round("zero, non-zeros, zero", data, runs[r] + 2);
+        memset(data, 0x01, runs[r]);
+        memset(&data[runs[r]], 0x00, 3);
+        memset(&data[runs[r] + 3], 0xFF, runs[r]);
+        test_cobs_round("non-zeros, zeros, non-zeros", data, (runs[r] * 2) + 3);
+    }
+
+    // mixed, from no zeros to all zeros
+    for (int i = 0; i <= 20; i++) {
+        const size_t length = (size_t)(host_uniform() * PROTOCOL_RECORD_MAX);
+        test_random(data, length, (double)i / 20.0);
+        test_cobs_round("random", data, length);
+    }
+    test_cobs_round("empty", data, 0);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    const char *name;
+    protocol_type_t type;
+    size_t body;
+} test_type_t;
+
+static const test_type_t test_types[] = {
+    { "INIT", PROTOCOL_TYPE_INIT, sizeof(protocol_init_t) + (NUM_DEVICES * sizeof(protocol_calibration_t)) },
+    { "TERM", PROTOCOL_TYPE_TERM, 0 },
+    { "READ", PROTOCOL_TYPE_READ, sizeof(protocol_read_t) + (NUM_DEVICES * sizeof(protocol_read_device_t)) },
+    { "HARM", PROTOCOL_TYPE_HARM, sizeof(protocol_harm_t) + (NUM_DEVICES * 2 * sizeof(protocol_harmonics_t)) },
+    { "DIAG", PROTOCOL_TYPE_DIAG, sizeof(protocol_diag_t) + (NUM_DEVICES * 2 * sizeof(protocol_diag_sensor_t)) },
+    { "FAIL", PROTOCOL_TYPE_FAIL, sizeof(protocol_fail_t) },
+    { "CYCL", PROTOCOL_TYPE_CYCL, sizeof(protocol_cycle_t) + (NUM_DEVICES * sizeof(protocol_cycle_device_t)) },
+    { "CMND", PROTOCOL_TYPE_CMND, sizeof(protocol_command_t) },
+    { "CAPT", PROTOCOL_TYPE_CAPT, sizeof(protocol_capture_t) + (CAPTURE_CHUNK_SAMPLES * sizeof(uint16_t)) },
+    { "EVNT", PROTOCOL_TYPE_EVNT, sizeof(protocol_event_t) },
+    { "PERF", PROTOCOL_TYPE_PERF, sizeof(protocol_perf_t) },
+};
+#define TEST_TYPES (sizeof(test_types) / sizeof(test_types[0]))
+
+static void test_types_round(void) {
+    static uint8_t record[PROTOCOL_RECORD_MAX], decoded[PROTOCOL_RECORD_MAX], frame[PROTOCOL_FRAME_MAX];
+    CHECK(TEST_TYPES == PROTOCOL_TYPE_PERF, "%zu record types tested, of %d", TEST_TYPES, PROTOCOL_TYPE_PERF);
+    for (size_t t = 0; t < TEST_TYPES; t++) {
+        const test_type_t *type = &test_types[t];
+        CHECK(sizeof(protocol_header_t) + type->body + PROTOCOL_CRC_SIZE <= PROTOCOL_RECORD_MAX, "%s: record of %zu bytes over the maximum", type->name,
+              sizeof(protocol_header_t) + type->body + PROTOCOL_CRC_SIZE);
+        for (int i = 0; i < 16; i++) {
+            const size_t size  = test_record(record, type->type, type->body, (uint64_t)i);
+            const size_t count = protocol_frame_encode(record, size, frame);
+            CHECK(count <= PROTOCOL_FRAME_MAX && test_delimited(frame, count), "%s: frame of %zu bytes not delimited, or over the maximum", type->name, count);
+            const size_t length = protocol_frame_decode(&frame[1], count - 2, decoded, sizeof(decoded));
+            CHECK(length == size && memcmp(decoded, record, size) == 0, "%s: decoded %zu bytes, not the %zu encoded", type->name, length, size);
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+static void test_invalid(void) {
+    static uint8_t record[PROTOCOL_RECORD_MAX], decoded[PROTOCOL_RECORD_MAX], frame[PROTOCOL_FRAME_MAX];
+    const uint8_t corruptions[TEST_CORRUPTIONS] = { 0x01, 0x80, 0xFF, 0x5A };
+    int codes_corrupted = 0, codes_accepted = 0;
+
+    for (size_t t = 0; t < TEST_TYPES; t++) {
+        const test_type_t *type = &test_types[t];
+        const size_t size       = test_record(record, type->type, type->body, t);
+        const size_t count      = protocol_frame_encode(record, size, frame);
+        uint8_t *content        = &frame[1];
+        const size_t length     = count - 2;
+
+        // a corrupted byte, anywhere: not to 0x00, as that would delimit (a truncated frame, below). Of a data byte it is a one byte
+        // error in the record, which the CRC always detects; of a COBS code byte it moves zeros about the record, which it misses at
+        // the chance of a 16-bit CRC, so those are counted over all types
+        bool code[PROTOCOL_FRAME_MAX] = { false };
+        for (size_t i = 0; i < length; i += content[i])
+            code[i] = true;
+        int accepted = 0;
+        for (size_t i = 0; i < length; i++)
+            for (int c = 0; c < TEST_CORRUPTIONS; c++) {
+                const uint8_t original = content[i];
+                content[i] ^= corruptions[c];
+                if (content[i] != PROTOCOL_DELIMITER) {
+                    const bool decodes = protocol_frame_decode(content, length, decoded, sizeof(decoded)) != 0;
+                    if (code[i]) {
+                        codes_corrupted++;
+                        codes_accepted += decodes ? 1 : 0;
+                    } else
+                        accepted += decodes ? 1 : 0;
+                }
+                content[i] = original;
+            }
+        CHECK(accepted == 0, "%s: %d frames with a corrupted data byte accepted", type->name, accepted);
+
+        // truncated, at every length
+        accepted = 0;
+        for (size_t i = 0; i < length; i++)
+            if (protocol_frame_decode(content, i, decoded, sizeof(decoded)) != 0)
+                accepted++;
+        CHECK(accepted == 0, "%s: %d truncated frames accepted", type->name, accepted);
+
+        // version, and length of body against the record
+        ((protocol_header_t *)record)->version = PROTOCOL_VERSION + 1;
+        size_t rejected                        = protocol_frame_encode(record, size, frame);
+        CHECK(protocol_frame_decode(&frame[1], rejected - 2, decoded, sizeof(decoded)) == 0, "%s: other version accepted", type->name);
+        ((protocol_header_t *)record)->version = PROTOCOL_VERSION;
+        ((protocol_header_t *)record)->length++;
+        rejected = protocol_frame_encode(record, size, frame);
+        CHECK(protocol_frame_decode(&frame[1], rejected - 2, decoded, sizeof(decoded)) == 0, "%s: body length over the record accepted", type->name);
+    }
+    CHECK(codes_accepted <= 1 + (codes_corrupted / 4096), "%d of %d frames with a corrupted code byte accepted, expected 1 in 65536", codes_accepted, codes_corrupted);
+}
+
+// frames out of a stream as the client splits them: content between delimiters, any run of delimiters separating, with text lines between
+static int test_stream_frames(const uint8_t *stream, const size_t length, int *rejected) {
+    static uint8_t decoded[PROTOCOL_RECORD_MAX];
+    int frames   = 0;
+    size_t start = 0;
+    *rejected    = 0;
+    for (size_t i = 0; i <= length; i++)
+        if (i == length || stream[i] == PROTOCOL_DELIMITER) {
+            if (i > start && stream[start] != '#') { // text line, else frame content
+                if (protocol_frame_decode(&stream[start], i - start, decoded, sizeof(decoded)) != 0)
+                    frames++;
+                else
+                    (*rejected)++;
+            }
+            start = i + 1;
+        }
+    return frames;
+}
+
+static void test_stream(void) {
+    static uint8_t record[PROTOCOL_RECORD_MAX], stream[PROTOCOL_FRAME_MAX * 8];
+    const char *text = "# text line between frames\r\n";
+    size_t length    = 0;
+
+    // back to back frames share no delimiter: 0x00 0x00 between, with a run of three and text between others
+    for (int i = 0; i < 4; i++) {
+        const size_t size = test_record(record, PROTOCOL_TYPE_READ, test_types[2].body, (uint64_t)i);
+        length += protocol_frame_encode(record, size, &stream[length]);
+        if (i == 1)
+            stream[length++] = PROTOCOL_DELIMITER;
+        if (i == 2) {
+            memcpy(&stream[length], text, strlen(text));
+            length += strlen(text);
+        }
+    }
+    int rejected;
+    int frames = test_stream_frames(stream, length, &rejected);
+    CHECK(frames == 4 && rejected == 0, "back to back: %d frames, %d rejected, expected 4 and 0", frames, rejected);
+
+    // a frame cut short by loss, then the next resynchronises at its delimiter
+    const size_t cut = length / 3;
+    memmove(&stream[cut], &stream[cut + 40], length - cut - 40);
+    length -= 40;
+    frames = test_stream_frames(stream, length, &rejected);
+    CHECK(frames == 3 && rejected == 1, "truncated in stream: %d frames, %d rejected, expected 3 and 1", frames, rejected);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+
+    test_crc();
+    test_cobs();
+    test_types_round();
+    test_invalid();
+    test_stream();
+
+    return host_exit("test_protocol");
+}
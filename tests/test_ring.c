@@ -0,0 +1,184 @@
+/*
+ * ESP32-S3 AC Power Monitor - test: ring (powermon_ring.h) under a producer and a consumer thread, of sequenced records
+ * through small capacities so that indices wrap many times, for loss, reordering or torn slots; and the sequence count
+ * under a writer and a reader thread, for torn copies
+ */
+
+#include "host.h"
+#include <pthread.h>
+#include <sched.h>
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define TEST_RECORDS  500000  // through each ring
+#define TEST_PAYLOAD  13      // words, so records are not a power of two in size
+#define TEST_WRITES   1000000 // of the sequence counted data
+#define TEST_SEQCOUNT 16      // words of the sequence counted data
+
+typedef struct {
+    uint32_t sequence;
+    uint32_t payload[TEST_PAYLOAD]; // each from the sequence, so a slot read while being written does not match
+    uint32_t check;
+} test_record_t;
+
+typedef struct {
+    ring_t ring;
+    uint64_t full, empty;                    // waits, by producer and consumer
+    uint32_t received, lost, reordered, torn; // by consumer
+} test_ring_t;
+
+static uint32_t test_word(const uint32_t sequence, const int i) { return (sequence * 2654435761U) ^ (uint32_t)(i * 40503); }
+
+static void *test_producer(void *context) {
+    test_ring_t *test = (test_ring_t *)context;
+    for (uint32_t sequence = 0; sequence < TEST_RECORDS; sequence++) {
+        test_record_t *record;
+        while ((record = (test_record_t *)ring_write_begin(&test->ring)) == NULL) {
+            test->full++;
+            sched_yield(); // as the consumer may share the core
+        }
+        record->sequence = sequence;
+        record->check    = sequence;
+        for (int i = 0; i < TEST_PAYLOAD; i++) {
+            record->payload[i] = test_word(sequence, i);
+            record->check ^= record->payload[i];
+        }
+        ring_write_end(&test->ring);
+    }
+    return NULL;
+}
+
+static void *test_consumer(void *context) {
+    test_ring_t *test = (test_ring_t *)context;
+    uint32_t expected = 0;
+    while (expected < TEST_RECORDS) {
+        const test_record_t *record;
+        while ((record = (const test_record_t *)ring_read_begin(&test->ring)) == NULL) {
+            test->empty++;
+            sched_yield();
+        }
+        const test_record_t copy = *record;
+        ring_read_end(&test->ring);
+        uint32_t check = copy.sequence;
+        bool torn      = false;
+        for (int i = 0; i < TEST_PAYLOAD; i++) {
+            check ^= copy.payload[i];
+            torn |= copy.payload[i] != test_word(copy.sequence, i);
+        }
+        if (torn || check != copy.check)
+            test->torn++;
+        if (copy.sequence > expected)
+            test->lost += copy.sequence - expected;
+        else if (copy.sequence < expected)
+            test->reordered++;
+        expected = copy.sequence + 1;
+        test->received++;
+    }
+    return NULL;
+}
+
+static void test_ring(const uint32_t capacity) {
+
+    static test_ring_t test;
+    static test_record_t storage[64];
+    memset(&test, 0, sizeof(test));
+    CHECK(capacity <= sizeof(storage) / sizeof(storage[0]) && ring_init(&test.ring, storage, sizeof(test_record_t), capacity), "capacity %lu: ring_init",
+          (unsigned long)capacity);
+
+    pthread_t producer, consumer;
+    CHECK(pthread_create(&consumer, NULL, test_consumer, &test) == 0 && pthread_create(&producer, NULL, test_producer, &test) == 0, "capacity %lu: threads",
+          (unsigned long)capacity);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    CHECK(test.received == TEST_RECORDS && test.lost == 0 && test.reordered == 0 && test.torn == 0,
+          "capacity %lu: %lu received of %d, %lu lost, %lu reordered, %lu torn", (unsigned long)capacity, (unsigned long)test.received, TEST_RECORDS,
+          (unsigned long)test.lost, (unsigned long)test.reordered, (unsigned long)test.torn);
+    CHECK(ring_count(&test.ring) == 0 && ring_read_begin(&test.ring) == NULL, "capacity %lu: not empty after", (unsigned long)capacity);
+    printf("  capacity %2lu: %d records, wrapped %lu times, producer waited %llu times, consumer %llu\n", (unsigned long)capacity, TEST_RECORDS,
+           (unsigned long)(TEST_RECORDS / capacity), (unsigned long long)test.full, (unsigned long long)test.empty);
+}
+
+static void test_ring_bounds(void) {
+
+    static test_record_t storage[4];
+    ring_t ring;
+    CHECK(!ring_init(&ring, storage, sizeof(test_record_t), 0) && !ring_init(&ring, storage, sizeof(test_record_t), 3), "capacity not a power of two accepted");
+    CHECK(ring_init(&ring, storage, sizeof(test_record_t), 4), "capacity 4");
+    for (int i = 0; i < 4; i++) {
+        CHECK(ring_write_begin(&ring) != NULL, "slot %d of 4", i);
+        ring_write_end(&ring);
+    }
+    CHECK(ring_write_begin(&ring) == NULL && ring_count(&ring) == 4, "full ring not full");
+    ring_read_end(&ring);
+    CHECK(ring_write_begin(&ring) == &storage[0] && ring_count(&ring) == 3, "slot after wrap not the first");
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    seqcount_t sequence;
+    uint32_t data[TEST_SEQCOUNT]; // all the same, as written
+    volatile bool done;
+    uint64_t copies, retries, torn;
+} test_seqcount_t;
+
+static void *test_writer(void *context) {
+    test_seqcount_t *test = (test_seqcount_t *)context;
+    for (uint32_t n = 1; n <= TEST_WRITES; n++) {
+        seqcount_write_begin(&test->sequence);
+        for (int i = 0; i < TEST_SEQCOUNT; i++)
+            ((volatile uint32_t *)test->data)[i] = n;
+        seqcount_write_end(&test->sequence);
+    }
+    test->done = true;
+    return NULL;
+}
+
+static void *test_reader(void *context) {
+    test_seqcount_t *test = (test_seqcount_t *)context;
+    while (!test->done) {
+        uint32_t copy[TEST_SEQCOUNT], sequence;
+        while (true) {
+            sequence = seqcount_read_begin(&test->sequence);
+            for (int i = 0; i < TEST_SEQCOUNT; i++)
+                copy[i] = ((volatile uint32_t *)test->data)[i];
+            if (!seqcount_read_retry(&test->sequence, sequence))
+                break;
+            test->retries++;
+        }
+        for (int i = 1; i < TEST_SEQCOUNT; i++)
+            if (copy[i] != copy[0]) {
+                test->torn++;
+                break;
+            }
+        test->copies++;
+    }
+    return NULL;
+}
+
+static void test_seqcount(void) {
+
+    static test_seqcount_t test;
+    atomic_init(&test.sequence, 0);
+    pthread_t writer, reader;
+    CHECK(pthread_create(&reader, NULL, test_reader, &test) == 0 && pthread_create(&writer, NULL, test_writer, &test) == 0, "seqcount: threads");
+    pthread_join(writer, NULL);
+    pthread_join(reader, NULL);
+    CHECK(test.torn == 0, "seqcount: %llu of %llu copies torn", (unsigned long long)test.torn, (unsigned long long)test.copies);
+    CHECK(atomic_load(&test.sequence) == 2U * TEST_WRITES, "seqcount: sequence %lu after %d writes", (unsigned long)atomic_load(&test.sequence), TEST_WRITES);
+    printf("  seqcount: %d writes, %llu copies, %llu retried\n", TEST_WRITES, (unsigned long long)test.copies, (unsigned long long)test.retries);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+
+    test_ring_bounds();
+    const uint32_t capacities[] = { 1, 2, 4, 16 };
+    for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++)
+        test_ring(capacities[c]);
+    test_seqcount();
+
+    return host_exit("test_ring");
+}